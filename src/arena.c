@@ -0,0 +1,121 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+// newBlock allocates a block with room for at least size bytes
+static arenaBlock_t *newBlock(size_t size)
+{
+    arenaBlock_t *block = malloc(sizeof(arenaBlock_t));
+    if (block == NULL)
+        return NULL;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (posix_memalign((void **)&block->data, ARENA_ALIGN, size) != 0)
+    {
+        free(block);
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+// freeBlocks frees a list of blocks
+static void freeBlocks(arenaBlock_t *block)
+{
+    while (block != NULL)
+    {
+        arenaBlock_t *next = block->next;
+        free(block->data);
+        free(block);
+        block = next;
+    }
+}
+
+/*
+    arenaInit creates an arena
+    arguments:
+        blockSize - the size of the first block (and the smallest block that is added)
+        maxRetain - the most memory the arena keeps when it is reset
+*/
+arena_t *arenaInit(size_t blockSize, size_t maxRetain)
+{
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (arena == NULL)
+        return NULL;
+    arena->blockSize = blockSize;
+    arena->maxRetain = maxRetain > blockSize ? maxRetain : blockSize;
+    arena->head = newBlock(blockSize);
+    if (arena->head == NULL)
+    {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+/*
+    arenaAlloc returns size bytes (aligned to ARENA_ALIGN) from the arena, or NULL if it can't grow
+    - the memory is not zeroed and stays valid until the next arenaReset
+    - a new block is only added when the current one is full, and it is at least as big as everything so far
+*/
+void *arenaAlloc(arena_t *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arenaBlock_t *block = arena->head;
+    if (block == NULL || block->size - block->used < size)
+    {
+        size_t blockSize = arena->blockSize;
+        if (block != NULL && blockSize < arenaCapacity(arena))
+            blockSize = arenaCapacity(arena);
+        if (blockSize < size)
+            blockSize = size;
+        if ((block = newBlock(blockSize)) == NULL)
+            return NULL;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/*
+    arenaReset frees everything that was allocated from the arena in one go
+    - if the arena had to grow, the blocks are swapped for a single block of the combined size, so the next read of
+      the same size is served without touching malloc
+    - the combined block is capped at maxRetain, so RSS stays flat after the odd very long read
+*/
+void arenaReset(arena_t *arena)
+{
+    arenaBlock_t *block = arena->head;
+    if (block != NULL && block->next == NULL && block->size <= arena->maxRetain)
+    {
+        block->used = 0;
+        return;
+    }
+    size_t size = arenaCapacity(arena);
+    if (size > arena->maxRetain)
+        size = arena->blockSize;
+    freeBlocks(arena->head);
+    arena->head = newBlock(size);
+}
+
+// arenaCapacity returns the number of bytes held by the arena
+size_t arenaCapacity(arena_t *arena)
+{
+    size_t size = 0;
+    arenaBlock_t *block;
+    for (block = arena->head; block != NULL; block = block->next)
+        size += block->size;
+    return size;
+}
+
+// arenaDestroy frees an arena and all its blocks
+void arenaDestroy(arena_t *arena)
+{
+    if (arena == NULL)
+        return;
+    freeBlocks(arena->head);
+    free(arena);
+}
@@ -0,0 +1,42 @@
+// arena is a bump allocator for per-read scratch, which is reset (rather than freed) between reads
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// ARENA_ALIGN is the alignment of every allocation (a cache line, which also suits AVX loads)
+#define ARENA_ALIGN 64
+
+// ARENA_BLOCK_SIZE is the size of the first block, and the smallest block that is allocated
+#define ARENA_BLOCK_SIZE 1048576
+
+// ARENA_MAX_RETAIN is the most that is kept over a reset (anything bigger is given back, so one huge read doesn't pin memory)
+#define ARENA_MAX_RETAIN 16777216
+
+// arenaBlock_t is a chunk of memory that allocations are bumped out of
+typedef struct arenaBlock
+{
+    struct arenaBlock *next;
+    unsigned char *data;
+    size_t size;
+    size_t used;
+} arenaBlock_t;
+
+// arena_t is a list of blocks, newest first
+typedef struct arena
+{
+    arenaBlock_t *head;
+    size_t blockSize;
+    size_t maxRetain;
+} arena_t;
+
+/*
+    function prototypes
+*/
+arena_t *arenaInit(size_t blockSize, size_t maxRetain);
+void *arenaAlloc(arena_t *arena, size_t size);
+void arenaReset(arena_t *arena);
+size_t arenaCapacity(arena_t *arena);
+void arenaDestroy(arena_t *arena);
+
+#endif
@@ -11,27 +11,34 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "bloom.h"
+#include "kmerhash.h"
 #include "murmurhash2.h"
 
 #define MAKESTRING(n) STRING(n)
 #define STRING(n) #n
 
+/*
+ * The bit array is accessed as 64 bit words. Adds set bits with an atomic
+ * fetch-or, so several threads can build the same filter without locking.
+ */
 inline static int test_bit_set_bit(unsigned char *buf,
-                                   unsigned int x, int set_bit)
+                                   uint64_t x, int set_bit)
 {
-  unsigned int byte = x >> 3;
-  unsigned char c = buf[byte]; // expensive memory access
-  unsigned int mask = 1 << (x % 8);
+  uint64_t *word = (uint64_t *)buf + (x >> 6);
+  uint64_t mask = 1ULL << (x & 63);
+  uint64_t c = __atomic_load_n(word, __ATOMIC_RELAXED); // expensive memory access
 
   if (c & mask)
   {
@@ -41,30 +48,60 @@ inline static int test_bit_set_bit(unsigned char *buf,
   {
     if (set_bit)
     {
-      buf[byte] = c | mask;
+      c = __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+      return (c & mask) != 0;
     }
     return 0;
   }
 }
 
-static int bloom_check_add(struct bloom *bloom,
-                           const void *buffer, int len, int add)
+/*
+ * The 64 bit element hash is split into the double hashing pair: the high
+ * and low words of the hash swap places to give the second hash. Positions
+ * are reduced onto the bit array with a multiply-shift instead of a modulo,
+ * which also lets filters grow beyond 2^32 bits.
+ */
+static int bloom_check_add_hash(struct bloom *bloom, uint64_t hash, int add)
 {
   if (bloom->ready == 0)
   {
     printf("bloom at %p not initialized!\n", (void *)bloom);
     return -1;
   }
+  if (add && bloom->frozen)
+  {
+    return -1;
+  }
 
   int hits = 0;
-  register unsigned int a = murmurhash2(buffer, len, 0x9747b28c);
-  register unsigned int b = murmurhash2(buffer, len, a);
-  register unsigned int x;
+  register uint64_t a = hash;
+  register uint64_t b = (hash << 32) | (hash >> 32);
+  register uint64_t x;
   register unsigned int i;
 
+  // blocked filters keep every position for this element inside one block
+  if (bloom->type == BLOOM_BLOCKED)
+  {
+    uint64_t block = (uint64_t)(((unsigned __int128)a * bloom->blocks) >> 64) * BLOOM_BLOCK_BITS;
+    for (i = 0; i < bloom->hashes; i++)
+    {
+      b *= 0x9E3779B97F4A7C15ULL;
+      x = block + (b >> 55);
+      if (test_bit_set_bit(bloom->bf, x, add))
+      {
+        hits++;
+      }
+      else if (!add)
+      {
+        return 0;
+      }
+    }
+    return hits == bloom->hashes;
+  }
+
   for (i = 0; i < bloom->hashes; i++)
   {
-    x = (a + i * b) % bloom->bits;
+    x = (uint64_t)(((unsigned __int128)(a + i * b) * bloom->bits) >> 64);
     if (test_bit_set_bit(bloom->bf, x, add))
     {
       hits++;
@@ -84,6 +121,14 @@ static int bloom_check_add(struct bloom *bloom,
   return 0;
 }
 
+static int bloom_check_add(struct bloom *bloom,
+                           const void *buffer, int len, int add)
+{
+  register unsigned int a = murmurhash2(buffer, len, 0x9747b28c);
+  register unsigned int b = murmurhash2(buffer, len, a);
+  return bloom_check_add_hash(bloom, ((uint64_t)a << 32) | b, add);
+}
+
 int bloom_init_size(struct bloom *bloom, int entries, double error,
                     unsigned int cache_size)
 {
@@ -91,41 +136,91 @@ int bloom_init_size(struct bloom *bloom, int entries, double error,
 }
 
 int bloom_init(struct bloom *bloom, int entries, double error)
+{
+  return bloom_init_type(bloom, entries, error, BLOOM_STANDARD);
+}
+
+static int bloom_set_size(struct bloom *bloom, int entries, double error, int type)
 {
   bloom->ready = 0;
+  bloom->frozen = 0;
+  bloom->mapped = 0;
 
   if (entries < 1000 || error == 0)
   {
     return 1;
   }
 
+  if (type != BLOOM_STANDARD && type != BLOOM_BLOCKED)
+  {
+    return 1;
+  }
+
   bloom->entries = entries;
   bloom->error = error;
+  bloom->type = type;
 
   double num = log(bloom->error);
   double denom = 0.480453013918201; // ln(2)^2
   bloom->bpe = -(num / denom);
 
   double dentries = (double)entries;
-  bloom->bits = (int)(dentries * bloom->bpe);
+  bloom->bits = (uint64_t)(dentries * bloom->bpe);
 
-  if (bloom->bits % 8)
+  // round blocked filters up to a whole number of blocks
+  if (bloom->type == BLOOM_BLOCKED)
   {
-    bloom->bytes = (bloom->bits / 8) + 1;
+    bloom->blocks = (bloom->bits + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+    bloom->bits = bloom->blocks * BLOOM_BLOCK_BITS;
+  }
+
+  // round up to whole 64 bit words
+  bloom->bytes = ((bloom->bits + 63) / 64) * 8;
+
+  bloom->hashes = (int)ceil(0.693147180559945 * bloom->bpe); // ln(2)
+  return 0;
+}
+
+int bloom_init_type(struct bloom *bloom, int entries, double error, int type)
+{
+  if (bloom_set_size(bloom, entries, error, type) != 0)
+  {
+    return 1;
+  }
+
+  if (bloom->type == BLOOM_BLOCKED)
+  {
+    void *buf;
+    if (posix_memalign(&buf, BLOOM_BLOCK_BYTES, bloom->bytes) != 0)
+    { // LCOV_EXCL_START
+      return 1;
+    } // LCOV_EXCL_STOP
+    memset(buf, 0, bloom->bytes);
+    bloom->bf = (unsigned char *)buf;
   }
   else
   {
-    bloom->bytes = bloom->bits / 8;
+    bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
+    if (bloom->bf == NULL)
+    { // LCOV_EXCL_START
+      return 1;
+    } // LCOV_EXCL_STOP
   }
 
-  bloom->hashes = (int)ceil(0.693147180559945 * bloom->bpe); // ln(2)
+  bloom->ready = 1;
+  return 0;
+}
 
-  bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
-  if (bloom->bf == NULL)
-  { // LCOV_EXCL_START
+int bloom_init_mapped(struct bloom *bloom, int entries, double error, int type,
+                      unsigned char *buf, uint64_t bytes)
+{
+  if (bloom_set_size(bloom, entries, error, type) != 0 || bytes != bloom->bytes)
+  {
     return 1;
-  } // LCOV_EXCL_STOP
-
+  }
+  bloom->bf = buf;
+  bloom->mapped = 1;
+  bloom->frozen = 1;
   bloom->ready = 1;
   return 0;
 }
@@ -140,29 +235,59 @@ int bloom_add(struct bloom *bloom, const void *buffer, int len)
   return bloom_check_add(bloom, buffer, len, 1);
 }
 
+int bloom_check_hash(struct bloom *bloom, uint64_t hash)
+{
+  return bloom_check_add_hash(bloom, fmix64(hash), 0);
+}
+
+int bloom_add_hash(struct bloom *bloom, uint64_t hash)
+{
+  return bloom_check_add_hash(bloom, fmix64(hash), 1);
+}
+
+int bloom_freeze(struct bloom *bloom)
+{
+  if (!bloom->ready)
+    return 1;
+
+  // make sure every write to the bit array is visible before the filter is shared
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  bloom->frozen = 1;
+  return 0;
+}
+
 void bloom_print(struct bloom *bloom)
 {
   printf("bloom at %p\n", (void *)bloom);
   printf(" ->entries = %d\n", bloom->entries);
   printf(" ->error = %f\n", bloom->error);
-  printf(" ->bits = %d\n", bloom->bits);
+  printf(" ->type = %s\n", bloom->type == BLOOM_BLOCKED ? "blocked" : "standard");
+  printf(" ->bits = %" PRIu64 "\n", bloom->bits);
   printf(" ->bits per elem = %f\n", bloom->bpe);
-  printf(" ->bytes = %d\n", bloom->bytes);
+  printf(" ->bytes = %" PRIu64 "\n", bloom->bytes);
   printf(" ->hash functions = %d\n", bloom->hashes);
+  printf(" ->frozen = %d\n", bloom->frozen);
 }
 
 void bloom_free(struct bloom *bloom)
 {
   if (bloom->ready)
   {
-    free(bloom->bf);
+    if (bloom->mapped)
+    {
+      munmap(bloom->bf, bloom->bytes);
+    }
+    else
+    {
+      free(bloom->bf);
+    }
   }
   bloom->ready = 0;
 }
 
 int bloom_reset(struct bloom *bloom)
 {
-  if (!bloom->ready)
+  if (!bloom->ready || bloom->frozen)
     return 1;
   memset(bloom->bf, 0, bloom->bytes);
   return 0;
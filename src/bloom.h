@@ -2,6 +2,7 @@
 #define BLOOM_H
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /*
  *  Copyright (c) 2012-2017, Jyri J. Virkki
@@ -18,6 +19,24 @@ extern "C" {
 #endif
 
 
+/** ***************************************************************************
+ * Filter layouts.
+ *
+ * BLOOM_STANDARD spreads the hash positions for an element over the whole
+ * bit array.
+ *
+ * BLOOM_BLOCKED picks one 64-byte (cache line) block for each element and
+ * keeps all of its hash positions inside that block, so a check costs one
+ * cache miss instead of one per hash function. The false positive rate is
+ * slightly higher than a standard filter with the same number of bits.
+ *
+ */
+#define BLOOM_STANDARD 0
+#define BLOOM_BLOCKED 1
+#define BLOOM_BLOCK_BYTES 64
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_BYTES * 8)
+
+
 /** ***************************************************************************
  * Structure to keep track of one bloom filter.  Caller needs to
  * allocate this and pass it to the functions below. First call for
@@ -31,16 +50,20 @@ struct bloom
   // modify any of these.
   int entries;
   double error;
-  int bits;
-  int bytes;
+  uint64_t bits;
+  uint64_t bytes;
   int hashes;
+  int type;
 
   // Fields below are private to the implementation. These may go away or
   // change incompatibly at any moment. Client code MUST NOT access or rely
   // on these.
   double bpe;
   unsigned char * bf;
+  uint64_t blocks;
   int ready;
+  int frozen;
+  int mapped;
 };
 
 
@@ -74,6 +97,49 @@ struct bloom
 int bloom_init(struct bloom * bloom, int entries, double error);
 
 
+/** ***************************************************************************
+ * Initialize the bloom filter for use, with a specific layout.
+ *
+ * As bloom_init(), but the layout can be BLOOM_STANDARD or BLOOM_BLOCKED.
+ * A blocked filter rounds the bit array up to a whole number of blocks and
+ * the array is aligned to the block size.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_init_type(struct bloom * bloom, int entries, double error, int type);
+
+
+/** ***************************************************************************
+ * Initialize a frozen bloom filter around an existing, read-only bit array.
+ *
+ * This is used to open a filter that was saved to disk and mmap'd back in.
+ * The entries, error and type must be the ones the filter was built with,
+ * and bytes must match the size they give. The filter is frozen, and
+ * bloom_free() will munmap the bit array.
+ *
+ * Parameters:
+ * -----------
+ *     bloom   - Pointer to an allocated struct bloom (see above).
+ *     entries - The entries the saved filter was initialized with.
+ *     error   - The error the saved filter was initialized with.
+ *     type    - The layout the saved filter was initialized with.
+ *     buf     - The mmap'd bit array.
+ *     bytes   - The size of the mmap'd bit array.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (parameters don't match the bit array)
+ *
+ */
+int bloom_init_mapped(struct bloom * bloom, int entries, double error, int type,
+                      unsigned char * buf, uint64_t bytes);
+
+
 /** ***************************************************************************
  * Deprecated, use bloom_init()
  *
@@ -123,6 +189,74 @@ int bloom_check(struct bloom * bloom, const void * buffer, int len);
 int bloom_add(struct bloom * bloom, const void * buffer, int len);
 
 
+/** ***************************************************************************
+ * Check if the given 64 bit hash is in the bloom filter.
+ *
+ * As bloom_check(), but for callers that already have a hash for the
+ * element (e.g. a hashed k-mer). The hash is mixed and then split into the
+ * double hashing pair, so it is not hashed again with murmurhash2.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *     hash   - The hash of the element to check.
+ *
+ * Return:
+ * -------
+ *     0 - element is not present
+ *     1 - element is present (or false positive due to collision)
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_check_hash(struct bloom * bloom, uint64_t hash);
+
+
+/** ***************************************************************************
+ * Add the given 64 bit hash to the bloom filter.
+ *
+ * As bloom_add(), but for callers that already have a hash for the element.
+ * Elements added with bloom_add_hash() must be checked with
+ * bloom_check_hash().
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *     hash   - The hash of the element to add.
+ *
+ * Adds are atomic, so several threads may add to the same (unfrozen)
+ * filter at once.
+ *
+ * Return:
+ * -------
+ *     0 - element was not present and was added
+ *     1 - element (or a collision) had already been added previously
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_add_hash(struct bloom * bloom, uint64_t hash);
+
+
+/** ***************************************************************************
+ * Freeze the bloom filter, publishing it as a read-only snapshot.
+ *
+ * Once frozen, any number of threads may call bloom_check() and
+ * bloom_check_hash() concurrently without locking. Adding to a frozen
+ * filter is refused (returns -1). Freeze the filter before handing it to
+ * other threads.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - bloom not initialized
+ *
+ */
+int bloom_freeze(struct bloom * bloom);
+
+
 /** ***************************************************************************
  * Print (to stdout) info about this bloom filter. Debugging aid.
  *
@@ -0,0 +1,178 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "slog.h"
+
+/*
+    the checkpoint is a list of every FASTQ file that the daemon has taken on but not yet finished
+
+    - a file joins the list when it is dispatched, and leaves it once it has been read to the end (or can't be read)
+    - while a file is being sketched, readsDone is moved on past each run of finished read batches
+    - at shutdown the readers are stopped, and whatever is left on the list is written to a state file as
+      "<readsDone>\t<filepath>" lines, which the next daemon reads back and resumes from
+    - the state file is also rewritten while the daemon runs, so that a daemon which is killed or crashes only
+      repeats the work done since the last write
+    - files are resumed from the last read that was known to be sketched, so a few reads may be sketched twice
+      but none are missed
+*/
+
+// checkpointInit creates an empty checkpoint
+checkpoint_t *checkpointInit()
+{
+    checkpoint_t *checkpoint = calloc(1, sizeof(checkpoint_t));
+    if (checkpoint == NULL)
+        return NULL;
+    pthread_mutex_init(&(checkpoint->mutex), NULL);
+    return checkpoint;
+}
+
+// checkpointAdd creates a job for a file, which is put on the checkpoint (if checkpoint isn't NULL)
+// returns NULL if the job couldn't be allocated
+fastqJob_t *checkpointAdd(checkpoint_t *checkpoint, const char *filepath, long readsDone)
+{
+    fastqJob_t *job = calloc(1, sizeof(fastqJob_t));
+    if (job == NULL || (job->filepath = strdup(filepath)) == NULL)
+    {
+        free(job);
+        return NULL;
+    }
+    job->checkpoint = checkpoint;
+    job->readsDone = readsDone;
+    if (checkpoint == NULL)
+        return job;
+    pthread_mutex_lock(&(checkpoint->mutex));
+    job->next = checkpoint->jobs;
+    if (checkpoint->jobs != NULL)
+        checkpoint->jobs->prev = job;
+    checkpoint->jobs = job;
+    checkpoint->numJobs++;
+    pthread_mutex_unlock(&(checkpoint->mutex));
+    return job;
+}
+
+// checkpointFinish takes a finished job off its checkpoint and frees it
+void checkpointFinish(fastqJob_t *job)
+{
+    if (job == NULL)
+        return;
+    checkpoint_t *checkpoint = job->checkpoint;
+    if (checkpoint != NULL)
+    {
+        pthread_mutex_lock(&(checkpoint->mutex));
+        if (job->prev != NULL)
+            job->prev->next = job->next;
+        else
+            checkpoint->jobs = job->next;
+        if (job->next != NULL)
+            job->next->prev = job->prev;
+        checkpoint->numJobs--;
+        pthread_mutex_unlock(&(checkpoint->mutex));
+    }
+    free(job->filepath);
+    free(job);
+}
+
+// checkpointCopy adds a copy of each job on src to dst, with its current readsDone
+void checkpointCopy(checkpoint_t *dst, checkpoint_t *src)
+{
+    pthread_mutex_lock(&(src->mutex));
+    fastqJob_t *job;
+    for (job = src->jobs; job != NULL; job = job->next)
+        checkpointAdd(dst, job->filepath, __atomic_load_n(&job->readsDone, __ATOMIC_ACQUIRE));
+    pthread_mutex_unlock(&(src->mutex));
+}
+
+// checkpointStop tells the readers to stop at the end of their current batch
+void checkpointStop(checkpoint_t *checkpoint)
+{
+    __atomic_store_n(&checkpoint->stopping, 1, __ATOMIC_RELEASE);
+}
+
+// checkpointStopping returns true once the readers have been told to stop
+bool checkpointStopping(checkpoint_t *checkpoint)
+{
+    return checkpoint != NULL && __atomic_load_n(&checkpoint->stopping, __ATOMIC_ACQUIRE);
+}
+
+/*
+    checkpointWrite saves the unfinished files to a state file
+    - the file is written alongside and then renamed into place, so a crash never leaves half a state file
+    - if there are no unfinished files, any old state file is removed
+    - returns 0 on success
+*/
+int checkpointWrite(checkpoint_t *checkpoint, const char *stateFile)
+{
+    char tmpFile[PATH_MAX];
+    if (snprintf(tmpFile, sizeof(tmpFile), "%s.tmp", stateFile) >= (int)sizeof(tmpFile))
+        return 1;
+    pthread_mutex_lock(&(checkpoint->mutex));
+    if (checkpoint->jobs == NULL)
+    {
+        pthread_mutex_unlock(&(checkpoint->mutex));
+        remove(stateFile);
+        return 0;
+    }
+    FILE *fp = fopen(tmpFile, "w");
+    if (fp == NULL)
+    {
+        pthread_mutex_unlock(&(checkpoint->mutex));
+        slog(0, SLOG_ERROR, "could not open the state file: %s", tmpFile);
+        return 1;
+    }
+    fastqJob_t *job;
+    int err = 0;
+    for (job = checkpoint->jobs; job != NULL; job = job->next)
+        if (fprintf(fp, "%ld\t%s\n", __atomic_load_n(&job->readsDone, __ATOMIC_ACQUIRE), job->filepath) < 0)
+            err = 1;
+    pthread_mutex_unlock(&(checkpoint->mutex));
+    if (fclose(fp) != 0 || err || rename(tmpFile, stateFile) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not write the state file: %s", stateFile);
+        remove(tmpFile);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+    checkpointLoad reads a state file and calls resume for each file in it
+    - returns the number of files, 0 if there is no state file, or -1 if it is malformed
+*/
+int checkpointLoad(const char *stateFile, checkpointResume_t resume, void *arg)
+{
+    FILE *fp = fopen(stateFile, "r");
+    if (fp == NULL)
+        return 0;
+    char line[PATH_MAX + 32];
+    int n = 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *end;
+        long readsDone = strtol(line, &end, 10);
+        size_t len = strlen(line);
+        if (end == line || *end != '\t' || readsDone < 0 || len < 2 || line[len - 1] != '\n')
+        {
+            fclose(fp);
+            return -1;
+        }
+        line[len - 1] = '\0';
+        resume(end + 1, readsDone, arg);
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+// checkpointDestroy frees a checkpoint and any jobs left on it
+void checkpointDestroy(checkpoint_t *checkpoint)
+{
+    if (checkpoint == NULL)
+        return;
+    while (checkpoint->jobs != NULL)
+        checkpointFinish(checkpoint->jobs);
+    pthread_mutex_destroy(&(checkpoint->mutex));
+    free(checkpoint);
+}
@@ -0,0 +1,43 @@
+// checkpoint keeps track of the FASTQ files the daemon still has to finish, so that they can be saved at shutdown and resumed at start up
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// fastqJob_t is a FASTQ file that has been dispatched, or is waiting to be
+typedef struct fastqJob
+{
+    struct checkpoint *checkpoint; // the checkpoint the job is on (NULL if it isn't tracked)
+    char *filepath;
+    long readsDone;                // reads from the start of the file that have been sketched, with no gaps
+    struct fastqJob *prev;
+    struct fastqJob *next;
+} fastqJob_t;
+
+// checkpoint_t is the list of unfinished FASTQ files
+typedef struct checkpoint
+{
+    fastqJob_t *jobs;
+    int numJobs;
+    int stopping;           // set once the daemon is shutting down, to stop the readers
+    pthread_mutex_t mutex;
+} checkpoint_t;
+
+// checkpointResume_t is called by checkpointLoad for each file in a state file
+typedef void (*checkpointResume_t)(const char *filepath, long readsDone, void *arg);
+
+/*
+    function prototypes
+*/
+checkpoint_t *checkpointInit();
+fastqJob_t *checkpointAdd(checkpoint_t *checkpoint, const char *filepath, long readsDone);
+void checkpointFinish(fastqJob_t *job);
+void checkpointCopy(checkpoint_t *dst, checkpoint_t *src);
+void checkpointStop(checkpoint_t *checkpoint);
+bool checkpointStopping(checkpoint_t *checkpoint);
+int checkpointWrite(checkpoint_t *checkpoint, const char *stateFile);
+int checkpointLoad(const char *stateFile, checkpointResume_t resume, void *arg);
+void checkpointDestroy(checkpoint_t *checkpoint);
+
+#endif
@@ -1,6 +1,8 @@
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "frozen.h"
@@ -20,8 +22,14 @@ config_t *initConfig()
         c->pid = -1;
         c->k_size = AM_DEFAULT_K_SIZE;
         c->sketch_size = AM_DEFAULT_SKETCH_SIZE;
+        c->sketch_scale = AM_DEFAULT_SKETCH_SCALE;
         c->bloom_fp_rate = AM_DEFAULT_BLOOM_FP_RATE;
         c->bloom_max_elements = AM_DEFAULT_BLOOM_MAX_EL;
+        c->bloom_blocked = AM_DEFAULT_BLOOM_BLOCKED;
+        c->ref_kmers = AM_DEFAULT_REF_KMERS;
+        c->queue_capacity = AM_DEFAULT_QUEUE_CAPACITY;
+        c->num_threads = AM_DEFAULT_NUM_THREADS;
+        c->cpu_list = NULL;
         c->bloom_filter = NULL;
     }
     return c;
@@ -36,6 +44,7 @@ void destroyConfig(config_t *config)
     free(config->current_log_file);
     free(config->watch_directory);
     free(config->white_list);
+    free(config->cpu_list);
     free(config);
     config = NULL;
 }
@@ -72,7 +81,7 @@ int writeConfig(config_t *config, char *configFile)
     config->modified = timeStamp;
 
     // write it to file
-    ret = json_fprintf(configFile, "{ filename: %Q, created: %Q, modified: %Q, current_log_file: %Q, watch_directory: %Q, white_list: %Q, pid: %d, k_size: %d, sketch_size: %d, bloom_fp_rate: %f, bloom_max_elements: %d }",
+    ret = json_fprintf(configFile, "{ filename: %Q, created: %Q, modified: %Q, current_log_file: %Q, watch_directory: %Q, white_list: %Q, pid: %d, k_size: %d, sketch_size: %d, sketch_scale: %d, bloom_fp_rate: %f, bloom_max_elements: %d, bloom_blocked: %B, ref_kmers: %d, queue_capacity: %d, num_threads: %d, cpu_list: %Q }",
                        config->filename,
                        config->created,
                        config->modified,
@@ -82,8 +91,14 @@ int writeConfig(config_t *config, char *configFile)
                        config->pid,
                        config->k_size,
                        config->sketch_size,
+                       config->sketch_scale,
                        config->bloom_fp_rate,
-                       config->bloom_max_elements);
+                       config->bloom_max_elements,
+                       config->bloom_blocked,
+                       config->ref_kmers,
+                       config->queue_capacity,
+                       config->num_threads,
+                       config->cpu_list);
     if (ret < 0)
     {
         fprintf(stderr, "failed to write config to disk (%d)\n", ret);
@@ -103,7 +118,7 @@ int loadConfig(config_t *config, char *configFile)
     char *content = json_fread(configFile);
 
     // scan the file content and populate the tmp config
-    int status = json_scanf(content, strlen(content), "{ filename: %Q, created: %Q, modified: %Q, current_log_file: %Q, watch_directory: %Q, white_list: %Q, pid: %d, k_size: %d, sketch_size: %d, bloom_fp_rate: %f, bloom_max_elements: %d }",
+    int status = json_scanf(content, strlen(content), "{ filename: %Q, created: %Q, modified: %Q, current_log_file: %Q, watch_directory: %Q, white_list: %Q, pid: %d, k_size: %d, sketch_size: %d, sketch_scale: %d, bloom_fp_rate: %f, bloom_max_elements: %d, bloom_blocked: %B, ref_kmers: %d, queue_capacity: %d, num_threads: %d, cpu_list: %Q }",
                             &config->filename,
                             &config->created,
                             &config->modified,
@@ -113,8 +128,14 @@ int loadConfig(config_t *config, char *configFile)
                             &config->pid,
                             &config->k_size,
                             &config->sketch_size,
+                            &config->sketch_scale,
                             &config->bloom_fp_rate,
-                            &config->bloom_max_elements);
+                            &config->bloom_max_elements,
+                            &config->bloom_blocked,
+                            &config->ref_kmers,
+                            &config->queue_capacity,
+                            &config->num_threads,
+                            &config->cpu_list);
 
     // free the buffer
     free(content);
@@ -126,3 +147,73 @@ int loadConfig(config_t *config, char *configFile)
     }
     return 0;
 }
+
+/*
+    parseCPUList reads a list of CPUs such as "0-3,8,10-11" into an array
+    - the array is allocated and must be freed by the caller
+    - returns the number of CPUs, or -1 if the list is malformed or a CPU is out of range
+*/
+int parseCPUList(const char *cpuList, int **cpus)
+{
+    *cpus = NULL;
+    if (cpuList == NULL)
+        return -1;
+    int n = 0, size = 0;
+    const char *p = cpuList;
+    while (*p != '\0')
+    {
+        char *end;
+        if (!isdigit((unsigned char)*p))
+            goto bad;
+        long first = strtol(p, &end, 10), last = first;
+        p = end;
+        if (*p == '-')
+        {
+            if (!isdigit((unsigned char)*++p))
+                goto bad;
+            last = strtol(p, &end, 10);
+            p = end;
+        }
+        if (last < first || last >= AM_MAX_CPUS)
+            goto bad;
+        if (*p == ',')
+        {
+            if (*++p == '\0')
+                goto bad;
+        }
+        else if (*p != '\0')
+            goto bad;
+        for (; first <= last; first++)
+        {
+            if (n == size)
+            {
+                size = size ? size * 2 : 16;
+                int *tmp = realloc(*cpus, size * sizeof(int));
+                if (tmp == NULL)
+                    goto bad;
+                *cpus = tmp;
+            }
+            (*cpus)[n++] = (int)first;
+        }
+    }
+    if (n != 0)
+        return n;
+bad:
+    free(*cpus);
+    *cpus = NULL;
+    return -1;
+}
+
+// getNumThreads returns the number of sketching threads to run, working out what auto (0) means
+int getNumThreads(config_t *config)
+{
+    if (config->num_threads > 0)
+        return config->num_threads;
+    int *cpus;
+    int n = parseCPUList(config->cpu_list, &cpus);
+    free(cpus);
+    if (n > 0)
+        return n;
+    n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
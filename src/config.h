@@ -6,8 +6,21 @@
 
 #define AM_DEFAULT_K_SIZE 7
 #define AM_DEFAULT_SKETCH_SIZE 128
+#define AM_DEFAULT_SKETCH_SCALE 0
 #define AM_DEFAULT_BLOOM_FP_RATE 0.001
 #define AM_DEFAULT_BLOOM_MAX_EL 100000
+#define AM_DEFAULT_BLOOM_BLOCKED false
+#define AM_DEFAULT_REF_KMERS 0
+#define AM_DEFAULT_QUEUE_CAPACITY 64
+#define AM_DEFAULT_NUM_THREADS 0
+
+// AM_MAX_THREADS is the most sketching threads that can be asked for, and AM_MAX_CPUS is one more than the highest CPU that can be pinned to
+#define AM_MAX_THREADS 1024
+#define AM_MAX_CPUS 1024
+
+// when the white list is indexed, the bloom filter is sized to the estimated distinct k-mers plus this much headroom (but no smaller than the minimum)
+#define AM_BLOOM_SIZE_HEADROOM 1.1
+#define AM_BLOOM_MIN_ELEMENTS 1000
 
 /*
     config_t is used to record the minimum information required by antman
@@ -23,8 +36,14 @@ typedef struct config
     int pid;
     int k_size;
     int sketch_size;
+    int sketch_scale; // 0 for a KMV sketch of sketch_size, otherwise a scaled sketch keeping 1/sketch_scale of the k-mers
     double bloom_fp_rate;
     int bloom_max_elements;
+    bool bloom_blocked;
+    int ref_kmers; // the estimated number of distinct k-mers in the white list (set when the reference index is built)
+    int queue_capacity; // the most FASTQ files that can wait in the workerpool queue (0 for unbounded)
+    int num_threads; // the number of sketching threads (0 for auto, which is one per CPU in cpu_list, or one per online CPU)
+    char *cpu_list; // the CPUs to pin the sketching threads to, e.g. "0-3,8" (NULL to let them run anywhere)
     struct bloom *bloom_filter;
 } config_t;
 
@@ -35,6 +54,8 @@ config_t *initConfig();
 void destroyConfig(config_t *config);
 int writeConfig(config_t *config, char *configFile);
 int loadConfig(config_t *config, char *configFile);
+int parseCPUList(const char *cpuList, int **cpus);
+int getNumThreads(config_t *config);
 void slog_get_date(SlogDate *pDate);
 
 #endif
\ No newline at end of file
@@ -7,14 +7,16 @@
 #include <sys/stat.h> // contains umask(3)
 
 #include "bloom.h"
+#include "checkpoint.h"
 #include "daemonize.h"
+#ifndef AM_USE_FSWATCH
+#include "inotify.h"
+#endif
+#include "readiness.h"
 #include "sequence.h"
 #include "slog.h"
 #include "workerpool.h"
 
-// TODO: set these values by the cli
-const int NUM_THREADS = 4;
-
 // done controls when to stop the antman threads
 volatile sig_atomic_t done = 0;
 
@@ -34,6 +36,29 @@ void catchSigterm()
     sigaction(SIGTERM, &action, NULL);
 }
 
+// resumeFile passes a file saved by an earlier daemon on to the readiness stage
+static void resumeFile(const char *filepath, long readsDone, void *arg)
+{
+    readinessResume((readiness_t *)arg, filepath, readsDone);
+}
+
+// saveState rewrites the state file with the files the running daemon hasn't finished
+// the readiness stage is copied first, so a file it hands over to the workerpool in the meantime is saved twice rather than missed
+static void saveState(readiness_t *readiness, checkpoint_t *checkpoint)
+{
+    checkpoint_t *snapshot = checkpointInit();
+    if (snapshot == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the state snapshot");
+        return;
+    }
+    readinessCheckpoint(readiness, snapshot);
+    checkpointCopy(snapshot, checkpoint);
+    checkpointWrite(snapshot, STATE_LOCATION);
+    checkpointDestroy(snapshot);
+}
+
+#ifdef AM_USE_FSWATCH
 // startWatching is used to start the directory watcher inside a thread
 void *startWatching(void *param)
 {
@@ -45,6 +70,7 @@ void *startWatching(void *param)
     }
     return NULL;
 }
+#endif
 
 // startDaemon converts the current program to a daemon process, launches some threads and starts directory watching
 int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
@@ -84,6 +110,7 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
     // set up the signal catcher
     catchSigterm();
 
+#ifdef AM_USE_FSWATCH
     // initialise fswatch
     slog(0, SLOG_INFO, "initialising fswatch...");
     if (FSW_OK != fsw_init_library())
@@ -92,7 +119,7 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
         slog(0, SLOG_LIVE, "\t- %s", fsw_last_error());
         return 1;
     }
-    const FSW_HANDLE handle = fsw_init_session(fsevents_monitor_type);
+    const FSW_HANDLE handle = fsw_init_session(system_default_monitor_type);
 
     // add the path(s) for the watcher to watch
     if (FSW_OK != fsw_add_path(handle, amConfig->watch_directory))
@@ -101,16 +128,62 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
         return 1;
     }
     slog(0, SLOG_LIVE, "\t- added directory to the watch path: %s", amConfig->watch_directory);
+#endif
 
     // launch the worker threads
     slog(0, SLOG_INFO, "creating workerpool...");
     tpool_t *wp;
-    wp = tpool_create(NUM_THREADS);
-    slog(0, SLOG_LIVE, "\t- created workerpool of %d threads", NUM_THREADS);
+    int numThreads = getNumThreads(amConfig);
+    int *cpus = NULL, numCpus = 0;
+    if (amConfig->cpu_list != NULL && (numCpus = parseCPUList(amConfig->cpu_list, &cpus)) < 0)
+    {
+        slog(0, SLOG_ERROR, "could not read the CPU list: %s", amConfig->cpu_list);
+        return 1;
+    }
+    wp = tpool_create_pinned(numThreads, amConfig->queue_capacity < 0 ? 0 : amConfig->queue_capacity, cpus, numCpus);
+    if (wp == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not create the workerpool");
+        return 1;
+    }
+    tpool_set_drop(wp, dropFastqWork);
+    slog(0, SLOG_LIVE, "\t- created workerpool of %d threads", numThreads);
+    if (numCpus != 0)
+        slog(0, SLOG_LIVE, "\t- pinned the workers to CPUs: %s", amConfig->cpu_list);
+    slog(0, SLOG_LIVE, "\t- workerpool queue capacity: %d files", amConfig->queue_capacity);
     wargs->workerPool = wp;
+    wargs->cpus = cpus;
+    wargs->numCpus = numCpus;
+    fastqStats_t stats = {0, 0, 0, 0};
+    wargs->stats = &stats;
+
+    // create the checkpoint, which keeps track of the files that haven't been finished
+    checkpoint_t *checkpoint = checkpointInit();
+    if (checkpoint == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not create the checkpoint");
+        return 1;
+    }
+    wargs->checkpoint = checkpoint;
+
+    // create the readiness stage, which holds back files until they have been written
+    readiness_t *readiness = readinessInit(wargs, READINESS_QUIET_MS);
+    if (readiness == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not create the file readiness stage");
+        return 1;
+    }
 
+    // pick up any files that the last daemon didn't finish
+    int resumed = checkpointLoad(STATE_LOCATION, resumeFile, readiness);
+    if (resumed < 0)
+        slog(0, SLOG_WARN, "\t- could not read the state file, so it has been ignored: %s", STATE_LOCATION);
+    else if (resumed > 0)
+        slog(0, SLOG_LIVE, "\t- resuming %d unfinished files from: %s", resumed, STATE_LOCATION);
+
+#ifdef AM_USE_FSWATCH
     // set the watcher callback function
-    if (FSW_OK != fsw_set_callback(handle, watcherCallback, wargs))
+    if (FSW_OK != fsw_set_callback(handle, watcherCallback, readiness))
     {
         slog(0, SLOG_ERROR, "could not set the callback function for libfswatch");
         return 1;
@@ -123,14 +196,35 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
         slog(0, SLOG_ERROR, "could not start the watcher thread");
         return 1;
     }
+#else
+    // start the inotify watcher, which passes files on as soon as they are closed after writing
+    slog(0, SLOG_INFO, "initialising inotify...");
+    inotifyWatcher_t *watcher = inotifyInit(amConfig->watch_directory, readiness);
+    if (watcher == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not watch the directory: %s", amConfig->watch_directory);
+        return 1;
+    }
+    slog(0, SLOG_LIVE, "\t- added directory to the watch path: %s", amConfig->watch_directory);
+    if (inotifyStart(watcher) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not start the watcher thread");
+        return 1;
+    }
+#endif
     slog(0, SLOG_INFO, "antman is waiting for sequence data...");
 
-    // run antman until a stop signal is received
+    // run antman until a stop signal is received, saving the unfinished files every AM_CHECKPOINT_SECS
+    // (the state file from the last daemon is left in place until then, so a crash before the first save loses nothing)
+    int ticks = 0;
     while (!done)
     {
-        pause();
+        sleep(1);
+        if (!done && ++ticks % AM_CHECKPOINT_SECS == 0)
+            saveState(readiness, checkpoint);
     }
 
+#ifdef AM_USE_FSWATCH
     // stop the directory watcher
     slog(0, SLOG_LIVE, "\t- stopping the directory watcher");
     if (FSW_OK != fsw_stop_monitor(handle))
@@ -138,27 +232,54 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
         slog(0, SLOG_ERROR, "error stopping the directory watcher");
         return 1;
     }
-    sleep(5);
+
+    // fsw_start_monitor returns once the monitor has stopped, so the session can go once the thread has finished
+    if (pthread_join(start_thread, NULL))
+    {
+        slog(0, SLOG_ERROR, "error joining directory watcher thread");
+        return 1;
+    }
     if (FSW_OK != fsw_destroy_session(handle))
     {
         slog(0, SLOG_ERROR, "error destroying the fswatch session");
         return 1;
     }
-
-    // wait for the directory watcher thread to finish
-    if (pthread_join(start_thread, NULL))
+#else
+    // stop the directory watcher (this returns once the watcher thread has exited)
+    slog(0, SLOG_LIVE, "\t- stopping the directory watcher");
+    if (inotifyStop(watcher) != 0)
     {
-        slog(0, SLOG_ERROR, "error joining directory watcher thread");
+        slog(0, SLOG_ERROR, "error stopping the directory watcher");
         return 1;
     }
+    inotifyDestroy(watcher);
+#endif
 
-    // wait on any active threads in the workerpool
+    // stop the readiness stage, saving the files it was holding on to
+    readinessCheckpoint(readiness, checkpoint);
+    readinessDestroy(readiness);
+
+    // stop the readers at their next batch, and give the sketching threads time to finish the batches already sent
+    // after that, tpool_destroy stops each thread once its current batch is done, and the queued batches are dropped
     slog(0, SLOG_LIVE, "\t- stopping the sketching threads");
-    tpool_wait(wp);
+    checkpointStop(checkpoint);
+    if (!tpool_wait_timeout(wp, AM_DRAIN_SECS))
+        slog(0, SLOG_WARN, "\t- the sketching threads did not finish within %ds, stopping them after their current batch (the rest will be sketched by the next daemon)", AM_DRAIN_SECS);
+    slog(0, SLOG_LIVE, "\t- workerpool queue high-water mark: %zu files", tpool_high_water(wp));
+    slog(0, SLOG_LIVE, "\t- processed %ld files (%ld reads, %ld sketched, %ld files unreadable)", stats.files, stats.reads, stats.sketched, stats.failed);
 
-    // destroy the workerpool
+    // destroy the workerpool (any queued files and read batches are dropped, and their files stay on the checkpoint)
     tpool_destroy(wp);
 
+    // save the unfinished files for the next daemon
+    int numSaved = checkpoint->numJobs;
+    if (checkpointWrite(checkpoint, STATE_LOCATION) != 0)
+        slog(0, SLOG_ERROR, "could not save %d unfinished files", numSaved);
+    else if (numSaved > 0)
+        slog(0, SLOG_LIVE, "\t- saved %d unfinished files to: %s", numSaved, STATE_LOCATION);
+    checkpointDestroy(checkpoint);
+    free(cpus);
+
     return 0;
 }
 
@@ -1,17 +1,26 @@
 #ifndef DAEMONIZE_H
 #define DAEMONIZE_H
 
-#include <libfswatch/c/libfswatch.h>
-
 #include "config.h"
 #include "watcher.h"
 
+// AM_DRAIN_SECS is how long the daemon gives the sketching threads to finish the batches already sent when it is stopped (after that, only the batches being sketched are finished)
+#define AM_DRAIN_SECS 30
+
+// AM_CHECKPOINT_SECS is how often the running daemon rewrites its state file
+#define AM_CHECKPOINT_SECS 30
+
+// AM_STOP_WAIT_SECS is how long `antman --stop` waits for the daemon to save its state and exit
+#define AM_STOP_WAIT_SECS 60
+
 /*
     function prototypes
 */
 void sigTermHandler(int signum);
 void catchSigterm();
+#ifdef AM_USE_FSWATCH
 void *startWatching(void *param);
+#endif
 int startDaemon(config_t *amConfig, watcherArgs_t *wargs);
 int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile);
 
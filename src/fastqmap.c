@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fastqmap.h"
+
+/*
+    the FASTQ map reads an uncompressed FASTQ file through a read-only mapping, advised as sequential,
+    so records are parsed in place rather than being copied through zlib and kseq's stream buffer
+
+    only four line records are supported (single line sequence and quality), which is what basecallers write,
+    fqmNext returns -2 for anything else and the caller falls back to kseq
+*/
+
+// fastqMap
+struct fastqMap
+{
+    const char *data;
+    size_t size;
+    size_t pos;
+};
+
+// nextLine finds the line starting at pos, strips the line ending and moves pos on to the next line
+// returns 0, or -1 if there are no more lines
+static int nextLine(fastqMap_t *fqm, const char **line, int *len)
+{
+    if (fqm->pos >= fqm->size)
+        return -1;
+    const char *start = fqm->data + fqm->pos;
+    const char *end = memchr(start, '\n', fqm->size - fqm->pos);
+    if (end == NULL)
+    {
+        end = fqm->data + fqm->size;
+        fqm->pos = fqm->size;
+    }
+    else
+    {
+        fqm->pos = end - fqm->data + 1;
+    }
+    if (end > start && *(end - 1) == '\r')
+        end--;
+    *line = start;
+    *len = end - start;
+    return 0;
+}
+
+// fqmOpen maps an uncompressed FASTQ file
+// returns NULL if the file can't be opened or mapped, or if it is gzipped
+fastqMap_t *fqmOpen(const char *filepath)
+{
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode))
+    {
+        close(fd);
+        return NULL;
+    }
+    fastqMap_t *fqm = calloc(1, sizeof(fastqMap_t));
+    if (fqm == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // an empty file has nothing to map
+    fqm->size = sb.st_size;
+    if (fqm->size == 0)
+    {
+        close(fd);
+        return fqm;
+    }
+    void *data = mmap(NULL, fqm->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        free(fqm);
+        return NULL;
+    }
+    fqm->data = data;
+
+    // leave gzipped files to the gzreader
+    if (fqm->size >= 2 && (unsigned char)fqm->data[0] == 31 && (unsigned char)fqm->data[1] == 139)
+    {
+        fqmClose(fqm);
+        return NULL;
+    }
+    madvise(data, fqm->size, MADV_SEQUENTIAL);
+    return fqm;
+}
+
+// fqmNext gets the next record from the file
+// returns the sequence length, -1 at the end of the file or -2 if the record is malformed
+int fqmNext(fastqMap_t *fqm, fastqRecord_t *record)
+{
+    const char *line;
+    int len;
+
+    // skip any blank lines between records
+    do
+    {
+        if (nextLine(fqm, &line, &len) != 0)
+            return -1;
+    } while (len == 0);
+    if (line[0] != '@')
+        return -2;
+    record->name = line + 1;
+    record->nameLen = len - 1;
+    if (nextLine(fqm, &record->seq, &record->seqLen) != 0)
+        return -2;
+    if (nextLine(fqm, &line, &len) != 0 || len == 0 || line[0] != '+')
+        return -2;
+    if (nextLine(fqm, &record->qual, &record->qualLen) != 0 || record->qualLen != record->seqLen)
+        return -2;
+    return record->seqLen;
+}
+
+// fqmClose unmaps the file
+void fqmClose(fastqMap_t *fqm)
+{
+    if (fqm == NULL)
+        return;
+    if (fqm->data != NULL)
+        munmap((void *)fqm->data, fqm->size);
+    free(fqm);
+}
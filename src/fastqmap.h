@@ -0,0 +1,26 @@
+// fastqmap is a zero-copy parser for uncompressed FASTQ files, which maps the file and returns views of each record
+#ifndef FASTQMAP_H
+#define FASTQMAP_H
+
+// fastqRecord_t points into the mapped file, so it is only valid until the map is closed (the fields are not NUL terminated)
+typedef struct fastqRecord
+{
+    const char *name;
+    int nameLen;
+    const char *seq;
+    int seqLen;
+    const char *qual;
+    int qualLen;
+} fastqRecord_t;
+
+//
+typedef struct fastqMap fastqMap_t;
+
+/*
+    function prototypes
+*/
+fastqMap_t *fqmOpen(const char *filepath);
+int fqmNext(fastqMap_t *fqm, fastqRecord_t *record);
+void fqmClose(fastqMap_t *fqm);
+
+#endif
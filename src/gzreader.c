@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "gzreader.h"
+
+/*
+    the gzreader decompresses a file ahead of the caller, into a ring of output blocks which are handed back in order by gzrRead
+
+    BGZF files (the blocked gzip written by htslib and some basecallers) are a series of independent gzip members of at most 64KB,
+    with the size of each member in its header, so the inflate threads can each take the next block from the file and inflate it
+    in parallel
+
+    any other file (plain or multi-member gzip, or uncompressed) is read through zlib's gzread by a single read ahead thread,
+    so that decompression still overlaps with parsing in the caller
+
+    gzrRead has the same form as gzread, so it can be plugged into kseq with KSEQ_INIT(gzReader_t *, gzrRead)
+*/
+
+// BGZF block layout
+#define BGZF_HEADER_SIZE 18  // fixed header + the BC extra subfield
+#define BGZF_FOOTER_SIZE 8   // CRC32 + ISIZE
+
+// slot states
+#define SLOT_EMPTY 0
+#define SLOT_BUSY 1
+#define SLOT_DONE 2
+
+// gzrSlot is one block of the file, which is read and inflated by a worker and then copied out by gzrRead
+typedef struct gzrSlot
+{
+    unsigned char *in;  // the compressed block (BGZF only)
+    int inLen;
+    unsigned char *out; // the inflated block
+    int outLen;
+    int state;
+    bool eof;           // no more blocks follow this one
+    bool error;         // the block could not be read or inflated
+} gzrSlot_t;
+
+// gzReader
+struct gzReader
+{
+    int fd;             // the file (BGZF only)
+    gzFile gz;          // the file (everything else)
+    bool bgzf;
+    gzrSlot_t *slots;
+    int numSlots;
+    uint64_t issued;    // blocks taken by workers
+    uint64_t consumed;  // blocks fully copied out by gzrRead
+    int outPos;         // how much of the current block has been copied out
+    bool eof;           // a worker has reached the end of the file
+    bool stop;          // tells the workers to exit
+    pthread_t *threads;
+    int numThreads;
+    pthread_mutex_t mutex;
+    pthread_cond_t workCond; // signalled when a slot is freed
+    pthread_cond_t doneCond; // signalled when a slot is filled
+};
+
+// readFull reads up to n bytes, retrying short reads, and returns the number read (or -1 on error)
+static int readFull(int fd, unsigned char *buf, int n)
+{
+    int got = 0;
+    while (got < n)
+    {
+        ssize_t r = read(fd, buf + got, n - got);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0)
+            break;
+        got += r;
+    }
+    return got;
+}
+
+// isBGZFHeader checks for a gzip header with the BGZF extra subfield and returns the block size (or 0)
+static int isBGZFHeader(const unsigned char *h)
+{
+    if (h[0] != 31 || h[1] != 139 || h[2] != 8 || !(h[3] & 4))
+        return 0;
+    if ((h[10] | h[11] << 8) != 6 || h[12] != 'B' || h[13] != 'C' || (h[14] | h[15] << 8) != 2)
+        return 0;
+    return (h[16] | h[17] << 8) + 1;
+}
+
+// readBGZFBlock reads the next BGZF block into a slot (the mutex must be held so that blocks are read in order)
+static void readBGZFBlock(gzReader_t *reader, gzrSlot_t *slot)
+{
+    int n = readFull(reader->fd, slot->in, BGZF_HEADER_SIZE);
+    if (n == 0)
+    {
+        slot->eof = true;
+        return;
+    }
+    int blockSize = (n == BGZF_HEADER_SIZE) ? isBGZFHeader(slot->in) : 0;
+    if (blockSize < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE || readFull(reader->fd, slot->in + BGZF_HEADER_SIZE, blockSize - BGZF_HEADER_SIZE) != blockSize - BGZF_HEADER_SIZE)
+    {
+        slot->error = true;
+        return;
+    }
+    slot->inLen = blockSize;
+}
+
+// inflateBGZFBlock inflates a BGZF block and checks it against its CRC32 and size
+static void inflateBGZFBlock(gzrSlot_t *slot)
+{
+    const unsigned char *footer = slot->in + slot->inLen - BGZF_FOOTER_SIZE;
+    uint32_t crc = footer[0] | footer[1] << 8 | footer[2] << 16 | (uint32_t)footer[3] << 24;
+    uint32_t isize = footer[4] | footer[5] << 8 | footer[6] << 16 | (uint32_t)footer[7] << 24;
+    if (isize > GZREADER_BLOCK_SIZE)
+    {
+        slot->error = true;
+        return;
+    }
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK)
+    {
+        slot->error = true;
+        return;
+    }
+    zs.next_in = slot->in + BGZF_HEADER_SIZE;
+    zs.avail_in = slot->inLen - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+    zs.next_out = slot->out;
+    zs.avail_out = GZREADER_BLOCK_SIZE;
+    int ret = inflate(&zs, Z_FINISH);
+    slot->outLen = GZREADER_BLOCK_SIZE - zs.avail_out;
+    inflateEnd(&zs);
+    if (ret != Z_STREAM_END || slot->outLen != (int)isize || crc32(crc32(0L, Z_NULL, 0), slot->out, slot->outLen) != crc)
+        slot->error = true;
+}
+
+// worker takes the next block of the file, fills its slot and hands it back to gzrRead
+static void *worker(void *param)
+{
+    gzReader_t *reader = (gzReader_t *)param;
+    pthread_mutex_lock(&(reader->mutex));
+    while (1)
+    {
+        // wait for a free slot
+        while (!reader->stop && (reader->eof || reader->issued - reader->consumed >= (uint64_t)reader->numSlots))
+            pthread_cond_wait(&(reader->workCond), &(reader->mutex));
+        if (reader->stop)
+            break;
+        gzrSlot_t *slot = &reader->slots[reader->issued % reader->numSlots];
+        reader->issued++;
+        slot->state = SLOT_BUSY;
+        slot->outLen = 0;
+        slot->eof = false;
+        slot->error = false;
+
+        // BGZF blocks are read in order under the lock and then inflated in parallel, other files only have one worker
+        if (reader->bgzf)
+        {
+            readBGZFBlock(reader, slot);
+            if (slot->eof || slot->error)
+                reader->eof = true;
+            pthread_mutex_unlock(&(reader->mutex));
+            if (!slot->eof && !slot->error)
+                inflateBGZFBlock(slot);
+        }
+        else
+        {
+            pthread_mutex_unlock(&(reader->mutex));
+            int n = gzread(reader->gz, slot->out, GZREADER_BLOCK_SIZE);
+            if (n < 0)
+                slot->error = true;
+            else if (n == 0)
+                slot->eof = true;
+            else
+                slot->outLen = n;
+        }
+        pthread_mutex_lock(&(reader->mutex));
+        if (slot->eof || slot->error)
+            reader->eof = true;
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&(reader->doneCond));
+    }
+    pthread_mutex_unlock(&(reader->mutex));
+    return NULL;
+}
+
+/*
+    gzrOpen opens a file and starts decompressing it with numThreads inflate threads (<= 0 uses the number of online CPUs)
+    - if numCpus isn't 0, the threads can only run on the listed CPUs (they aren't pinned to one each, as there may be
+      fewer threads than CPUs)
+    - returns NULL if the file can't be opened
+*/
+gzReader_t *gzrOpen(const char *filepath, int numThreads, const int *cpus, int numCpus)
+{
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    gzReader_t *reader = calloc(1, sizeof(gzReader_t));
+    if (reader == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    pthread_mutex_init(&(reader->mutex), NULL);
+    pthread_cond_init(&(reader->workCond), NULL);
+    pthread_cond_init(&(reader->doneCond), NULL);
+
+    // check the first block for the BGZF header, otherwise fall back to a single read ahead thread
+    unsigned char header[BGZF_HEADER_SIZE];
+    reader->bgzf = (readFull(fd, header, BGZF_HEADER_SIZE) == BGZF_HEADER_SIZE && isBGZFHeader(header));
+    lseek(fd, 0, SEEK_SET);
+    if (reader->bgzf)
+    {
+        reader->fd = fd;
+        if (numThreads <= 0)
+            numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (numThreads <= 0)
+            numThreads = 1;
+    }
+    else
+    {
+        reader->fd = -1;
+        reader->gz = gzdopen(fd, "r");
+        if (reader->gz == NULL)
+        {
+            close(fd);
+            gzrClose(reader);
+            return NULL;
+        }
+        gzbuffer(reader->gz, GZREADER_BLOCK_SIZE);
+        numThreads = 1;
+    }
+
+    // set up the slots and start the workers
+    reader->numSlots = GZREADER_SLOTS_PER_THREAD * numThreads;
+    reader->slots = calloc(reader->numSlots, sizeof(gzrSlot_t));
+    reader->threads = calloc(numThreads, sizeof(pthread_t));
+    if (reader->slots == NULL || reader->threads == NULL)
+    {
+        gzrClose(reader);
+        return NULL;
+    }
+    int i;
+    for (i = 0; i < reader->numSlots; i++)
+    {
+        reader->slots[i].out = malloc(GZREADER_BLOCK_SIZE);
+        reader->slots[i].in = reader->bgzf ? malloc(GZREADER_BLOCK_SIZE) : NULL;
+        if (reader->slots[i].out == NULL || (reader->bgzf && reader->slots[i].in == NULL))
+        {
+            gzrClose(reader);
+            return NULL;
+        }
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+#ifdef __linux__
+    if (numCpus != 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (i = 0; i < numCpus; i++)
+            CPU_SET(cpus[i], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+#endif
+    for (i = 0; i < numThreads; i++)
+    {
+        if (pthread_create(&(reader->threads[i]), &attr, worker, reader))
+            break;
+        reader->numThreads++;
+    }
+    pthread_attr_destroy(&attr);
+    if (reader->numThreads == 0)
+    {
+        gzrClose(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+// gzrRead copies up to len decompressed bytes into buf
+// returns the number of bytes copied, 0 at the end of the file or -1 on error
+int gzrRead(gzReader_t *reader, void *buf, unsigned int len)
+{
+    unsigned char *dst = (unsigned char *)buf;
+    int copied = 0;
+    pthread_mutex_lock(&(reader->mutex));
+    while (copied < (int)len)
+    {
+        // wait for the next block in the file
+        gzrSlot_t *slot = &reader->slots[reader->consumed % reader->numSlots];
+        while (reader->consumed == reader->issued || slot->state != SLOT_DONE)
+            pthread_cond_wait(&(reader->doneCond), &(reader->mutex));
+        if (slot->error)
+        {
+            pthread_mutex_unlock(&(reader->mutex));
+            return copied ? copied : -1;
+        }
+        if (slot->eof)
+            break;
+
+        // copy out what is left in the block, outside of the lock
+        pthread_mutex_unlock(&(reader->mutex));
+        int n = slot->outLen - reader->outPos;
+        if (n > (int)len - copied)
+            n = len - copied;
+        memcpy(dst + copied, slot->out + reader->outPos, n);
+        copied += n;
+        reader->outPos += n;
+        pthread_mutex_lock(&(reader->mutex));
+
+        // free the slot once it has all been copied out
+        if (reader->outPos == slot->outLen)
+        {
+            slot->state = SLOT_EMPTY;
+            reader->consumed++;
+            reader->outPos = 0;
+            pthread_cond_signal(&(reader->workCond));
+        }
+    }
+    pthread_mutex_unlock(&(reader->mutex));
+    return copied;
+}
+
+// gzrIsBGZF returns true if the file is being inflated in parallel as BGZF
+bool gzrIsBGZF(gzReader_t *reader)
+{
+    return reader->bgzf;
+}
+
+// gzrClose stops the workers and closes the file
+void gzrClose(gzReader_t *reader)
+{
+    if (reader == NULL)
+        return;
+    if (reader->numThreads != 0)
+    {
+        pthread_mutex_lock(&(reader->mutex));
+        reader->stop = true;
+        pthread_cond_broadcast(&(reader->workCond));
+        pthread_mutex_unlock(&(reader->mutex));
+        int i;
+        for (i = 0; i < reader->numThreads; i++)
+            pthread_join(reader->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&(reader->mutex));
+    pthread_cond_destroy(&(reader->workCond));
+    pthread_cond_destroy(&(reader->doneCond));
+    if (reader->slots != NULL)
+    {
+        int i;
+        for (i = 0; i < reader->numSlots; i++)
+        {
+            free(reader->slots[i].in);
+            free(reader->slots[i].out);
+        }
+    }
+    free(reader->slots);
+    free(reader->threads);
+    if (reader->gz != NULL)
+        gzclose(reader->gz);
+    if (reader->fd >= 0)
+        close(reader->fd);
+    free(reader);
+}
@@ -0,0 +1,24 @@
+// gzreader is a threaded replacement for gzread, which inflates BGZF blocks in parallel and reads ahead on other files
+#ifndef GZREADER_H
+#define GZREADER_H
+
+#include <stdbool.h>
+
+// GZREADER_BLOCK_SIZE is the largest BGZF block (compressed or not), and the size of each read ahead chunk for other files
+#define GZREADER_BLOCK_SIZE 65536
+
+// GZREADER_SLOTS_PER_THREAD sets how many blocks can be read ahead for each inflate thread
+#define GZREADER_SLOTS_PER_THREAD 4
+
+//
+typedef struct gzReader gzReader_t;
+
+/*
+    function prototypes
+*/
+gzReader_t *gzrOpen(const char *filepath, int numThreads, const int *cpus, int numCpus);
+int gzrRead(gzReader_t *reader, void *buf, unsigned int len);
+bool gzrIsBGZF(gzReader_t *reader);
+void gzrClose(gzReader_t *reader);
+
+#endif
@@ -4,80 +4,175 @@
 #include <stdbool.h>
 #include "hashmap.h"
 
-kmer* hashArray[HASHMAP_SIZE];
+/*
+   the hashmap is a linear probing set of hashed k-mers, stored inline in a power-of-two table
 
-// kmer
-struct kmer { 
+   each slot is stamped with the epoch it was written in and only counts as occupied if the
+   stamp matches the current epoch, so hmClear just bumps the epoch instead of touching the table
+
+   deletions use backward shifting, so there are no tombstones and probe chains are never broken
+*/
+
+// slot
+typedef struct slot {
    uint64_t kmerHash;
+   uint32_t epoch;
+} slot_t;
+
+// hashmap is owned by a single sketcher, so no locking is needed
+struct hashmap {
+   slot_t* slots;
+   uint64_t mask;    // capacity - 1
+   int capacity;     // number of slots (a power of two)
+   int count;        // number of occupied slots
+   uint32_t epoch;   // the current epoch
+   int shift;        // 64 - log2(capacity), used to get the home slot
 };
 
-// hmInsert a hashed k-mer into the hashmap
-// returns true if inserted, false if not
-bool hmInsert(uint64_t kmerHash) {
+// homeSlot returns the first slot to probe for a hashed k-mer
+// the low byte of a hashed k-mer holds the k-mer span, so fibonacci hashing is used to take the high bits
+static inline uint64_t homeSlot(hashmap_t* hm, uint64_t kmerHash) {
+   return (kmerHash * 0x9E3779B97F4A7C15ULL) >> hm->shift;
+}
+
+// isOccupied checks if a slot holds a value written in the current epoch
+static inline bool isOccupied(hashmap_t* hm, uint64_t i) {
+   return hm->slots[i].epoch == hm->epoch;
+}
+
+// hmInit allocates an empty hashmap that can hold at least maxElements at a load factor of 0.5 or less
+hashmap_t* hmInit(int maxElements) {
+   hashmap_t* hm = (hashmap_t*) malloc(sizeof(hashmap_t));
+   if (hm == NULL)
+      return NULL;
+   int capacity = HASHMAP_MIN_CAPACITY, bits = 4;
+   while (capacity < 2 * maxElements) {
+      capacity <<= 1;
+      bits++;
+   }
+   hm->slots = (slot_t*) calloc(capacity, sizeof(slot_t));
+   if (hm->slots == NULL) {
+      free(hm);
+      return NULL;
+   }
+   hm->capacity = capacity;
+   hm->mask = capacity - 1;
+   hm->shift = 64 - bits;
+   hm->count = 0;
+   hm->epoch = 1;
+   return hm;
+}
 
-   // get the initial index position for this hashed k-mer in the hashmap
-   int hashIndex = kmerHash % HASHMAP_SIZE;
+// hmCapacity returns the number of slots in the hashmap
+int hmCapacity(hashmap_t* hm) {
+   return hm->capacity;
+}
 
-   // if the array cell at the hashIndex is full, keep moving until an empty one is found or until all cells have been checked
-   int counter = 0;
-   while (hashArray[hashIndex] != NULL) {
-      hashIndex++;
-      hashIndex %= HASHMAP_SIZE;
+// hmCount returns the number of values in the hashmap
+int hmCount(hashmap_t* hm) {
+   return hm->count;
+}
 
-      // if the array is full, return false
-      counter++;
-      if (counter == HASHMAP_SIZE) {
+// hmGrow rehashes the hashmap into a larger table that can hold at least maxElements
+// returns 0 on success (the hashmap is unchanged if the new table can't be allocated)
+int hmGrow(hashmap_t* hm, int maxElements) {
+   hashmap_t* bigger = hmInit(maxElements);
+   if (bigger == NULL)
+      return 1;
+   if (bigger->capacity <= hm->capacity) {
+      hmDestroy(bigger);
+      return 0;
+   }
+   int i;
+   for (i = 0; i < hm->capacity; i++)
+      if (isOccupied(hm, i))
+         hmInsert(bigger, hm->slots[i].kmerHash);
+   free(hm->slots);
+   *hm = *bigger;
+   free(bigger);
+   return 0;
+}
+
+// hmInsert a hashed k-mer into the hashmap
+// returns true if inserted, false if it was already present or the hashmap is full
+// (one slot is always left empty so that probing terminates)
+bool hmInsert(hashmap_t* hm, uint64_t kmerHash) {
+   if (hm->count == hm->capacity - 1)
+      return false;
+
+   // keep moving from the home slot until the hashed k-mer or an empty slot is found
+   uint64_t i = homeSlot(hm, kmerHash);
+   while (isOccupied(hm, i)) {
+      if (hm->slots[i].kmerHash == kmerHash)
          return false;
-      }
+      i = (i + 1) & hm->mask;
    }
 
    // store the hashed k-mer
-   struct kmer *tmp = (kmer*) malloc(sizeof(struct kmer));
-   tmp->kmerHash = kmerHash;
-   hashArray[hashIndex] = tmp;
+   hm->slots[i].kmerHash = kmerHash;
+   hm->slots[i].epoch = hm->epoch;
+   hm->count++;
    return true;
 }
 
 // hmSearch for a hashed k-mer in the hashmap
 // returns true if present, false if absent
-bool hmSearch(uint64_t kmerHash) {
-
-   // find the approximate location of the hashed k-mer in the array
-   int hashIndex = kmerHash % HASHMAP_SIZE;  
-
-   // if NULL is found before the query, then the query is not in the array or has been deleted
-   while(hashArray[hashIndex] != NULL) {
-      if(hashArray[hashIndex]->kmerHash == kmerHash)
-         return true; 
-			
-      // go to next cell in the array
-      hashIndex++;
-		
-      // make sure the index wraps around the array
-      hashIndex %= HASHMAP_SIZE;
+bool hmSearch(hashmap_t* hm, uint64_t kmerHash) {
+
+   // if an empty slot is found before the query, then the query is not in the table
+   uint64_t i = homeSlot(hm, kmerHash);
+   while (isOccupied(hm, i)) {
+      if (hm->slots[i].kmerHash == kmerHash)
+         return true;
+      i = (i + 1) & hm->mask;
    }
    return false;        
 }
 
 // hmDelete will remove a hashed k-mer from the map
-void hmDelete(uint64_t kmerHash) {
-   int hashIndex = kmerHash % HASHMAP_SIZE;
-   while(hashArray[hashIndex] != NULL) {
-      if(hashArray[hashIndex]->kmerHash == kmerHash) {
-         free(hashArray[hashIndex]);
-         hashArray[hashIndex] = NULL;
+void hmDelete(hashmap_t* hm, uint64_t kmerHash) {
+
+   // find the hashed k-mer
+   uint64_t i = homeSlot(hm, kmerHash);
+   while (isOccupied(hm, i)) {
+      if (hm->slots[i].kmerHash == kmerHash)
          break;
-      }
-      hashIndex++;
-      hashIndex %= HASHMAP_SIZE;
-   }      
+      i = (i + 1) & hm->mask;
+   }
+   if (!isOccupied(hm, i))
+      return;
+   hm->count--;
+
+   // shift back any later values in the probe chain that can now sit closer to their home slot
+   uint64_t j = i;
+   while (1) {
+      hm->slots[i].epoch = hm->epoch - 1;
+      do {
+         j = (j + 1) & hm->mask;
+         if (!isOccupied(hm, j))
+            return;
+      } while (((j - homeSlot(hm, hm->slots[j].kmerHash)) & hm->mask) < ((j - i) & hm->mask));
+      hm->slots[i] = hm->slots[j];
+      i = j;
+   }
 }
 
-// hmDestroy will free the hashmap
-void hmDestroy(void) {
-   int i;
-   for (i = 0; i < HASHMAP_SIZE; i++) {
-      free(hashArray[i]);
-      hashArray[i] = NULL;      
+// hmClear will empty the hashmap so that it can be reused
+void hmClear(hashmap_t* hm) {
+   hm->count = 0;
+   hm->epoch++;
+
+   // the epoch has wrapped, so the stamps do need wiping this time
+   if (hm->epoch == 0) {
+      memset(hm->slots, 0, hm->capacity * sizeof(slot_t));
+      hm->epoch = 1;
    }
-}
\ No newline at end of file
+}
+
+// hmDestroy will free the hashmap
+void hmDestroy(hashmap_t* hm) {
+   if (hm == NULL)
+      return;
+   free(hm->slots);
+   free(hm);
+}
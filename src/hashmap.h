@@ -1,21 +1,27 @@
-// simple hash map which uses linear probing to keep track of what hash values are currently in a KMV sketch
+// simple hash set which uses open addressing to keep track of what hash values are currently in a KMV sketch
 #ifndef HASHMAP_H
 #define HASHMAP_H
 
 #include <stdbool.h>
 #include <stdint.h>
 
-#define HASHMAP_SIZE 256
+// HASHMAP_MIN_CAPACITY is the smallest table that will be allocated
+#define HASHMAP_MIN_CAPACITY 16
 
 //
-typedef struct kmer kmer;
+typedef struct hashmap hashmap_t;
 
 /*
     function prototypes
 */
-bool hmInsert(uint64_t kmerHash);
-bool hmSearch(uint64_t kmerHash);
-void hmDelete(uint64_t kmerHash);
-void hmDestroy(void);
+hashmap_t *hmInit(int maxElements);
+int hmCapacity(hashmap_t *hm);
+int hmCount(hashmap_t *hm);
+int hmGrow(hashmap_t *hm, int maxElements);
+bool hmInsert(hashmap_t *hm, uint64_t kmerHash);
+bool hmSearch(hashmap_t *hm, uint64_t kmerHash);
+void hmDelete(hashmap_t *hm, uint64_t kmerHash);
+void hmClear(hashmap_t *hm);
+void hmDestroy(hashmap_t *hm);
 
-#endif
\ No newline at end of file
+#endif
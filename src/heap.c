@@ -1,89 +1,114 @@
 #include <stdio.h> 
 #include <stdlib.h> 
+#include <string.h>
 #include "heap.h"
 #include "slog.h"
 
-// node is the building block for the heap
-struct node { 
-    struct node* next; 
-    uint64_t minimum; // the hashed k-mer
+// heap is an array binary max-heap, with the largest minimum at index 0
+struct heap { 
+    uint64_t* minimums; // the hashed k-mers
+    int size;           // how many minimums are currently in the heap
+    int capacity;       // the maximum number of minimums (the sketch size)
 };
 
-// initHeap creates a new node in the heap 
-node_t* initHeap(uint64_t minimum) { 
-    node_t* tmp = (node_t*)malloc(sizeof(node_t)); 
-    tmp->next = NULL; 
-    tmp->minimum = minimum; 
+// siftUp moves the minimum at index i up the heap until the heap property is restored
+static inline void siftUp(uint64_t* minimums, int i) {
+    uint64_t minimum = minimums[i];
+    while (i > 0) {
+        int parent = (i - 1) >> 1;
+        if (minimums[parent] >= minimum) break;
+        minimums[i] = minimums[parent];
+        i = parent;
+    }
+    minimums[i] = minimum;
+}
+
+// siftDown moves the minimum at index i down the heap until the heap property is restored
+static inline void siftDown(uint64_t* minimums, int size, int i) {
+    uint64_t minimum = minimums[i];
+    int child;
+    while ((child = 2 * i + 1) < size) {
+
+        // pick the larger of the two children
+        if (child + 1 < size && minimums[child + 1] > minimums[child]) child++;
+        if (minimums[child] <= minimum) break;
+        minimums[i] = minimums[child];
+        i = child;
+    }
+    minimums[i] = minimum;
+}
+
+// initHeap creates an empty heap that can hold capacity minimums
+heap_t* initHeap(int capacity) { 
+    heap_t* tmp = (heap_t*)malloc(sizeof(heap_t)); 
+    if (tmp == NULL) return NULL;
+    tmp->minimums = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    if (tmp->minimums == NULL) {
+        free(tmp);
+        return NULL;
+    }
+    tmp->size = 0;
+    tmp->capacity = capacity;
     return tmp; 
 } 
+
+// resetHeap empties the heap without releasing its storage
+void resetHeap(heap_t* heap) {
+    heap->size = 0;
+}
+
+// heapSize returns the number of minimums currently in the heap
+int heapSize(heap_t* heap) {
+    return heap->size;
+}
   
 // peek will return the largest minimum currently in the heap
-uint64_t peek(node_t** head) {
-    return (*head)->minimum; 
+uint64_t peek(heap_t* heap) {
+    return heap->minimums[0]; 
 }
   
-// pop will remove the largest minimum currently in the heap and return it
-void pop(node_t** head) {
-    node_t* tmp = *head; 
-    (*head) = (*head)->next; 
-    free(tmp); 
+// pop will remove the largest minimum currently in the heap
+void pop(heap_t* heap) {
+    if (heap->size == 0) return;
+    heap->size--;
+    if (heap->size == 0) return;
+    heap->minimums[0] = heap->minimums[heap->size];
+    siftDown(heap->minimums, heap->size, 0);
 } 
   
-// push will add a minimum to the heap 
-void push(node_t** head, uint64_t minimum) {
-
-    // create a new node for the incoming minimum 
-    node_t* tmp = initHeap(minimum); 
-
-    // start with the largest minimum already in the heap
-    node_t* start = (*head); 
-
-    // if the new minimum > the start node, add it at the top of the heap and change the head node 
-    if ((*head)->minimum < minimum) {
-        tmp->next = *head; 
-        (*head) = tmp; 
-    }
+// push will add a minimum to the heap, it's the callers job to check the heap isn't full
+void push(heap_t* heap, uint64_t minimum) {
+    heap->minimums[heap->size] = minimum;
+    siftUp(heap->minimums, heap->size);
+    heap->size++;
+}
 
-    // otherwise, move down the heap and find where the new minimum should be inserted
-    else { 
-        while (start->next != NULL && start->next->minimum > minimum) { 
-            start = start->next; 
-        }
-        tmp->next = start->next; 
-        start->next = tmp; 
-    }
+// replaceTop swaps the largest minimum in the heap for a new minimum (equivalent to pop then push)
+void replaceTop(heap_t* heap, uint64_t minimum) {
+    heap->minimums[0] = minimum;
+    siftDown(heap->minimums, heap->size, 0);
 }
 
-// getSketch adds the heap values to an array, from top to bottom (largest to smallest)
+// getSketch copies the heap values to an array (in heap order) and returns how many were copied
 // it's the callers job to init and free the sketch
-void getSketch(node_t** head, int numValues, uint64_t* sketch) {
-    node_t* start = (*head);
-    int i = 0;
-    while(start->next != NULL) {
-        *(sketch + i) = start->minimum;
-        start = start->next;
-        i++;
-    }
-
-    // grab the final value and then return
-    *(sketch + i) = start->minimum;
-    return;
+int getSketch(heap_t* heap, uint64_t* sketch) {
+    memcpy(sketch, heap->minimums, heap->size * sizeof(uint64_t));
+    return heap->size;
 }
 
 // isEmpty checks if the heap is empty
-bool isEmpty(node_t** head) {
-    return (*head) == NULL; 
+bool isEmpty(heap_t* heap) {
+    return heap->size == 0; 
 }
 
-// destroy will free the heap
-void destroy(node_t** head) {
-    node_t *tmp;
-
-    // set the tmp node to head and stop the traversal if the list is empty
-    while ((tmp = *head) != NULL) { 
-        (*head) = (*head)->next;
-        free(tmp);
-    }
+// isFull checks if the heap is at capacity
+bool isFull(heap_t* heap) {
+    return heap->size == heap->capacity;
 }
 
-
+// destroy will free the heap
+void destroy(heap_t* heap) {
+    if (heap == NULL) return;
+    free(heap->minimums);
+    free(heap);
+}
@@ -1,4 +1,4 @@
-// heap is a heap implementation using a linked list
+// heap is a fixed-capacity binary max-heap stored in a contiguous array
 // the heap is represents the KMV MinHash sketch, containing a subset of hashed k-mers
 #ifndef HEAP_H
 #define HEAP_H
@@ -7,20 +7,25 @@
 #include <stdint.h>
 
 /*
-    node_t contains information for a minimum (hashed k-mer)
-    the heap is linked list of nodes and equates to a KMV MinHash sketch
+    heap_t holds up to capacity minimums (hashed k-mers)
+    the largest minimum is always at the top, so it can be replaced in O(log k)
+    the heap is allocated once and can be reset and reused for each sketch
 */
-typedef struct node node_t;
+typedef struct heap heap_t;
 
 /*
     function prototypes
 */
-node_t *initHeap(uint64_t minimum);
-uint64_t peek(node_t **head);
-void pop(node_t **head);
-void push(node_t **head, uint64_t minimum);
-void getSketch(node_t **head, int numValues, uint64_t *sketch);
-bool isEmpty(node_t **head);
-void destroy(node_t **head);
+heap_t *initHeap(int capacity);
+void resetHeap(heap_t *heap);
+int heapSize(heap_t *heap);
+uint64_t peek(heap_t *heap);
+void pop(heap_t *heap);
+void push(heap_t *heap, uint64_t minimum);
+void replaceTop(heap_t *heap, uint64_t minimum);
+int getSketch(heap_t *heap, uint64_t *sketch);
+bool isEmpty(heap_t *heap);
+bool isFull(heap_t *heap);
+void destroy(heap_t *heap);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,68 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "hll.h"
+#include "kmerhash.h"
+
+// hllInit allocates an empty HyperLogLog with 2^p registers
+hll_t *hllInit(int p)
+{
+    assert(p >= 4 && p <= 18);
+    hll_t *hll = malloc(sizeof(hll_t));
+    if (hll == NULL)
+        return NULL;
+    hll->p = p;
+    hll->m = 1 << p;
+    hll->registers = calloc(hll->m, sizeof(uint8_t));
+    if (hll->registers == NULL)
+    {
+        free(hll);
+        return NULL;
+    }
+    return hll;
+}
+
+/*
+    hllAdd adds a hashed k-mer to the HyperLogLog
+    - the registers are updated with a compare and swap, so workers can share one HyperLogLog without a lock
+    - a register only changes when it increases, which quickly becomes rare, so the common case is a single load
+*/
+void hllAdd(hll_t *hll, uint64_t hashedKmer)
+{
+    uint64_t x = fmix64(hashedKmer);
+    uint8_t *reg = &hll->registers[x >> (64 - hll->p)];
+
+    // the rank is the position of the first set bit after the index bits (the sentinel bit caps it)
+    uint8_t rank = __builtin_clzll(x << hll->p | 1ULL << (hll->p - 1)) + 1;
+    uint8_t current = __atomic_load_n(reg, __ATOMIC_RELAXED);
+    while (rank > current && !__atomic_compare_exchange_n(reg, &current, rank, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// hllEstimate returns the estimated number of distinct hashed k-mers added so far
+double hllEstimate(hll_t *hll)
+{
+    double sum = 0.0, alpha = 0.7213 / (1.0 + 1.079 / hll->m);
+    int zeros = 0, i;
+    for (i = 0; i < hll->m; i++)
+    {
+        sum += ldexp(1.0, -hll->registers[i]);
+        zeros += hll->registers[i] == 0;
+    }
+    double estimate = alpha * hll->m * hll->m / sum;
+
+    // use linear counting while there are still empty registers and the raw estimate is biased
+    if (estimate <= 2.5 * hll->m && zeros != 0)
+        estimate = hll->m * log((double)hll->m / zeros);
+    return estimate;
+}
+
+// hllDestroy frees a HyperLogLog
+void hllDestroy(hll_t *hll)
+{
+    if (hll == NULL)
+        return;
+    free(hll->registers);
+    free(hll);
+}
@@ -0,0 +1,26 @@
+// hll is a HyperLogLog sketch for estimating how many distinct hashed k-mers have been seen
+#ifndef HLL_H
+#define HLL_H
+
+#include <stdint.h>
+
+// HLL_PRECISION is the default number of index bits (2^14 registers, ~0.8% standard error)
+#define HLL_PRECISION 14
+
+// hll_t holds one 8 bit register per bucket
+typedef struct hll
+{
+    int p;
+    int m;
+    uint8_t *registers;
+} hll_t;
+
+/*
+    function prototypes
+*/
+hll_t *hllInit(int p);
+void hllAdd(hll_t *hll, uint64_t hashedKmer);
+double hllEstimate(hll_t *hll);
+void hllDestroy(hll_t *hll);
+
+#endif
@@ -0,0 +1,272 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "inotify.h"
+#include "slog.h"
+
+/*
+    the inotify watcher watches a directory tree for files that have been closed after writing (IN_CLOSE_WRITE)
+    or renamed into place (IN_MOVED_TO)
+
+    it runs a single thread which waits on epoll for inotify events and for a stop signal (an eventfd),
+    and tells the readiness stage about FASTQ files as soon as the event is read
+
+    files which are already in a newly created subdirectory by the time it is watched have missed their events,
+    so these are passed on as pending and the readiness stage waits for them to stop changing
+*/
+
+// the events to watch for on every directory
+#define INOTIFY_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR)
+
+// the size of the buffer used to read inotify events
+#define INOTIFY_BUFFER_SIZE 65536
+
+// inotifyWatcher
+struct inotifyWatcher
+{
+    int inotifyFd;         // the inotify instance
+    int stopFd;            // eventfd used to stop the watcher thread
+    int epollFd;           // waits on the inotify instance and the stop eventfd
+    char **wdPaths;        // maps watch descriptors to directory paths
+    int wdCapacity;        // the length of wdPaths
+    readiness_t *readiness; // receives the FASTQ files
+    pthread_t thread;      // the watcher thread
+    bool running;          // set if the watcher thread has been started
+};
+
+// setWatchPath records the directory path for a watch descriptor
+static int setWatchPath(inotifyWatcher_t *watcher, int wd, const char *path)
+{
+    if (wd >= watcher->wdCapacity)
+    {
+        int capacity = watcher->wdCapacity ? watcher->wdCapacity : 64;
+        while (capacity <= wd)
+            capacity *= 2;
+        char **tmp = realloc(watcher->wdPaths, capacity * sizeof(char *));
+        if (tmp == NULL)
+            return 1;
+        memset(tmp + watcher->wdCapacity, 0, (capacity - watcher->wdCapacity) * sizeof(char *));
+        watcher->wdPaths = tmp;
+        watcher->wdCapacity = capacity;
+    }
+    free(watcher->wdPaths[wd]);
+    watcher->wdPaths[wd] = strdup(path);
+    return watcher->wdPaths[wd] == NULL;
+}
+
+// addWatchTree adds a watch for a directory and all of its subdirectories
+// if notifyFiles is set, any FASTQ files already in the tree are sent to the readiness stage as pending
+static int addWatchTree(inotifyWatcher_t *watcher, const char *dirPath, bool notifyFiles)
+{
+    int wd = inotify_add_watch(watcher->inotifyFd, dirPath, INOTIFY_MASK);
+    if (wd < 0)
+    {
+        slog(0, SLOG_ERROR, "could not watch directory: %s (%s)", dirPath, strerror(errno));
+        return 1;
+    }
+    if (setWatchPath(watcher, wd, dirPath) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the watch path: %s", dirPath);
+        return 1;
+    }
+
+    // walk the subdirectories
+    DIR *dir = opendir(dirPath);
+    if (dir == NULL)
+        return 0;
+    struct dirent *entry;
+    char path[PATH_MAX];
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name) >= (int)sizeof(path))
+            continue;
+        struct stat sb;
+        if (entry->d_type == DT_DIR || (entry->d_type == DT_UNKNOWN && stat(path, &sb) == 0 && S_ISDIR(sb.st_mode)))
+            addWatchTree(watcher, path, notifyFiles);
+        else if (notifyFiles && isFastq(path))
+            readinessNotify(watcher->readiness, path, false);
+    }
+    closedir(dir);
+    return 0;
+}
+
+// handleEvent deals with a single inotify event
+static void handleEvent(inotifyWatcher_t *watcher, const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        slog(0, SLOG_WARN, "\t- [watcher]:\tinotify queue overflowed, some files may have been missed");
+        return;
+    }
+
+    // the watch has gone (e.g. the directory was removed)
+    if (event->mask & IN_IGNORED)
+    {
+        if (event->wd < watcher->wdCapacity)
+        {
+            free(watcher->wdPaths[event->wd]);
+            watcher->wdPaths[event->wd] = NULL;
+        }
+        return;
+    }
+    if (event->len == 0 || event->wd >= watcher->wdCapacity || watcher->wdPaths[event->wd] == NULL)
+        return;
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", watcher->wdPaths[event->wd], event->name) >= (int)sizeof(path))
+    {
+        slog(0, SLOG_ERROR, "\t- [watcher]:\tpath too long, ignoring: %s", event->name);
+        return;
+    }
+
+    // start watching any new subdirectories
+    if (event->mask & IN_ISDIR)
+    {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+            addWatchTree(watcher, path, true);
+        return;
+    }
+
+    // files are only sent on once they have been closed after writing, or moved into place
+    if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && isFastq(path))
+    {
+        slog(0, SLOG_LIVE, "\t- [watcher]:\tfound a FASTQ file: %s", path);
+        readinessNotify(watcher->readiness, path, true);
+    }
+}
+
+// inotifyLoop reads inotify events until the stop eventfd is signalled
+static void *inotifyLoop(void *param)
+{
+    inotifyWatcher_t *watcher = (inotifyWatcher_t *)param;
+    char buf[INOTIFY_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct epoll_event events[2];
+    while (1)
+    {
+        int n = epoll_wait(watcher->epollFd, events, 2, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            slog(0, SLOG_ERROR, "\t- [watcher]:\tepoll failed: %s", strerror(errno));
+            return NULL;
+        }
+        int i;
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == watcher->stopFd)
+                return NULL;
+        }
+
+        // drain the inotify instance
+        ssize_t len;
+        while ((len = read(watcher->inotifyFd, buf, sizeof(buf))) > 0)
+        {
+            char *ptr;
+            const struct inotify_event *event;
+            for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len)
+            {
+                event = (const struct inotify_event *)ptr;
+                handleEvent(watcher, event);
+            }
+        }
+        if (len < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            slog(0, SLOG_ERROR, "\t- [watcher]:\tcould not read inotify events: %s", strerror(errno));
+            return NULL;
+        }
+    }
+}
+
+// inotifyInit sets up a watcher for a directory tree (which isn't started until inotifyStart is called)
+inotifyWatcher_t *inotifyInit(const char *watchDir, readiness_t *readiness)
+{
+    inotifyWatcher_t *watcher = calloc(1, sizeof(inotifyWatcher_t));
+    if (watcher == NULL)
+        return NULL;
+    watcher->readiness = readiness;
+    watcher->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watcher->stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    watcher->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (watcher->inotifyFd < 0 || watcher->stopFd < 0 || watcher->epollFd < 0)
+    {
+        slog(0, SLOG_ERROR, "could not create the inotify instance: %s", strerror(errno));
+        inotifyDestroy(watcher);
+        return NULL;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = watcher->inotifyFd;
+    if (epoll_ctl(watcher->epollFd, EPOLL_CTL_ADD, watcher->inotifyFd, &ev) != 0)
+    {
+        inotifyDestroy(watcher);
+        return NULL;
+    }
+    ev.data.fd = watcher->stopFd;
+    if (epoll_ctl(watcher->epollFd, EPOLL_CTL_ADD, watcher->stopFd, &ev) != 0)
+    {
+        inotifyDestroy(watcher);
+        return NULL;
+    }
+    if (addWatchTree(watcher, watchDir, false) != 0)
+    {
+        inotifyDestroy(watcher);
+        return NULL;
+    }
+    return watcher;
+}
+
+// inotifyStart starts the watcher thread (returns 0 on success)
+int inotifyStart(inotifyWatcher_t *watcher)
+{
+    if (pthread_create(&watcher->thread, NULL, inotifyLoop, watcher))
+        return 1;
+    watcher->running = true;
+    return 0;
+}
+
+// inotifyStop signals the watcher thread to stop and waits for it to exit (returns 0 on success)
+int inotifyStop(inotifyWatcher_t *watcher)
+{
+    if (!watcher->running)
+        return 0;
+    uint64_t one = 1;
+    if (write(watcher->stopFd, &one, sizeof(one)) != sizeof(one))
+        return 1;
+    if (pthread_join(watcher->thread, NULL))
+        return 1;
+    watcher->running = false;
+    return 0;
+}
+
+// inotifyDestroy closes the inotify instance and frees the watcher
+void inotifyDestroy(inotifyWatcher_t *watcher)
+{
+    if (watcher == NULL)
+        return;
+    inotifyStop(watcher);
+    if (watcher->epollFd >= 0)
+        close(watcher->epollFd);
+    if (watcher->stopFd >= 0)
+        close(watcher->stopFd);
+    if (watcher->inotifyFd >= 0)
+        close(watcher->inotifyFd);
+    int i;
+    for (i = 0; i < watcher->wdCapacity; i++)
+        free(watcher->wdPaths[i]);
+    free(watcher->wdPaths);
+    free(watcher);
+}
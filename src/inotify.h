@@ -0,0 +1,18 @@
+// inotify is the native Linux directory watcher, which hands finished FASTQ files to the readiness stage
+#ifndef INOTIFY_H
+#define INOTIFY_H
+
+#include "readiness.h"
+
+//
+typedef struct inotifyWatcher inotifyWatcher_t;
+
+/*
+    function prototypes
+*/
+inotifyWatcher_t *inotifyInit(const char *watchDir, readiness_t *readiness);
+int inotifyStart(inotifyWatcher_t *watcher);
+int inotifyStop(inotifyWatcher_t *watcher);
+void inotifyDestroy(inotifyWatcher_t *watcher);
+
+#endif
@@ -0,0 +1,165 @@
+#include <pthread.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "kmerhash.h"
+
+/*
+    hash64 only uses shifts, adds, xors and masks, so the batched kernels run it on 4 (AVX2) or 8 (AVX-512) k-mers per instruction
+
+    the sketcher hashes a batch of k-mers and then uses filterBelow to find the few that are below the current sketch maximum,
+    so most k-mers never reach the hashmap or heap
+
+    the kernels are picked at runtime on the first call, and the scalar versions handle any partial vector at the end of a batch
+*/
+
+// hash64BatchScalar hashes a batch of k-mers one at a time
+void hash64BatchScalar(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        hashes[i] = hash64(kmers[i], mask) << 8 | span;
+}
+
+// filterBelowScalar finds the hashes below the threshold, without branching on each one
+int filterBelowScalar(const uint64_t *hashes, int n, uint64_t threshold, int *idx)
+{
+    int i, m = 0;
+    for (i = 0; i < n; i++)
+    {
+        idx[m] = i;
+        m += hashes[i] < threshold;
+    }
+    return m;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// hash64BatchAVX2 hashes 4 k-mers at a time
+__attribute__((target("avx2"))) void hash64BatchAVX2(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes)
+{
+    const __m256i m = _mm256_set1_epi64x(mask), s = _mm256_set1_epi64x(span), ones = _mm256_set1_epi64x(-1);
+    int i;
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m256i key = _mm256_loadu_si256((const __m256i *)(kmers + i));
+        key = _mm256_and_si256(_mm256_add_epi64(_mm256_xor_si256(key, ones), _mm256_slli_epi64(key, 21)), m);
+        key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 24));
+        key = _mm256_and_si256(_mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 3)), _mm256_slli_epi64(key, 8)), m);
+        key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 14));
+        key = _mm256_and_si256(_mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 2)), _mm256_slli_epi64(key, 4)), m);
+        key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 28));
+        key = _mm256_and_si256(_mm256_add_epi64(key, _mm256_slli_epi64(key, 31)), m);
+        _mm256_storeu_si256((__m256i *)(hashes + i), _mm256_or_si256(_mm256_slli_epi64(key, 8), s));
+    }
+    hash64BatchScalar(kmers + i, n - i, mask, span, hashes + i);
+}
+
+// filterBelowAVX2 compares 4 hashes at a time (AVX2 only has a signed compare, so the sign bits are flipped first)
+__attribute__((target("avx2"))) int filterBelowAVX2(const uint64_t *hashes, int n, uint64_t threshold, int *idx)
+{
+    const __m256i flip = _mm256_set1_epi64x(INT64_MIN), t = _mm256_xor_si256(_mm256_set1_epi64x(threshold), flip);
+    int i, m = 0;
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m256i h = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(hashes + i)), flip);
+        int below = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(t, h)));
+        while (below)
+        {
+            idx[m++] = i + __builtin_ctz(below);
+            below &= below - 1;
+        }
+    }
+    for (; i < n; i++)
+    {
+        idx[m] = i;
+        m += hashes[i] < threshold;
+    }
+    return m;
+}
+
+// hash64BatchAVX512 hashes 8 k-mers at a time
+__attribute__((target("avx512f"))) void hash64BatchAVX512(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes)
+{
+    const __m512i m = _mm512_set1_epi64(mask), s = _mm512_set1_epi64(span), ones = _mm512_set1_epi64(-1);
+    int i;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        __m512i key = _mm512_loadu_si512((const void *)(kmers + i));
+        key = _mm512_and_si512(_mm512_add_epi64(_mm512_xor_si512(key, ones), _mm512_slli_epi64(key, 21)), m);
+        key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 24));
+        key = _mm512_and_si512(_mm512_add_epi64(_mm512_add_epi64(key, _mm512_slli_epi64(key, 3)), _mm512_slli_epi64(key, 8)), m);
+        key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 14));
+        key = _mm512_and_si512(_mm512_add_epi64(_mm512_add_epi64(key, _mm512_slli_epi64(key, 2)), _mm512_slli_epi64(key, 4)), m);
+        key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 28));
+        key = _mm512_and_si512(_mm512_add_epi64(key, _mm512_slli_epi64(key, 31)), m);
+        _mm512_storeu_si512((void *)(hashes + i), _mm512_or_si512(_mm512_slli_epi64(key, 8), s));
+    }
+    hash64BatchScalar(kmers + i, n - i, mask, span, hashes + i);
+}
+
+// filterBelowAVX512 compares 8 hashes at a time
+__attribute__((target("avx512f"))) int filterBelowAVX512(const uint64_t *hashes, int n, uint64_t threshold, int *idx)
+{
+    const __m512i t = _mm512_set1_epi64(threshold);
+    int i, m = 0;
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        unsigned int below = _mm512_cmplt_epu64_mask(_mm512_loadu_si512((const void *)(hashes + i)), t);
+        while (below)
+        {
+            idx[m++] = i + __builtin_ctz(below);
+            below &= below - 1;
+        }
+    }
+    for (; i < n; i++)
+    {
+        idx[m] = i;
+        m += hashes[i] < threshold;
+    }
+    return m;
+}
+#endif
+
+// kernels holds the batched functions picked for this CPU
+static struct
+{
+    hashBatchFunc_t hash;
+    filterBelowFunc_t filter;
+} kernels;
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+// selectKernels picks the widest kernels that the CPU supports
+static void selectKernels(void)
+{
+    kernels.hash = hash64BatchScalar;
+    kernels.filter = filterBelowScalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        kernels.hash = hash64BatchAVX512;
+        kernels.filter = filterBelowAVX512;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.hash = hash64BatchAVX2;
+        kernels.filter = filterBelowAVX2;
+    }
+#endif
+}
+
+// hash64Batch hashes a batch of k-mers with the widest kernel that the CPU supports
+void hash64Batch(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes)
+{
+    pthread_once(&kernelsOnce, selectKernels);
+    kernels.hash(kmers, n, mask, span, hashes);
+}
+
+// filterBelow finds the hashes below a threshold with the widest kernel that the CPU supports
+int filterBelow(const uint64_t *hashes, int n, uint64_t threshold, int *idx)
+{
+    pthread_once(&kernelsOnce, selectKernels);
+    return kernels.filter(hashes, n, threshold, idx);
+}
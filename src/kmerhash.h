@@ -0,0 +1,62 @@
+// kmerhash has the k-mer hash function, and batched versions of it which use AVX2 or AVX-512 when the CPU supports them
+#ifndef KMERHASH_H
+#define KMERHASH_H
+
+#include <stdint.h>
+
+// KMERHASH_BATCH is the number of k-mers the sketcher collects before hashing them together
+#define KMERHASH_BATCH 256
+
+// hash64 is the invertible integer hash from minimap2, applied to a 2k bit k-mer
+static inline uint64_t hash64(uint64_t key, uint64_t mask)
+{
+    key = (~key + (key << 21)) & mask; // key = (key << 21) - key - 1;
+    key = key ^ key >> 24;
+    key = ((key + (key << 3)) + (key << 8)) & mask; // key * 265
+    key = key ^ key >> 14;
+    key = ((key + (key << 2)) + (key << 4)) & mask; // key * 21
+    key = key ^ key >> 28;
+    key = (key + (key << 31)) & mask;
+    return key;
+}
+
+// hash128 reduces a k-mer of up to 64 bases (k > 31), held in two words, to 64 bits
+// both words go through the full width hash64 so that every base affects every bit of the result
+static inline uint64_t hash128(uint64_t lo, uint64_t hi)
+{
+    return hash64(hash64(hi, UINT64_MAX) ^ lo, UINT64_MAX);
+}
+
+// fmix64 is the murmur3 64 bit finaliser, used by the bloom filter and HyperLogLog to spread hashed k-mers over the whole word
+// (a hashed k-mer only carries 2k bits of entropy, with the span in its low byte)
+static inline uint64_t fmix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// hashBatchFunc_t sets hashes[i] = hash64(kmers[i], mask) << 8 | span for n k-mers
+typedef void (*hashBatchFunc_t)(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes);
+
+// filterBelowFunc_t writes the indices of the hashes that are below threshold to idx, and returns how many there are
+typedef int (*filterBelowFunc_t)(const uint64_t *hashes, int n, uint64_t threshold, int *idx);
+
+/*
+    function prototypes
+*/
+void hash64BatchScalar(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes);
+int filterBelowScalar(const uint64_t *hashes, int n, uint64_t threshold, int *idx);
+#if defined(__x86_64__) || defined(__i386__)
+void hash64BatchAVX2(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes);
+int filterBelowAVX2(const uint64_t *hashes, int n, uint64_t threshold, int *idx);
+void hash64BatchAVX512(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes);
+int filterBelowAVX512(const uint64_t *hashes, int n, uint64_t threshold, int *idx);
+#endif
+void hash64Batch(const uint64_t *kmers, int n, uint64_t mask, uint64_t span, uint64_t *hashes);
+int filterBelow(const uint64_t *hashes, int n, uint64_t threshold, int *idx);
+
+#endif
@@ -1,8 +1,10 @@
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -11,7 +13,9 @@
 #include "bloom.h"
 #include "config.h"
 #include "daemonize.h"
+#include "refindex.h"
 #include "sequence.h"
+#include "sketch.h"
 #include "slog.h"
 #include "watcher.h"
 
@@ -35,6 +39,9 @@ void printUsage(void)
            "\t --setWatchDir=<path>                 \t set the watch directory (default: %s)\n"
            "\t --setWhiteList=<path/filename>      \t set the white list\n"
            "\t --setLog=<path/filename>            \t set the log file\n"
+           "\t --setThreads=<int|auto>             \t set the number of sketching threads (default: auto)\n"
+           "\t --setCPUs=<list|none>               \t pin the sketching threads to a list of CPUs, e.g. 0-3,8\n"
+           "\t --buildIndex                         \t build the white list reference index and exits\n"
            "\t --start                              \t start the antman daemon\n"
            "\t --stop                               \t stop the antman daemon\n"
            "\t --getPID                             \t prints PID of the antman daemon and exits\n"
@@ -81,9 +88,10 @@ int checkPID(config_t *amConfig)
 /*
     stopAntman stops the daemon
     - issues SIGTERM to antman daemon
-    - updates the config
-
-    TODO: instead of using SIGTERM, use waitpid and then decide to use a SIGKILL before harvesting zombies
+    - waits for the daemon to save its unfinished files and exit, so that a restart can pick them up
+    - updates the config once the daemon has gone
+    - if the daemon is still running after AM_STOP_WAIT_SECS, its PID is kept in the config and an error is returned,
+      so another daemon can't be started over the top of it (it isn't sent a SIGKILL, as it may still be writing its state)
 */
 int stopAntman(config_t *amConfig)
 {
@@ -93,6 +101,19 @@ int stopAntman(config_t *amConfig)
         slog(0, SLOG_LIVE, "\t- registered PID: %d", amConfig->pid);
         return 1;
     }
+
+    // the daemon isn't our child, so poll for it instead of using waitpid
+    struct timespec poll = {0, 100000000};
+    int i;
+    for (i = 0; i < AM_STOP_WAIT_SECS * 10 && kill(amConfig->pid, 0) == 0; i++)
+        nanosleep(&poll, NULL);
+    if (kill(amConfig->pid, 0) == 0)
+    {
+        slog(0, SLOG_ERROR, "the daemon is still shutting down after %ds", AM_STOP_WAIT_SECS);
+        slog(0, SLOG_LIVE, "\t- registered PID: %d", amConfig->pid);
+        slog(0, SLOG_LIVE, "\t- run `antman --stop` again to keep waiting for it");
+        return 1;
+    }
     amConfig->pid = -1;
     if (writeConfig(amConfig, amConfig->filename) != 0)
     {
@@ -128,6 +149,50 @@ int setWatchDir(config_t *amConfig, char *dirName)
     }
 }
 
+/*
+    setThreads sets the number of sketching threads
+    - auto uses one thread per pinned CPU, or one per online CPU
+*/
+int setThreads(config_t *amConfig, char *numThreads)
+{
+    if (strcmp(numThreads, "auto") == 0)
+    {
+        amConfig->num_threads = 0;
+        return 0;
+    }
+    char *end;
+    long n = strtol(numThreads, &end, 10);
+    if (*numThreads == '\0' || *end != '\0' || n < 1 || n > AM_MAX_THREADS)
+    {
+        slog(0, SLOG_ERROR, "number of threads must be auto or between 1 and %d (got %s)", AM_MAX_THREADS, numThreads);
+        return 1;
+    }
+    amConfig->num_threads = (int)n;
+    return 0;
+}
+
+/*
+    setCPUs sets the CPUs to pin the sketching threads to
+    - none removes any pinning
+*/
+int setCPUs(config_t *amConfig, char *cpuList)
+{
+    free(amConfig->cpu_list);
+    amConfig->cpu_list = NULL;
+    if (strcmp(cpuList, "none") == 0)
+        return 0;
+    int *cpus;
+    int n = parseCPUList(cpuList, &cpus);
+    free(cpus);
+    if (n < 0)
+    {
+        slog(0, SLOG_ERROR, "could not read the CPU list (expected something like 0-3,8): %s", cpuList);
+        return 1;
+    }
+    amConfig->cpu_list = strdup(cpuList);
+    return 0;
+}
+
 /*
     setWhiteList sets the white list
     - checks the file exists
@@ -144,6 +209,100 @@ int setWhiteList(config_t *amConfig, char *fileName)
     return 0;
 }
 
+// bloomSizeFor returns the bloom filter size for a reference with refKmers distinct k-mers (leaving room for the HyperLogLog error)
+static int bloomSizeFor(long refKmers)
+{
+    double entries = refKmers * AM_BLOOM_SIZE_HEADROOM;
+    if (entries < AM_BLOOM_MIN_ELEMENTS)
+        return AM_BLOOM_MIN_ELEMENTS;
+    return entries > INT_MAX ? INT_MAX : (int)entries;
+}
+
+// buildWhiteList builds the white list bloom filter and returns the estimated number of distinct k-mers (-1 on error)
+static long buildWhiteList(config_t *amConfig, struct bloom *refBF)
+{
+    int bloomType = amConfig->bloom_blocked ? BLOOM_BLOCKED : BLOOM_STANDARD;
+    if (bloom_init_type(refBF, amConfig->bloom_max_elements, amConfig->bloom_fp_rate, bloomType) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not init bloom filter");
+        return -1;
+    }
+    int *cpus = NULL, numCpus = 0;
+    if (amConfig->cpu_list != NULL && (numCpus = parseCPUList(amConfig->cpu_list, &cpus)) < 0)
+    {
+        slog(0, SLOG_ERROR, "could not read the CPU list: %s", amConfig->cpu_list);
+        bloom_free(refBF);
+        return -1;
+    }
+    long refKmers = processRef(amConfig->white_list, refBF, amConfig->k_size, getNumThreads(amConfig), cpus, numCpus);
+    free(cpus);
+    if (refKmers < 0)
+        bloom_free(refBF);
+    return refKmers;
+}
+
+/*
+    loadWhiteList gets the white list bloom filter
+    - mmaps the reference index if it was built from the current white list and settings
+    - otherwise builds the bloom filter from the white list and saves it as the reference index
+    - the number of distinct white list k-mers is estimated during the build and stored in the config and the index
+    - if bloom_max_elements would overfill (or is well over twice the size of) the filter, it is resized to fit and rebuilt
+    - rebuild forces the bloom filter to be built
+*/
+int loadWhiteList(config_t *amConfig, struct bloom *refBF, int rebuild)
+{
+    if (amConfig->k_size < 1 || amConfig->k_size > SKETCH_MAX_K)
+    {
+        slog(0, SLOG_ERROR, "k_size must be between 1 and %d (got %d)", SKETCH_MAX_K, amConfig->k_size);
+        return 1;
+    }
+    if (!rebuild)
+    {
+        if (loadRefIndex(INDEX_LOCATION, amConfig, refBF) == 0)
+        {
+            slog(0, SLOG_LIVE, "\t- mapped reference index: %s", INDEX_LOCATION);
+            return 0;
+        }
+        slog(0, SLOG_LIVE, "\t- rebuilding reference index");
+    }
+
+    // build the bloom filter from the white list
+    long refKmers = buildWhiteList(amConfig, refBF);
+    if (refKmers < 0)
+        return 1;
+
+    // check the filter was the right size for the white list, and rebuild it if not
+    if (refKmers > amConfig->bloom_max_elements || refKmers * 2 < amConfig->bloom_max_elements)
+    {
+        int entries = bloomSizeFor(refKmers);
+        if (entries != amConfig->bloom_max_elements)
+        {
+            slog(0, SLOG_LIVE, "\t- resizing the bloom filter from %d to %d elements", amConfig->bloom_max_elements, entries);
+            amConfig->bloom_max_elements = entries;
+            bloom_free(refBF);
+            if ((refKmers = buildWhiteList(amConfig, refBF)) < 0)
+                return 1;
+        }
+    }
+    bloom_freeze(refBF);
+
+    // record the k-mer count (and any new size) in the config
+    amConfig->ref_kmers = refKmers > INT_MAX ? INT_MAX : (int)refKmers;
+    if (writeConfig(amConfig, amConfig->filename) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not update the config file");
+        bloom_free(refBF);
+        return 1;
+    }
+
+    // save it for next time (antman can carry on without it)
+    if (writeRefIndex(INDEX_LOCATION, amConfig, refBF) == 0)
+    {
+        slog(0, SLOG_LIVE, "\t- wrote reference index: %s", INDEX_LOCATION);
+    }
+    return 0;
+}
+
 /*
     main is the antman entry point
 */
@@ -158,13 +317,18 @@ int main(int argc, char *argv[])
         {"setWhiteList", ko_optional_argument, 304},
         {"setLog", ko_optional_argument, 305},
         {"getPID", ko_no_argument, 306},
+        {"buildIndex", ko_no_argument, 307},
+        {"setThreads", ko_required_argument, 308},
+        {"setCPUs", ko_required_argument, 309},
         {0, 0, 0}};
 
     // set up the job list
-    int start = 0, stop = 0, getPID = 0;
+    int start = 0, stop = 0, getPID = 0, buildIndex = 0;
     char *watchDir = NULL;
     char *whiteList = NULL;
     char *logFile = NULL;
+    char *numThreads = NULL;
+    char *cpuList = NULL;
 
     // get a default log name
     time_t timer;
@@ -206,6 +370,12 @@ int main(int argc, char *argv[])
             opt.arg ? (logFile = opt.arg) : (logFile = defaultLog);
         else if (c == 306)
             getPID = 1;
+        else if (c == 307)
+            buildIndex = 1;
+        else if (c == 308)
+            numThreads = opt.arg;
+        else if (c == 309)
+            cpuList = opt.arg;
         else if (c == 'u')
             printf("unused flag:  -u %s\n", opt.arg);
         else if (c == '?')
@@ -223,7 +393,7 @@ int main(int argc, char *argv[])
     }
 
     // check we have a job to do, otherwise print the help screen and exit
-    if (start + stop + getPID == 0 && (watchDir == NULL) && (logFile == NULL) && (whiteList == NULL))
+    if (start + stop + getPID + buildIndex == 0 && (watchDir == NULL) && (logFile == NULL) && (whiteList == NULL) && (numThreads == NULL) && (cpuList == NULL))
     {
         fprintf(stderr, "nothing to do: no flags set\n\n");
         printUsage();
@@ -303,6 +473,9 @@ int main(int argc, char *argv[])
     slog(0, SLOG_LIVE, "\t- watch directory: %s", amConfig->watch_directory);
     slog(0, SLOG_LIVE, "\t- white list: %s", amConfig->white_list);
     slog(0, SLOG_LIVE, "\t- current log file: %s", amConfig->current_log_file);
+    slog(0, SLOG_LIVE, "\t- sketching threads: %d%s", getNumThreads(amConfig), amConfig->num_threads == 0 ? " (auto)" : "");
+    if (amConfig->cpu_list != NULL)
+        slog(0, SLOG_LIVE, "\t- pinned to CPUs: %s", amConfig->cpu_list);
     if (daemonPID != -1)
     {
         slog(0, SLOG_LIVE, "\t- daemon running: true");
@@ -338,8 +511,8 @@ int main(int argc, char *argv[])
         slog(0, SLOG_LIVE, "\t- daemon log: %s", amConfig->current_log_file);
     }
 
-    // handle any --setWatchDir, --setWhiteList or --setLog requests
-    if (watchDir != NULL || whiteList != NULL || logFile != NULL)
+    // handle any --setWatchDir, --setWhiteList, --setLog, --setThreads or --setCPUs requests
+    if (watchDir != NULL || whiteList != NULL || logFile != NULL || numThreads != NULL || cpuList != NULL)
     {
 
         // if the daemon is already running, stop it first (if we didn't just stop it with --stop)
@@ -385,6 +558,30 @@ int main(int argc, char *argv[])
             slog(0, SLOG_LIVE, "\t- set to: %s", amConfig->current_log_file);
         }
 
+        // set the number of threads if requested
+        if (numThreads != NULL)
+        {
+            slog(0, SLOG_INFO, "setting sketching threads...");
+            if (setThreads(amConfig, numThreads) != 0)
+            {
+                destroyConfig(amConfig);
+                return 1;
+            }
+            slog(0, SLOG_LIVE, "\t- set to: %d%s", getNumThreads(amConfig), amConfig->num_threads == 0 ? " (auto)" : "");
+        }
+
+        // set the CPU list if requested
+        if (cpuList != NULL)
+        {
+            slog(0, SLOG_INFO, "setting CPU pinning...");
+            if (setCPUs(amConfig, cpuList) != 0)
+            {
+                destroyConfig(amConfig);
+                return 1;
+            }
+            slog(0, SLOG_LIVE, "\t- set to: %s", amConfig->cpu_list ? amConfig->cpu_list : "none");
+        }
+
         // update the config
         if (writeConfig(amConfig, amConfig->filename) != 0)
         {
@@ -401,6 +598,27 @@ int main(int argc, char *argv[])
         }
     }
 
+    // handle any --buildIndex request
+    if (buildIndex == 1)
+    {
+        slog(0, SLOG_INFO, "building reference index...");
+        if (amConfig->white_list == NULL)
+        {
+            slog(0, SLOG_ERROR, "no white list found");
+            slog(0, SLOG_LIVE, "\t- try `antman --setWhiteList=file.fna`");
+            destroyConfig(amConfig);
+            return 1;
+        }
+        struct bloom refBF;
+        if (loadWhiteList(amConfig, &refBF, 1) != 0)
+        {
+            destroyConfig(amConfig);
+            return 1;
+        }
+        bloom_free(&refBF);
+        slog(0, SLOG_LIVE, "\t done");
+    }
+
     // handle any --start request
     if (start == 1)
     {
@@ -435,13 +653,11 @@ int main(int argc, char *argv[])
         // load the white list into a bloom filter
         slog(0, SLOG_INFO, "loading white list into bloom filter...");
         struct bloom refBF;
-        if (bloom_init(&refBF, amConfig->bloom_max_elements, amConfig->bloom_fp_rate) != 0)
+        if (loadWhiteList(amConfig, &refBF, 0) != 0)
         {
-            slog(0, SLOG_ERROR, "could not init bloom filter");
             destroyConfig(amConfig);
             return 1;
         }
-        processRef(amConfig->white_list, &refBF, amConfig->k_size, amConfig->sketch_size);
         slog(0, SLOG_LIVE, "\t done");
         amConfig->bloom_filter = &refBF;
 
@@ -455,9 +671,16 @@ int main(int argc, char *argv[])
             destroyConfig(amConfig);
             return 1;
         }
+        wargs->stats = NULL;
+        wargs->checkpoint = NULL;
+        wargs->job = NULL;
+        wargs->cpus = NULL;
+        wargs->numCpus = 0;
         wargs->bloomFilter = amConfig->bloom_filter;
         wargs->k_size = amConfig->k_size;
         wargs->sketch_size = amConfig->sketch_size;
+        wargs->sketch_scale = amConfig->sketch_scale;
+        wargs->ref_kmers = amConfig->ref_kmers;
         wargs->fp_rate = amConfig->bloom_fp_rate;
 
         // start the daemon
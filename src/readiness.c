@@ -0,0 +1,408 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "hashmap.h"
+#include "readiness.h"
+#include "slog.h"
+
+/*
+    the readiness stage makes sure each FASTQ file is sent to the workerpool once, and only once it has been written
+
+    the watcher notifies it of files in one of two ways:
+        - complete, when the OS says the file was closed after writing or renamed into place (inotify IN_CLOSE_WRITE / IN_MOVED_TO)
+        - pending, when all that is known is that the file has changed (e.g. fswatch Created / Updated events)
+
+    complete files are dispatched straight away, pending files are held until their size and mtime have stayed the
+    same for the quiet period, which is checked by a timer thread
+
+    dispatched files are recorded by a 64 bit hash of their path, so repeated events for a file are ignored
+
+    if the workerpool queue is full, files are held back on a deferred list (in the order they were ready) and the
+    timer thread keeps offering them to the workerpool until there is room, so the watcher is never blocked and only
+    a path is kept for each file that is waiting
+
+    at shutdown the pending and deferred files are put on the daemon's checkpoint, and the next daemon hands them back
+    through readinessResume (files which hadn't been started go through the quiet period again, as they may not have
+    been finished when the state was saved)
+*/
+
+// pendingFile is a file that has changed but isn't known to be written yet
+typedef struct pendingFile
+{
+    char *filepath;
+    off_t size;
+    struct timespec mtime;
+    uint64_t lastChange; // ms on the monotonic clock
+    struct pendingFile *next;
+} pendingFile_t;
+
+// deferredFile is a file that is ready but is waiting for room in the workerpool queue
+typedef struct deferredFile
+{
+    char *filepath;
+    long readsDone; // reads already sketched by an earlier daemon
+    struct deferredFile *next;
+} deferredFile_t;
+
+// readiness
+struct readiness
+{
+    watcherArgs_t *wargs;    // used to dispatch files to the workerpool
+    int quietMs;             // the quiet period for pending files
+    pendingFile_t *pending;  // files waiting to go quiet
+    hashmap_t *dispatched;   // path hashes of the files that have been dispatched (or deferred)
+    int numDispatched;       // number of files dispatched
+    deferredFile_t *deferred;     // files waiting for room in the workerpool queue, oldest first
+    deferredFile_t *deferredLast; // the newest deferred file
+    int numDeferred;              // number of deferred files
+    pthread_mutex_t mutex;   // guards all of the above
+    pthread_cond_t cond;     // wakes the timer thread when stopping
+    pthread_t timer;         // the timer thread
+    bool stop;               // tells the timer thread to exit
+};
+
+// hashPath is FNV-1a over the file path
+static uint64_t hashPath(const char *filepath)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *filepath; filepath++)
+    {
+        h ^= (unsigned char)*filepath;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// nowMs returns the monotonic clock in milliseconds
+static uint64_t nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// removePending unlinks a file from the pending list (the mutex must be held)
+static void removePending(readiness_t *readiness, const char *filepath)
+{
+    pendingFile_t **pp = &readiness->pending;
+    while (*pp != NULL)
+    {
+        if (strcmp((*pp)->filepath, filepath) == 0)
+        {
+            pendingFile_t *pf = *pp;
+            *pp = pf->next;
+            free(pf->filepath);
+            free(pf);
+            return;
+        }
+        pp = &(*pp)->next;
+    }
+}
+
+// deferFile adds a file to the back of the deferred list (the mutex must be held)
+// returns false if it couldn't be allocated
+static bool deferFile(readiness_t *readiness, const char *filepath, long readsDone)
+{
+    deferredFile_t *df = malloc(sizeof(deferredFile_t));
+    if (df == NULL || (df->filepath = strdup(filepath)) == NULL)
+    {
+        slog(0, SLOG_ERROR, "\t- [readiness]:\tcould not allocate a deferred file");
+        free(df);
+        return false;
+    }
+    df->readsDone = readsDone;
+    df->next = NULL;
+    if (readiness->deferred == NULL)
+    {
+        slog(0, SLOG_WARN, "\t- [readiness]:\tworkerpool queue is full, holding back files");
+        readiness->deferred = df;
+    }
+    else
+        readiness->deferredLast->next = df;
+    readiness->deferredLast = df;
+    readiness->numDeferred++;
+    return true;
+}
+
+// flushDeferred sends deferred files to the workerpool, in order, until it is full again (the mutex must be held)
+static void flushDeferred(readiness_t *readiness)
+{
+    while (readiness->deferred != NULL)
+    {
+        deferredFile_t *df = readiness->deferred;
+        int ret = dispatchFastq(readiness->wargs, df->filepath, df->readsDone);
+        if (ret == DISPATCH_FULL)
+            return;
+        if (ret == 0)
+            readiness->numDispatched++;
+        else
+            hmDelete(readiness->dispatched, hashPath(df->filepath));
+        readiness->deferred = df->next;
+        if (readiness->deferred == NULL)
+            readiness->deferredLast = NULL;
+        readiness->numDeferred--;
+        free(df->filepath);
+        free(df);
+    }
+}
+
+// dispatch sends a file to the workerpool if it hasn't already been sent, skipping readsDone reads (the mutex must be held)
+// if the workerpool queue is full, or files are already waiting for it, the file joins the deferred list instead
+static void dispatch(readiness_t *readiness, const char *filepath, uint64_t pathHash, long readsDone)
+{
+    // grow the record of dispatched files before it fills
+    if (2 * (hmCount(readiness->dispatched) + 1) > hmCapacity(readiness->dispatched))
+    {
+        if (hmGrow(readiness->dispatched, 2 * hmCount(readiness->dispatched)) != 0)
+        {
+            slog(0, SLOG_ERROR, "\t- [readiness]:\tcould not grow the dispatched file record");
+            return;
+        }
+    }
+    if (!hmInsert(readiness->dispatched, pathHash))
+        return;
+    int ret = readiness->deferred != NULL ? DISPATCH_FULL : dispatchFastq(readiness->wargs, filepath, readsDone);
+    if (ret == DISPATCH_FULL && deferFile(readiness, filepath, readsDone))
+        return;
+    if (ret != 0)
+    {
+        hmDelete(readiness->dispatched, pathHash);
+        return;
+    }
+    readiness->numDispatched++;
+}
+
+// checkPending dispatches any pending files which have been quiet for long enough (the mutex must be held)
+static void checkPending(readiness_t *readiness)
+{
+    uint64_t now = nowMs();
+    pendingFile_t **pp = &readiness->pending;
+    while (*pp != NULL)
+    {
+        pendingFile_t *pf = *pp;
+        struct stat sb;
+
+        // drop files that have gone away
+        if (stat(pf->filepath, &sb) != 0)
+        {
+            *pp = pf->next;
+            free(pf->filepath);
+            free(pf);
+            continue;
+        }
+
+        // restart the quiet period if the file has changed
+        if (sb.st_size != pf->size || sb.st_mtim.tv_sec != pf->mtime.tv_sec || sb.st_mtim.tv_nsec != pf->mtime.tv_nsec)
+        {
+            pf->size = sb.st_size;
+            pf->mtime = sb.st_mtim;
+            pf->lastChange = now;
+        }
+        else if (sb.st_size > 0 && now - pf->lastChange >= (uint64_t)readiness->quietMs)
+        {
+            slog(0, SLOG_LIVE, "\t- [readiness]:\tfile has stopped changing: %s", pf->filepath);
+            dispatch(readiness, pf->filepath, hashPath(pf->filepath), 0);
+            *pp = pf->next;
+            free(pf->filepath);
+            free(pf);
+            continue;
+        }
+        pp = &pf->next;
+    }
+}
+
+// timerLoop periodically checks the pending files until the readiness stage is destroyed
+static void *timerLoop(void *param)
+{
+    readiness_t *readiness = (readiness_t *)param;
+    int quietPollMs = readiness->quietMs < READINESS_POLL_MS ? readiness->quietMs : READINESS_POLL_MS;
+    if (quietPollMs < 10)
+        quietPollMs = 10;
+    pthread_mutex_lock(&(readiness->mutex));
+    while (!readiness->stop)
+    {
+
+        // check back sooner while there are files waiting on the workerpool
+        int pollMs = readiness->deferred != NULL && READINESS_RETRY_MS < quietPollMs ? READINESS_RETRY_MS : quietPollMs;
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += pollMs / 1000;
+        deadline.tv_nsec += (long)(pollMs % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!readiness->stop && pthread_cond_timedwait(&(readiness->cond), &(readiness->mutex), &deadline) != ETIMEDOUT)
+            ;
+        if (!readiness->stop)
+        {
+            flushDeferred(readiness);
+            checkPending(readiness);
+        }
+    }
+    pthread_mutex_unlock(&(readiness->mutex));
+    return NULL;
+}
+
+// readinessInit creates the readiness stage and starts its timer thread
+readiness_t *readinessInit(watcherArgs_t *wargs, int quietMs)
+{
+    readiness_t *readiness = calloc(1, sizeof(readiness_t));
+    if (readiness == NULL)
+        return NULL;
+    readiness->wargs = wargs;
+    readiness->quietMs = quietMs;
+    readiness->dispatched = hmInit(HASHMAP_MIN_CAPACITY);
+    if (readiness->dispatched == NULL)
+    {
+        free(readiness);
+        return NULL;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(readiness->cond), &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&(readiness->mutex), NULL);
+    if (pthread_create(&(readiness->timer), NULL, timerLoop, readiness))
+    {
+        hmDestroy(readiness->dispatched);
+        pthread_mutex_destroy(&(readiness->mutex));
+        pthread_cond_destroy(&(readiness->cond));
+        free(readiness);
+        return NULL;
+    }
+    return readiness;
+}
+
+// readinessNotify tells the readiness stage that a file has changed
+// if complete is set, the file is known to be written and is dispatched straight away, otherwise it waits for the quiet period
+void readinessNotify(readiness_t *readiness, const char *filepath, bool complete)
+{
+    uint64_t pathHash = hashPath(filepath);
+    pthread_mutex_lock(&(readiness->mutex));
+    if (hmSearch(readiness->dispatched, pathHash))
+    {
+        pthread_mutex_unlock(&(readiness->mutex));
+        return;
+    }
+    if (complete)
+    {
+        struct stat sb;
+        removePending(readiness, filepath);
+        if (stat(filepath, &sb) != 0)
+        {
+            pthread_mutex_unlock(&(readiness->mutex));
+            return;
+        }
+        dispatch(readiness, filepath, pathHash, 0);
+        pthread_mutex_unlock(&(readiness->mutex));
+        return;
+    }
+
+    // add the file to the pending list if it isn't already there (the timer thread takes it from here)
+    pendingFile_t *pf;
+    for (pf = readiness->pending; pf != NULL; pf = pf->next)
+        if (strcmp(pf->filepath, filepath) == 0)
+            break;
+    if (pf == NULL)
+    {
+        pf = calloc(1, sizeof(pendingFile_t));
+        if (pf == NULL || (pf->filepath = strdup(filepath)) == NULL)
+        {
+            slog(0, SLOG_ERROR, "\t- [readiness]:\tcould not allocate a pending file");
+            free(pf);
+            pthread_mutex_unlock(&(readiness->mutex));
+            return;
+        }
+        pf->size = -1;
+        pf->lastChange = nowMs();
+        pf->next = readiness->pending;
+        readiness->pending = pf;
+    }
+    pthread_mutex_unlock(&(readiness->mutex));
+}
+
+// readinessResume hands back a file that an earlier daemon didn't finish, which had readsDone reads sketched
+// files which hadn't been started are treated as pending, the rest are dispatched from where they were stopped
+void readinessResume(readiness_t *readiness, const char *filepath, long readsDone)
+{
+    if (readsDone == 0)
+    {
+        readinessNotify(readiness, filepath, false);
+        return;
+    }
+    uint64_t pathHash = hashPath(filepath);
+    pthread_mutex_lock(&(readiness->mutex));
+    struct stat sb;
+    if (!hmSearch(readiness->dispatched, pathHash) && stat(filepath, &sb) == 0)
+    {
+        slog(0, SLOG_LIVE, "\t- [readiness]:\tresuming %s after %ld reads", filepath, readsDone);
+        dispatch(readiness, filepath, pathHash, readsDone);
+    }
+    pthread_mutex_unlock(&(readiness->mutex));
+}
+
+// readinessCheckpoint puts the pending and deferred files on a checkpoint, so that they can be resumed by the next daemon
+void readinessCheckpoint(readiness_t *readiness, checkpoint_t *checkpoint)
+{
+    pthread_mutex_lock(&(readiness->mutex));
+    pendingFile_t *pf;
+    for (pf = readiness->pending; pf != NULL; pf = pf->next)
+        checkpointAdd(checkpoint, pf->filepath, 0);
+    deferredFile_t *df;
+    for (df = readiness->deferred; df != NULL; df = df->next)
+        checkpointAdd(checkpoint, df->filepath, df->readsDone);
+    pthread_mutex_unlock(&(readiness->mutex));
+}
+
+// readinessDispatched returns the number of files sent to the workerpool
+int readinessDispatched(readiness_t *readiness)
+{
+    pthread_mutex_lock(&(readiness->mutex));
+    int n = readiness->numDispatched;
+    pthread_mutex_unlock(&(readiness->mutex));
+    return n;
+}
+
+// readinessDeferred returns the number of files waiting for room in the workerpool queue
+int readinessDeferred(readiness_t *readiness)
+{
+    pthread_mutex_lock(&(readiness->mutex));
+    int n = readiness->numDeferred;
+    pthread_mutex_unlock(&(readiness->mutex));
+    return n;
+}
+
+// readinessDestroy stops the timer thread and frees the readiness stage (pending and deferred files are not dispatched)
+void readinessDestroy(readiness_t *readiness)
+{
+    if (readiness == NULL)
+        return;
+    pthread_mutex_lock(&(readiness->mutex));
+    readiness->stop = true;
+    pthread_cond_broadcast(&(readiness->cond));
+    pthread_mutex_unlock(&(readiness->mutex));
+    pthread_join(readiness->timer, NULL);
+    while (readiness->pending != NULL)
+        removePending(readiness, readiness->pending->filepath);
+    if (readiness->numDeferred != 0)
+        slog(0, SLOG_WARN, "\t- [readiness]:\t%d files were still waiting for the workerpool", readiness->numDeferred);
+    while (readiness->deferred != NULL)
+    {
+        deferredFile_t *df = readiness->deferred;
+        readiness->deferred = df->next;
+        free(df->filepath);
+        free(df);
+    }
+    hmDestroy(readiness->dispatched);
+    pthread_mutex_destroy(&(readiness->mutex));
+    pthread_cond_destroy(&(readiness->cond));
+    free(readiness);
+}
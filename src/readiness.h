@@ -0,0 +1,32 @@
+// readiness sits between the directory watcher and the workerpool, and only lets through FASTQ files that have been fully written
+#ifndef READINESS_H
+#define READINESS_H
+
+#include <stdbool.h>
+
+#include "watcher.h"
+
+// READINESS_QUIET_MS is how long a file's size and mtime must stay the same before it is considered written
+#define READINESS_QUIET_MS 5000
+
+// READINESS_POLL_MS is how often the pending files are checked
+#define READINESS_POLL_MS 1000
+
+// READINESS_RETRY_MS is how often files held back by a full workerpool queue are offered to it again
+#define READINESS_RETRY_MS 50
+
+//
+typedef struct readiness readiness_t;
+
+/*
+    function prototypes
+*/
+readiness_t *readinessInit(watcherArgs_t *wargs, int quietMs);
+void readinessNotify(readiness_t *readiness, const char *filepath, bool complete);
+void readinessResume(readiness_t *readiness, const char *filepath, long readsDone);
+void readinessCheckpoint(readiness_t *readiness, checkpoint_t *checkpoint);
+int readinessDispatched(readiness_t *readiness);
+int readinessDeferred(readiness_t *readiness);
+void readinessDestroy(readiness_t *readiness);
+
+#endif
@@ -0,0 +1,204 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "refindex.h"
+#include "slog.h"
+
+/*
+    the reference index stores the white list bloom filter on disk, so that the daemon can mmap it instead of rebuilding it
+
+    layout:
+        refIndexHeader_t
+        zero padding up to REFINDEX_DATA_OFFSET
+        the bloom filter bit array (bloomBytes)
+*/
+
+static const char refIndexMagic[8] = {'A', 'M', 'I', 'D', 'X', 0, 0, 0};
+
+// hashPath is FNV-1a over the resolved white list path
+static uint64_t hashPath(const char *filepath)
+{
+    char resolved[PATH_MAX];
+    const char *p = realpath(filepath, resolved) ? resolved : filepath;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *p; p++)
+    {
+        hash ^= (unsigned char)*p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// getRefFingerprint fills in the fingerprint for a white list file (returns 0 on success)
+int getRefFingerprint(const char *filepath, refFingerprint_t *fingerprint)
+{
+    struct stat sb;
+    if (stat(filepath, &sb) != 0)
+        return 1;
+    memset(fingerprint, 0, sizeof(*fingerprint));
+    fingerprint->size = sb.st_size;
+    fingerprint->mtimeSec = sb.st_mtim.tv_sec;
+    fingerprint->mtimeNsec = sb.st_mtim.tv_nsec;
+    fingerprint->inode = sb.st_ino;
+    fingerprint->device = sb.st_dev;
+    fingerprint->pathHash = hashPath(filepath);
+    return 0;
+}
+
+// fillHeader sets up an index header for the current config and bloom filter
+static int fillHeader(refIndexHeader_t *header, config_t *amConfig, struct bloom *bf)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, refIndexMagic, sizeof(refIndexMagic));
+    header->version = REFINDEX_VERSION;
+    header->hashScheme = AM_HASH_SCHEME;
+    header->kSize = amConfig->k_size;
+    header->bloomType = bf->type;
+    header->bloomEntries = bf->entries;
+    header->bloomHashes = bf->hashes;
+    header->bloomError = bf->error;
+    header->bloomBytes = bf->bytes;
+    header->dataOffset = REFINDEX_DATA_OFFSET;
+    header->refKmers = amConfig->ref_kmers;
+    return getRefFingerprint(amConfig->white_list, &header->fingerprint);
+}
+
+// writeAll writes the whole buffer to fd (returns 0 on success)
+static int writeAll(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return 1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+    writeRefIndex saves the white list bloom filter to disk
+    - the index is written to a temporary file and renamed into place
+    - returns 0 on success
+*/
+int writeRefIndex(const char *indexFile, config_t *amConfig, struct bloom *bf)
+{
+    refIndexHeader_t header;
+    if (fillHeader(&header, amConfig, bf) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not fingerprint the white list: %s", amConfig->white_list);
+        return 1;
+    }
+
+    // write the header, the padding and the bit array
+    char tmpFile[PATH_MAX];
+    snprintf(tmpFile, sizeof(tmpFile), "%s.tmp", indexFile);
+    int fd = open(tmpFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        slog(0, SLOG_ERROR, "could not open reference index for writing: %s", tmpFile);
+        return 1;
+    }
+    unsigned char *padding = calloc(1, REFINDEX_DATA_OFFSET - sizeof(header));
+    int ret = (padding == NULL) ||
+              writeAll(fd, &header, sizeof(header)) ||
+              writeAll(fd, padding, REFINDEX_DATA_OFFSET - sizeof(header)) ||
+              writeAll(fd, bf->bf, bf->bytes);
+    free(padding);
+    if (close(fd) != 0 || ret != 0)
+    {
+        slog(0, SLOG_ERROR, "could not write reference index: %s", tmpFile);
+        unlink(tmpFile);
+        return 1;
+    }
+    if (rename(tmpFile, indexFile) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not move reference index into place: %s", indexFile);
+        unlink(tmpFile);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+    loadRefIndex mmaps a saved white list bloom filter
+    - the index is only used if it was built from the current white list with the current settings
+    - the loaded bloom filter is frozen and read-only
+    - the distinct k-mer count stored with the filter is copied to the config
+    - returns 0 on success, 1 if the index is missing, stale or unreadable (and the filter needs building)
+*/
+int loadRefIndex(const char *indexFile, config_t *amConfig, struct bloom *bf)
+{
+    int fd = open(indexFile, O_RDONLY);
+    if (fd < 0)
+        return 1;
+
+    // read and check the header
+    refIndexHeader_t header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, refIndexMagic, sizeof(refIndexMagic)) != 0 ||
+        header.version != REFINDEX_VERSION ||
+        header.hashScheme != AM_HASH_SCHEME ||
+        header.dataOffset != REFINDEX_DATA_OFFSET)
+    {
+        slog(0, SLOG_LIVE, "\t- reference index is from an incompatible version of antman");
+        close(fd);
+        return 1;
+    }
+
+    // check the index matches the settings and the white list
+    int bloomType = amConfig->bloom_blocked ? BLOOM_BLOCKED : BLOOM_STANDARD;
+    refFingerprint_t fingerprint;
+    if (header.kSize != amConfig->k_size ||
+        header.bloomType != bloomType ||
+        header.bloomEntries != amConfig->bloom_max_elements ||
+        header.bloomError != amConfig->bloom_fp_rate)
+    {
+        slog(0, SLOG_LIVE, "\t- reference index was built with different settings");
+        close(fd);
+        return 1;
+    }
+    if (getRefFingerprint(amConfig->white_list, &fingerprint) != 0 ||
+        memcmp(&fingerprint, &header.fingerprint, sizeof(fingerprint)) != 0)
+    {
+        slog(0, SLOG_LIVE, "\t- reference index does not match the current white list");
+        close(fd);
+        return 1;
+    }
+
+    // check the file holds the whole bit array
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (uint64_t)sb.st_size < header.dataOffset + header.bloomBytes)
+    {
+        slog(0, SLOG_LIVE, "\t- reference index is truncated");
+        close(fd);
+        return 1;
+    }
+
+    // map the bit array and wrap it in a frozen bloom filter
+    void *buf = mmap(NULL, header.bloomBytes, PROT_READ, MAP_SHARED, fd, header.dataOffset);
+    close(fd);
+    if (buf == MAP_FAILED)
+    {
+        slog(0, SLOG_ERROR, "could not mmap the reference index: %s", indexFile);
+        return 1;
+    }
+    if (bloom_init_mapped(bf, header.bloomEntries, header.bloomError, header.bloomType, buf, header.bloomBytes) != 0 ||
+        bf->hashes != header.bloomHashes)
+    {
+        slog(0, SLOG_LIVE, "\t- reference index bloom filter parameters are inconsistent");
+        munmap(buf, header.bloomBytes);
+        bf->ready = 0;
+        return 1;
+    }
+    amConfig->ref_kmers = header.refKmers;
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef REFINDEX_H
+#define REFINDEX_H
+
+#include <stdint.h>
+
+#include "bloom.h"
+#include "config.h"
+
+// REFINDEX_VERSION is bumped whenever the on-disk layout changes
+#define REFINDEX_VERSION 2
+
+// AM_HASH_SCHEME identifies how k-mers are hashed and mapped onto the bloom filter
+// bump this whenever the k-mers that are hashed, hash64 or the bloom probe derivation changes, so old indexes are rebuilt
+#define AM_HASH_SCHEME 2
+
+// REFINDEX_DATA_OFFSET is where the bit array starts (a multiple of any common page size, so it can be mmap'd)
+#define REFINDEX_DATA_OFFSET 65536
+
+/*
+    refFingerprint_t identifies a version of the white list file without having to read it
+*/
+typedef struct refFingerprint
+{
+    uint64_t size;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t inode;
+    uint64_t device;
+    uint64_t pathHash;
+} refFingerprint_t;
+
+/*
+    refIndexHeader_t is written at the start of the index file
+*/
+typedef struct refIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t hashScheme;
+    int32_t kSize;
+    int32_t bloomType;
+    int32_t bloomEntries;
+    int32_t bloomHashes;
+    double bloomError;
+    uint64_t bloomBytes;
+    uint64_t dataOffset;
+    uint64_t refKmers;
+    refFingerprint_t fingerprint;
+} refIndexHeader_t;
+
+/*
+    function prototypes
+*/
+int getRefFingerprint(const char *filepath, refFingerprint_t *fingerprint);
+int writeRefIndex(const char *indexFile, config_t *amConfig, struct bloom *bf);
+int loadRefIndex(const char *indexFile, config_t *amConfig, struct bloom *bf);
+
+#endif
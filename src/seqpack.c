@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "seqpack.h"
+
+/*
+    the 2-bit code for a base comes straight from its ASCII value: ((c >> 1) & 3) gives A/C/G/T = 0/1/3/2 (for either case),
+    and xoring in the high bit of that swaps G and T to give A/C/G/T = 0/1/2/3, which matches the seq_nt4_table from minimap2 (U is treated as T)
+
+    anything other than A/C/G/T/U (in either case) is flagged in the N-mask, and its code is meaningless
+*/
+
+// baseCode and baseValid give the packed code and validity of a single byte
+static inline uint64_t baseCode(unsigned char c)
+{
+    uint64_t code = (c >> 1) & 3;
+    return code ^ (code >> 1);
+}
+static inline int baseValid(unsigned char c)
+{
+    c |= 0x20;
+    return c == 'a' || c == 'c' || c == 'g' || c == 't' || c == 'u';
+}
+
+// seqpackScalar packs a sequence one base at a time
+void seqpackScalar(const char *str, int len, uint64_t *packed, uint32_t *nmask)
+{
+    int w, nWords = seqpackWords(len);
+    for (w = 0; w < nWords; w++)
+    {
+        const unsigned char *block = (const unsigned char *)str + w * SEQPACK_BLOCK;
+        int j, end = len - w * SEQPACK_BLOCK < SEQPACK_BLOCK ? len - w * SEQPACK_BLOCK : SEQPACK_BLOCK;
+        uint64_t bits = 0;
+        uint32_t ns = 0;
+        for (j = 0; j < end; j++)
+        {
+            bits |= baseCode(block[j]) << (2 * j);
+            ns |= (uint32_t)!baseValid(block[j]) << j;
+        }
+        packed[w] = bits;
+        nmask[w] = ns;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// seqpackAVX2 packs a sequence 32 bases at a time, finishing any partial block with the scalar code
+__attribute__((target("avx2"))) void seqpackAVX2(const char *str, int len, uint64_t *packed, uint32_t *nmask)
+{
+    const __m256i lower = _mm256_set1_epi8(0x20), three = _mm256_set1_epi8(3), one = _mm256_set1_epi8(1);
+    const __m256i a = _mm256_set1_epi8('a'), c = _mm256_set1_epi8('c'), g = _mm256_set1_epi8('g');
+    const __m256i t = _mm256_set1_epi8('t'), u = _mm256_set1_epi8('u');
+
+    // multipliers to fold 4 codes into a byte: pairs into 16 bit lanes, then pairs of those into 32 bit lanes
+    const __m256i pairs = _mm256_set1_epi16(1 | 4 << 8), quads = _mm256_set1_epi32(1 | 16 << 16);
+
+    // gathers the low byte of each 32 bit lane into the bottom of each 128 bit half
+    const __m256i gather = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    int w, full = len / SEQPACK_BLOCK;
+    for (w = 0; w < full; w++)
+    {
+        __m256i bases = _mm256_loadu_si256((const __m256i *)(str + w * SEQPACK_BLOCK));
+
+        // the N-mask
+        __m256i lc = _mm256_or_si256(bases, lower);
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lc, a), _mm256_cmpeq_epi8(lc, c)),
+                                        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lc, g), _mm256_cmpeq_epi8(lc, t)), _mm256_cmpeq_epi8(lc, u)));
+        nmask[w] = ~(uint32_t)_mm256_movemask_epi8(valid);
+
+        // the codes (there is no 8 bit shift, but the 16 bit shift is fine once the bits that cross bytes are masked off)
+        __m256i code = _mm256_and_si256(_mm256_srli_epi16(bases, 1), three);
+        code = _mm256_xor_si256(code, _mm256_and_si256(_mm256_srli_epi16(code, 1), one));
+
+        // fold the codes together, 4 per byte, and gather the bytes into the packed word
+        __m256i folded = _mm256_madd_epi16(_mm256_maddubs_epi16(code, pairs), quads);
+        folded = _mm256_shuffle_epi8(folded, gather);
+        packed[w] = (uint64_t)(uint32_t)_mm256_extract_epi32(folded, 0) | (uint64_t)(uint32_t)_mm256_extract_epi32(folded, 4) << 32;
+    }
+    if (full * SEQPACK_BLOCK < len)
+        seqpackScalar(str + full * SEQPACK_BLOCK, len - full * SEQPACK_BLOCK, packed + full, nmask + full);
+}
+#endif
+
+// seqpackSelect returns the fastest packing function that the CPU supports
+seqpackFunc_t seqpackSelect(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return seqpackAVX2;
+#endif
+    return seqpackScalar;
+}
+
+// seqpack packs a sequence with the fastest function that the CPU supports (which is picked on the first call)
+static seqpackFunc_t packFunc;
+static pthread_once_t packFuncOnce = PTHREAD_ONCE_INIT;
+static void selectPackFunc(void)
+{
+    packFunc = seqpackSelect();
+}
+void seqpack(const char *str, int len, uint64_t *packed, uint32_t *nmask)
+{
+    pthread_once(&packFuncOnce, selectPackFunc);
+    packFunc(str, len, packed, nmask);
+}
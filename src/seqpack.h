@@ -0,0 +1,27 @@
+// seqpack converts sequences to a packed 2-bit form for the sketcher, using AVX2 when the CPU supports it
+#ifndef SEQPACK_H
+#define SEQPACK_H
+
+#include <stdint.h>
+
+// SEQPACK_BLOCK is the number of bases held in each packed word
+#define SEQPACK_BLOCK 32
+
+// seqpackWords returns how many packed words (and N-mask words) a sequence of len bases needs
+#define seqpackWords(len) (((len) + SEQPACK_BLOCK - 1) / SEQPACK_BLOCK)
+
+// seqpackFunc_t packs len bases from str into packed (2 bits per base, A/C/G/T = 0/1/2/3, base i of each block in bits 2i and 2i+1)
+// and nmask (bit i of each block is set if the base isn't A/C/G/T/U)
+typedef void (*seqpackFunc_t)(const char *str, int len, uint64_t *packed, uint32_t *nmask);
+
+/*
+    function prototypes
+*/
+void seqpackScalar(const char *str, int len, uint64_t *packed, uint32_t *nmask);
+#if defined(__x86_64__) || defined(__i386__)
+void seqpackAVX2(const char *str, int len, uint64_t *packed, uint32_t *nmask);
+#endif
+seqpackFunc_t seqpackSelect(void);
+void seqpack(const char *str, int len, uint64_t *packed, uint32_t *nmask);
+
+#endif
@@ -2,32 +2,189 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 #include "slog.h"
+#include "fastqmap.h"
+#include "gzreader.h"
+#include "hll.h"
 #include "kseq.h"
 #include "sketch.h"
 #include "sequence.h"
 #include "watcher.h"
+#include "workerpool.h"
 
-//TODO: these are to be calculated and stored by antman
-#define REF_LENGTH 18246
+// reference sequences are split into chunks of this many k-mers for the workers
+#define REF_CHUNK_SIZE 1048576
 
-KSEQ_INIT(gzFile, gzread)
-pthread_mutex_t mutex1 = PTHREAD_MUTEX_INITIALIZER;
+// the maximum number of reference chunks that can be queued or processing at once
+#define REF_MAX_CHUNKS_IN_FLIGHT 64
 
-// processRef
-void processRef(char *filepath, struct bloom *bf, int kSize, int sketchSize)
+// FASTQ reads are sent to the workers in batches of up to this many reads
+#define FASTQ_BATCH_READS 256
+
+// a batch is also sent once it holds this many bases
+#define FASTQ_BATCH_BASES 1048576
+
+// the maximum number of read batches per FASTQ file that can be queued or processing at once
+#define FASTQ_MAX_BATCHES_IN_FLIGHT 16
+
+// BGZF FASTQ files are inflated by at least this many threads each (see inflateThreads)
+#define FASTQ_MIN_INFLATE_THREADS 2
+
+// fastqInflating is the number of FASTQ files being read through the gzreader
+static long fastqInflating = 0;
+
+KSEQ_INIT(gzReader_t *, gzrRead)
+
+// each worker thread keeps its own sketcher, which is freed when the thread exits
+static pthread_key_t sketcherKey;
+static pthread_once_t sketcherKeyOnce = PTHREAD_ONCE_INIT;
+
+// destroyThreadSketcher is the destructor for the thread-specific sketcher
+static void destroyThreadSketcher(void *sketcher)
+{
+    destroySketcher((sketcher_t *)sketcher);
+}
+
+// initSketcherKey creates the key used to store the thread-specific sketchers
+static void initSketcherKey(void)
+{
+    pthread_key_create(&sketcherKey, destroyThreadSketcher);
+}
+
+// getThreadSketcher returns the sketcher for the calling thread, creating it on first use
+// a scale above 0 gives a scaled sketcher and sketchSize is ignored
+static sketcher_t *getThreadSketcher(int kSize, int sketchSize, int scale)
+{
+    pthread_once(&sketcherKeyOnce, initSketcherKey);
+    sketcher_t *sketcher = pthread_getspecific(sketcherKey);
+    if (scale > 0)
+        sketchSize = 0;
+    if (sketcher != NULL && sketcher->k_size == kSize && sketcher->sketch_size == sketchSize && sketcher->scale == scale)
+    {
+        return sketcher;
+    }
+    destroySketcher(sketcher);
+    sketcher = (scale > 0) ? initScaledSketcher(kSize, scale) : initSketcher(kSize, sketchSize);
+    if (!sketcher)
+    {
+        slog(0, SLOG_ERROR, "could not allocate a sketcher");
+        exit(1);
+    }
+    pthread_setspecific(sketcherKey, sketcher);
+    return sketcher;
+}
+
+// refChunk_t is a piece of a reference sequence which is added to the bloom filter by a worker
+typedef struct refChunk
 {
-    gzFile fp;
+    struct refIngest *ingest;
+    char *seq;
+    int len;
+} refChunk_t;
+
+// refIngest_t tracks the reference chunks that are queued or being processed
+typedef struct refIngest
+{
+    struct bloom *bf;
+    hll_t *hll;
+    int kSize;
+    int inFlight;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} refIngest_t;
+
+// processRefChunk adds the k-mers from one reference chunk to the bloom filter
+static void processRefChunk(void *args)
+{
+    refChunk_t *chunk = (refChunk_t *)args;
+    refIngest_t *ingest = chunk->ingest;
+    sketcher_t *sketcher = getThreadSketcher(ingest->kSize, 0, 0);
+    sketcher->hll = ingest->hll;
+    sketchSequence(sketcher, chunk->seq, chunk->len, ingest->bf);
+    sketcher->hll = NULL;
+    free(chunk->seq);
+    free(chunk);
+
+    // let the reader know there is room for another chunk
+    pthread_mutex_lock(&ingest->mutex);
+    ingest->inFlight--;
+    pthread_cond_signal(&ingest->cond);
+    pthread_mutex_unlock(&ingest->mutex);
+}
+
+// queueRefChunk copies part of a reference sequence and sends it to the workerpool
+static void queueRefChunk(tpool_t *wp, refIngest_t *ingest, const char *seq, int len)
+{
+    refChunk_t *chunk = malloc(sizeof(refChunk_t));
+    if (!chunk || !(chunk->seq = malloc(len)))
+    {
+        slog(0, SLOG_ERROR, "could not allocate a reference chunk");
+        exit(1);
+    }
+    memcpy(chunk->seq, seq, len);
+    chunk->len = len;
+    chunk->ingest = ingest;
+
+    // wait until there is room, so that the reader can't run too far ahead of the workers
+    pthread_mutex_lock(&ingest->mutex);
+    while (ingest->inFlight >= REF_MAX_CHUNKS_IN_FLIGHT)
+        pthread_cond_wait(&ingest->cond, &ingest->mutex);
+    ingest->inFlight++;
+    pthread_mutex_unlock(&ingest->mutex);
+    if (!tpool_add_work(wp, processRefChunk, chunk))
+    {
+        slog(0, SLOG_ERROR, "could not send a reference chunk to the workerpool");
+        exit(1);
+    }
+}
+
+/*
+    processRef adds the k-mers from every sequence in a reference file to a bloom filter
+    - records are split into chunks (overlapping by k-1) which are processed by a pool of numThreads workers
+    - workers add to the bloom filter using atomic bit sets, so no locking is needed
+    - the distinct k-mers are counted with a HyperLogLog as they go in
+    - if numCpus isn't 0, the workers are pinned to the listed CPUs and the inflate threads are kept on them
+    - returns the estimated number of distinct k-mers in the reference, or -1 on error
+*/
+long processRef(char *filepath, struct bloom *bf, int kSize, int numThreads, const int *cpus, int numCpus)
+{
+    gzReader_t *fp;
     kseq_t *seq;
-    int l;
-    fp = gzopen(filepath, "r");
+    int l, start;
+    refIngest_t ingest;
+    ingest.bf = bf;
+    ingest.kSize = kSize;
+    ingest.inFlight = 0;
+    fp = gzrOpen(filepath, numThreads, cpus, numCpus);
+    if (fp == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not open reference file: %s", filepath);
+        return -1;
+    }
+    ingest.hll = hllInit(HLL_PRECISION);
+    if (ingest.hll == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the reference k-mer counter");
+        gzrClose(fp);
+        return -1;
+    }
+    pthread_mutex_init(&ingest.mutex, NULL);
+    pthread_cond_init(&ingest.cond, NULL);
+    tpool_t *wp = tpool_create_pinned(numThreads, 0, cpus, numCpus);
     seq = kseq_init(fp);
     while ((l = kseq_read(seq)) >= 0)
     {
 
-        // add the reference k-mers to the bloom filter
-        sketchSequence(seq->seq.s, l, kSize, sketchSize, bf, NULL);
+        // send the reference k-mers to the workers, a chunk at a time
+        for (start = 0; start + kSize <= l; start += REF_CHUNK_SIZE)
+        {
+            int len = l - start;
+            if (len > REF_CHUNK_SIZE + kSize - 1)
+                len = REF_CHUNK_SIZE + kSize - 1;
+            queueRefChunk(wp, &ingest, seq->seq.s + start, len);
+        }
 
         slog(0, SLOG_LIVE, "\t- processed sequence");
         slog(0, SLOG_LIVE, "\t\t* sequence: %s", seq->name.s);
@@ -36,81 +193,471 @@ void processRef(char *filepath, struct bloom *bf, int kSize, int sketchSize)
     }
     kseq_destroy(seq);
 
+    // wait for the workers to finish adding to the bloom filter
+    tpool_wait(wp);
+    tpool_destroy(wp);
+    pthread_mutex_destroy(&ingest.mutex);
+    pthread_cond_destroy(&ingest.cond);
+
+    // get the distinct k-mer count
+    long refKmers = (long)llround(hllEstimate(ingest.hll));
+    hllDestroy(ingest.hll);
+    slog(0, SLOG_LIVE, "\t- distinct %d-mers in reference: ~%ld", kSize, refKmers);
+
     // check for EOF
     if (l != -1)
     {
         slog(0, SLOG_ERROR, "EOF error for reference file: %d", l);
+        refKmers = -1;
     }
-    gzclose(fp);
-    return;
+    gzrClose(fp);
+    return refKmers;
 }
 
-// processFastq
-void processFastq(void *args)
+// fastqFile_t is shared by the reader and the read batches of a FASTQ file, and is freed by whichever finishes last
+typedef struct fastqFile
 {
     watcherArgs_t *wargs;
-    wargs = (watcherArgs_t *)args;
-    gzFile fp;
-    kseq_t *seq;
-    int l;
-    fp = gzopen(wargs->filepath, "r");
-    seq = kseq_init(fp);
+    int refs;          // the reader plus each unfinished batch
+    int inFlight;      // batches queued or being processed
+    int numReads;      // reads in the file
+    int numSketched;   // reads which were long enough to sketch
+    fastqMap_t *map;   // the mapped file for uncompressed FASTQ (batches point into it, so it is unmapped last)
+    tpool_future_t *future; // completed once the file is finished (NULL if processFastq wasn't given a future)
+    long skip;         // reads at the start of the file which were sketched by an earlier daemon
+    long readsSent;    // reads from the start of the file which have been skipped or sent in a batch
+    struct readBatch *oldest; // the unfinished batches, oldest first
+    struct readBatch *newest;
+    bool stopped;      // set if the reader stopped before the end of the file
+    bool failed;       // set if the reader gave up on a record it couldn't parse
+    pthread_mutex_t mutex;
+} fastqFile_t;
 
-    // process each sequence in the fastq file
-    while ((l = kseq_read(seq)) >= 0)
+/*
+    inflateThreads returns how many inflate threads a FASTQ file should get, and counts it as being read
+    - the workers are shared out between the files being inflated at the time, so a lone file can use the whole pool
+      but a burst of files doesn't start workers x CPUs threads (each of which holds GZREADER_SLOTS_PER_THREAD blocks)
+    - every file gets at least FASTQ_MIN_INFLATE_THREADS, so that inflating overlaps with parsing
+    - the count is dropped again with doneInflating
+*/
+static int inflateThreads(watcherArgs_t *wargs)
+{
+    long files = __atomic_add_fetch(&fastqInflating, 1, __ATOMIC_RELAXED);
+    long n = (long)tpool_num_threads(wargs->workerPool) / files;
+    return n < FASTQ_MIN_INFLATE_THREADS ? FASTQ_MIN_INFLATE_THREADS : (int)n;
+}
+
+// doneInflating drops a file from the count of files being inflated
+static void doneInflating()
+{
+    __atomic_sub_fetch(&fastqInflating, 1, __ATOMIC_RELAXED);
+}
+
+// readBatch_t is a set of reads which is sketched by a single worker
+// the reads are either copied into the batch buffer, or point straight into the mapped file
+typedef struct readBatch
+{
+    fastqFile_t *file;
+    const char *seqs[FASTQ_BATCH_READS];
+    int lens[FASTQ_BATCH_READS];
+    int numReads;
+    int numBases;
+    char *buffer;      // holds the copied reads (NULL for mapped files)
+    int size;          // bytes allocated for the buffer
+    long start;        // reads in the file before this batch
+    struct readBatch *prev;
+    struct readBatch *next;
+} readBatch_t;
+
+// completeFastq completes the future for a FASTQ file (if it has one), with the read counts as its result
+static void completeFastq(tpool_future_t *future, const char *filepath, tpool_status_t status, int numReads, int numSketched)
+{
+    if (future == NULL)
+        return;
+    fastqResult_t *result = malloc(sizeof(fastqResult_t) + strlen(filepath) + 1);
+    if (result != NULL)
     {
+        result->numReads = numReads;
+        result->numSketched = numSketched;
+        strcpy(result->filepath, filepath);
+    }
+    tpool_future_complete(future, status, result);
+}
 
-        //slog(0, SLOG_INFO, "name: %s\n", seq->name.s);
-        //if (seq->comment.l) printf("comment: %s\n", seq->comment.s);
-        //slog(0, SLOG_INFO, "seq: %s\n;len: %d\n", seq->seq.s, l);
-        //if (seq->qual.l) printf("qual: %s\n", seq->qual.s);
+// releaseFastqFile drops a reference to a FASTQ file and finishes it once nothing is using it
+static void releaseFastqFile(fastqFile_t *file)
+{
+    pthread_mutex_lock(&file->mutex);
+    int refs = --file->refs;
+    pthread_mutex_unlock(&file->mutex);
+    if (refs != 0)
+        return;
+    tpool_status_t status = file->stopped ? TPOOL_CANCELLED : file->failed ? TPOOL_FAILED : TPOOL_DONE;
+    if (status == TPOOL_DONE)
+        slog(0, SLOG_LIVE, "\t- [sketcher]:\tfinished %s (%d reads, %d sketched)", file->wargs->filepath, file->numReads, file->numSketched);
+    pthread_mutex_destroy(&file->mutex);
+    fqmClose(file->map);
 
-        // sketch the read
-        uint64_t *sketch = calloc(wargs->sketch_size, sizeof(uint64_t));
-        if (!sketch)
-        {
-            slog(0, SLOG_ERROR, "could not allocate a sketch");
-            exit(1);
-        }
-        sketchSequence(seq->seq.s, l, wargs->k_size, wargs->sketch_size, NULL, sketch);
-        slog(0, SLOG_LIVE, "\t- [sketcher]:\tsketched a %dbp sequence", l);
-
-        // estimate read containment within the reference
-        // lock the thread whilst using the bloom filter
-        int intersections = 0, i;
-        pthread_mutex_lock(&mutex1);
-        for (i = 0; i < wargs->sketch_size; i++)
+    // the future's callback owns wargs, so it is only freed here if there isn't one
+    if (file->future != NULL)
+        completeFastq(file->future, file->wargs->filepath, status, file->numReads, file->numSketched);
+    else
+        free(file->wargs);
+    free(file);
+}
+
+// queryRead sketches a read and estimates its containment within the reference
+static void queryRead(watcherArgs_t *wargs, sketcher_t *sketcher, const char *seq, int l)
+{
+    int sketchLength = sketchSequence(sketcher, seq, l, NULL);
+    if (sketchLength == 0)
+        return;
+    uint64_t *sketch = sketcher->sketch;
+    slog(0, SLOG_LIVE, "\t- [sketcher]:\tsketched a %dbp sequence", l);
+
+    // estimate read containment within the reference
+    // the bloom filter is frozen before the workers start, so no lock is needed
+    int intersections = 0, i;
+    for (i = 0; i < sketchLength; i++)
+    {
+        if (bloom_check_hash(wargs->bloomFilter, *(sketch + i)))
         {
-            if (bloom_check(wargs->bloomFilter, &*(sketch + i), wargs->k_size))
-            {
-                intersections++;
-            }
+            intersections++;
         }
-        pthread_mutex_unlock(&mutex1);
+    }
+
+    intersections -= (int)floor(wargs->fp_rate * sketchLength);
+    double containmentEstimate = ((double)intersections / sketchLength);
+
+    // a scaled sketch is a uniform sample of the read's k-mers, so the hit fraction is the containment
+    if (wargs->sketch_scale > 0)
+    {
+        slog(0, SLOG_LIVE, "\t- [sketcher]:\tcontainment = %f (%d/%d hashed k-mers)", containmentEstimate, intersections, sketchLength);
+        return;
+    }
+
+    int refTotalKmers = wargs->ref_kmers;
+    int queryTotalKmers = l - wargs->k_size + 1;
+
+    //slog(0, SLOG_INFO, "%d\t%d\t%d\t%f", intersections, refTotalKmers, queryTotalKmers, containmentEstimate);
 
-        intersections -= (int)floor(wargs->fp_rate * wargs->sketch_size);
-        double containmentEstimate = ((double)intersections / wargs->sketch_size);
+    double jaccardEst = ((double)(queryTotalKmers * containmentEstimate)) / ((queryTotalKmers + refTotalKmers) - (queryTotalKmers * containmentEstimate));
 
-        int refTotalKmers = REF_LENGTH - wargs->k_size + 1;
-        int queryTotalKmers = l - wargs->k_size + 1;
+    slog(0, SLOG_LIVE, "\t- [sketcher]:\tjaccardEst by containment = %f", jaccardEst);
+}
+
+// unlinkBatch takes a batch off its file's list of unfinished batches (the file's mutex must be held)
+static void unlinkBatch(fastqFile_t *file, readBatch_t *batch)
+{
+    if (batch->prev != NULL)
+        batch->prev->next = batch->next;
+    else
+        file->oldest = batch->next;
+    if (batch->next != NULL)
+        batch->next->prev = batch->prev;
+    else
+        file->newest = batch->prev;
+}
+
+// processReadBatch sketches and queries each read in a batch
+static void processReadBatch(void *args)
+{
+    readBatch_t *batch = (readBatch_t *)args;
+    fastqFile_t *file = batch->file;
+    sketcher_t *sketcher = getThreadSketcher(file->wargs->k_size, file->wargs->sketch_size, file->wargs->sketch_scale);
+    int i, numSketched = 0;
+    for (i = 0; i < batch->numReads; i++)
+    {
+        if (batch->lens[i] < file->wargs->k_size)
+            continue;
+        queryRead(file->wargs, sketcher, batch->seqs[i], batch->lens[i]);
+        numSketched++;
+    }
+    pthread_mutex_lock(&file->mutex);
+    file->numReads += batch->numReads;
+    file->numSketched += numSketched;
+    file->inFlight--;
+
+    // move the file's checkpoint on to the oldest batch that is still unfinished
+    unlinkBatch(file, batch);
+    if (file->wargs->job != NULL)
+        __atomic_store_n(&file->wargs->job->readsDone, file->oldest ? file->oldest->start : file->readsSent, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&file->mutex);
+    free(batch->buffer);
+    free(batch);
+    releaseFastqFile(file);
+}
+
+// newReadBatch allocates an empty read batch for a FASTQ file, with a buffer of bufferSize bytes for copied reads
+static readBatch_t *newReadBatch(fastqFile_t *file, int bufferSize)
+{
+    readBatch_t *batch = malloc(sizeof(readBatch_t));
+    if (!batch || (bufferSize && !(batch->buffer = malloc(bufferSize))))
+    {
+        slog(0, SLOG_ERROR, "could not allocate a read batch");
+        exit(1);
+    }
+    if (!bufferSize)
+        batch->buffer = NULL;
+    batch->file = file;
+    batch->numReads = 0;
+    batch->numBases = 0;
+    batch->size = bufferSize;
+    return batch;
+}
+
+// batchIsFull returns true once a batch should be sent on
+static inline bool batchIsFull(readBatch_t *batch)
+{
+    return batch->numReads == FASTQ_BATCH_READS || batch->numBases >= FASTQ_BATCH_BASES;
+}
+
+// addToBatch adds a read to the end of a batch, copying it into the buffer if the batch has one
+// returns false if there isn't room left in the buffer
+static bool addToBatch(readBatch_t *batch, const char *seq, int l)
+{
+    if (batch->buffer)
+    {
+        if (batch->numBases + l > batch->size)
+            return false;
+        memcpy(batch->buffer + batch->numBases, seq, l);
+        seq = batch->buffer + batch->numBases;
+    }
+    batch->seqs[batch->numReads] = seq;
+    batch->lens[batch->numReads] = l;
+    batch->numReads++;
+    batch->numBases += l;
+    return true;
+}
+
+// sendBatch passes a full batch to the workerpool
+// if the file already has too many batches in flight, the reader sketches the batch itself instead of waiting, as it may be holding the last free worker
+static void sendBatch(fastqFile_t *file, readBatch_t *batch)
+{
+    pthread_mutex_lock(&file->mutex);
+    bool queue = file->inFlight < FASTQ_MAX_BATCHES_IN_FLIGHT;
+    file->inFlight++;
+    file->refs++;
+    batch->start = file->readsSent;
+    file->readsSent += batch->numReads;
+    batch->prev = file->newest;
+    batch->next = NULL;
+    if (file->newest != NULL)
+        file->newest->next = batch;
+    else
+        file->oldest = batch;
+    file->newest = batch;
+    pthread_mutex_unlock(&file->mutex);
+    if (!queue || !tpool_add_work(file->wargs->workerPool, processReadBatch, batch))
+        processReadBatch(batch);
+}
 
-        //slog(0, SLOG_INFO, "%d\t%d\t%d\t%f", intersections, refTotalKmers, queryTotalKmers, containmentEstimate);
+// readerStopping returns true (and marks the file as stopped) once the daemon has asked the readers to stop
+static bool readerStopping(fastqFile_t *file)
+{
+    if (!checkpointStopping(file->wargs->checkpoint))
+        return false;
+    file->stopped = true;
+    return true;
+}
 
-        double jaccardEst = ((double)(queryTotalKmers * containmentEstimate)) / ((queryTotalKmers + refTotalKmers) - (queryTotalKmers * containmentEstimate));
+// readMapped batches up the reads from a mapped FASTQ file, without copying them
+// returns the last value from fqmNext (-1 at the end of the file)
+static int readMapped(fastqFile_t *file)
+{
+    fastqRecord_t record;
+    int l;
+    readBatch_t *batch = newReadBatch(file, 0);
+    while ((l = fqmNext(file->map, &record)) >= 0)
+    {
+        if (file->skip > 0)
+        {
+            file->skip--;
+            continue;
+        }
+        addToBatch(batch, record.seq, l);
+        if (batchIsFull(batch))
+        {
+            sendBatch(file, batch);
+            batch = newReadBatch(file, 0);
+            if (readerStopping(file))
+                break;
+        }
+    }
+    if (batch->numReads != 0)
+        sendBatch(file, batch);
+    else
+        free(batch);
+    return l;
+}
 
-        slog(0, SLOG_LIVE, "\t- [sketcher]:\tjaccardEst by containment = %f", jaccardEst);
+// readStream batches up the reads from a (possibly gzipped) FASTQ file through kseq, copying each one into the batch
+// returns the last value from kseq_read (-1 at the end of the file)
+static int readStream(fastqFile_t *file, gzReader_t *fp)
+{
+    kseq_t *seq = kseq_init(fp);
+    int l;
+    readBatch_t *batch = newReadBatch(file, FASTQ_BATCH_BASES);
+    while ((l = kseq_read(seq)) >= 0)
+    {
+        if (file->skip > 0)
+        {
+            file->skip--;
+            continue;
+        }
 
-        free(sketch);
+        // reads which don't fit are sent in the next batch, which is made big enough for them
+        // (if the batch is still empty, its buffer is swapped for a big enough one instead of sending nothing)
+        if (!addToBatch(batch, seq->seq.s, l))
+        {
+            int size = l > FASTQ_BATCH_BASES ? l : FASTQ_BATCH_BASES;
+            if (batch->numReads != 0)
+            {
+                sendBatch(file, batch);
+                batch = newReadBatch(file, size);
+            }
+            else
+            {
+                free(batch->buffer);
+                if (!(batch->buffer = malloc(size)))
+                {
+                    slog(0, SLOG_ERROR, "could not allocate a read batch");
+                    exit(1);
+                }
+                batch->size = size;
+            }
+            addToBatch(batch, seq->seq.s, l);
+        }
+        if (batchIsFull(batch))
+        {
+            sendBatch(file, batch);
+            batch = newReadBatch(file, FASTQ_BATCH_BASES);
+            if (readerStopping(file))
+                break;
+        }
     }
     kseq_destroy(seq);
+    if (batch->numReads != 0)
+    {
+        sendBatch(file, batch);
+    }
+    else
+    {
+        free(batch->buffer);
+        free(batch);
+    }
+    return l;
+}
+
+/*
+    dropFastqWork is the workerpool's drop hook, which releases the read batches that tpool_destroy drops
+    - the batch is freed and its file is released, as if it had been sketched, but the file is marked as stopped
+      so that its future is cancelled and it stays on the checkpoint
+    - the file's checkpoint isn't moved on, so it still points at (or before) the dropped batch and the reads are
+      sketched again by the next daemon
+    - any other job is left alone (processFastq's future is cancelled by the workerpool)
+*/
+void dropFastqWork(thread_func_t func, void *arg)
+{
+    if (func != processReadBatch)
+        return;
+    readBatch_t *batch = (readBatch_t *)arg;
+    fastqFile_t *file = batch->file;
+    pthread_mutex_lock(&file->mutex);
+    file->stopped = true;
+    file->inFlight--;
+    unlinkBatch(file, batch);
+    pthread_mutex_unlock(&file->mutex);
+    free(batch->buffer);
+    free(batch);
+    releaseFastqFile(file);
+}
+
+/*
+    processFastq is the reader for a FASTQ file
+    - uncompressed files are mapped and the reads are passed to the workers in place, anything else goes through the gzreader and kseq
+    - the mapped parser only takes four line records, so if it hits anything else (e.g. wrapped FASTQ) the rest of the file
+      is read through kseq, skipping the reads that were already sent
+    - reads are grouped into batches of up to FASTQ_BATCH_READS reads (or FASTQ_BATCH_BASES bases)
+    - the batches are sketched and queried by the workerpool, so a single file can use every worker
+    - the file is finished when the reader and all of its batches are done
+    - if it was added with tpool_add_task, its future is completed with a fastqResult_t once the file is finished,
+      and the future's callback is left to free wargs (otherwise it is freed here)
+    - reads already sketched by an earlier daemon (wargs->job->readsDone) are skipped
+    - if the daemon is shutting down, the reader stops at the next batch and the future is cancelled, with
+      wargs->job->readsDone left at the end of the last run of finished batches
+    - if the reader ends on a record that can't be parsed, the future is failed
+*/
+void processFastq(void *args)
+{
+    watcherArgs_t *wargs;
+    wargs = (watcherArgs_t *)args;
+    gzReader_t *fp = NULL;
+    int l;
+    tpool_future_t *future = tpool_defer();
+    if (checkpointStopping(wargs->checkpoint))
+    {
+        completeFastq(future, wargs->filepath, TPOOL_CANCELLED, 0, 0);
+        if (future == NULL)
+            free(wargs);
+        return;
+    }
+    fastqMap_t *map = fqmOpen(wargs->filepath);
+    if (map == NULL && (fp = gzrOpen(wargs->filepath, inflateThreads(wargs), wargs->cpus, wargs->numCpus)) == NULL)
+    {
+        doneInflating();
+        slog(0, SLOG_ERROR, "could not open FASTQ file: %s", wargs->filepath);
+        completeFastq(future, wargs->filepath, TPOOL_FAILED, 0, 0);
+        if (future == NULL)
+            free(wargs);
+        return;
+    }
+    fastqFile_t *file = malloc(sizeof(fastqFile_t));
+    if (!file)
+    {
+        slog(0, SLOG_ERROR, "could not allocate a FASTQ file");
+        exit(1);
+    }
+    file->wargs = wargs;
+    file->refs = 1;
+    file->inFlight = 0;
+    file->numReads = 0;
+    file->numSketched = 0;
+    file->map = map;
+    file->future = future;
+    file->skip = (wargs->job != NULL) ? wargs->job->readsDone : 0;
+    file->readsSent = file->skip;
+    file->oldest = NULL;
+    file->newest = NULL;
+    file->stopped = false;
+    file->failed = false;
+    pthread_mutex_init(&file->mutex, NULL);
+
+    // batch up each sequence in the fastq file
+    if (map)
+    {
+        l = readMapped(file);
+        if (l == -2 && !file->stopped && (fp = gzrOpen(wargs->filepath, 1, wargs->cpus, wargs->numCpus)) != NULL)
+        {
+            slog(0, SLOG_LIVE, "\t- [sketcher]:\t%s isn't four line FASTQ, reading the rest through kseq", wargs->filepath);
+            file->skip = file->readsSent;
+            l = readStream(file, fp);
+            gzrClose(fp);
+        }
+    }
+    else
+    {
+        l = readStream(file, fp);
+        gzrClose(fp);
+        doneInflating();
+    }
 
     // check for EOF
-    if (l != -1)
+    if (l != -1 && !file->stopped)
     {
         slog(0, SLOG_ERROR, "EOF error for FASTQ file: %d\n", l);
+        file->failed = true;
     }
-
-    gzclose(fp);
-    free(wargs);
+    releaseFastqFile(file);
     return;
 }
@@ -2,11 +2,21 @@
 #define SEQUENCE_H
 
 #include "bloom.h"
+#include "workerpool.h"
+
+// fastqResult_t is the result that processFastq leaves in its future
+typedef struct fastqResult
+{
+    int numReads;    // reads in the file
+    int numSketched; // reads which were long enough to sketch
+    char filepath[]; // the file
+} fastqResult_t;
 
 /*
     function prototypes
 */
-void processRef(char* filepath, struct bloom* bf, int kSize, int sketchSize);
+long processRef(char* filepath, struct bloom* bf, int kSize, int numThreads, const int* cpus, int numCpus);
 void processFastq(void* arg);
+void dropFastqWork(thread_func_t func, void* arg);
 
 #endif
\ No newline at end of file
@@ -5,144 +5,355 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include "arena.h"
 #include "bloom.h"
 #include "hashmap.h"
 #include "heap.h"
+#include "hll.h"
+#include "kmerhash.h"
+#include "seqpack.h"
+#include "sketch.h"
 #include "slog.h"
 
-unsigned char seq_nt4_table[256] = {
-	0, 1, 2, 3,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 0, 4, 1,  4, 4, 4, 2,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  3, 3, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 0, 4, 1,  4, 4, 4, 2,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  3, 3, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
-	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4
-};
-
-static inline uint64_t hash64(uint64_t key, uint64_t mask)
-{
-	key = (~key + (key << 21)) & mask; // key = (key << 21) - key - 1;
-	key = key ^ key >> 24;
-	key = ((key + (key << 3)) + (key << 8)) & mask; // key * 265
-	key = key ^ key >> 14;
-	key = ((key + (key << 2)) + (key << 4)) & mask; // key * 21
-	key = key ^ key >> 28;
-	key = (key + (key << 31)) & mask;
-	return key;
+static kmerLoopFunc_t selectKmerLoop(int k);
+
+/*
+	initSketcher allocates a sketcher and its scratch space
+	arguments:
+		kSize - k-mer size
+		sketchSize - number of minimums to keep (0 == bloom filter only)
+*/
+sketcher_t* initSketcher(int kSize, int sketchSize) {
+	assert(kSize > 0 && kSize <= SKETCH_MAX_K);
+	assert(sketchSize >= 0);
+
+	sketcher_t* sketcher = calloc(1, sizeof(sketcher_t));
+	if (sketcher == NULL) return NULL;
+	sketcher->k_size = kSize;
+	sketcher->sketch_size = sketchSize;
+	sketcher->kmer_loop = selectKmerLoop(kSize);
+	sketcher->arena = arenaInit(ARENA_BLOCK_SIZE, ARENA_MAX_RETAIN);
+	if (sketcher->arena == NULL) {
+		destroySketcher(sketcher);
+		return NULL;
+	}
+	if (sketchSize == 0) return sketcher;
+
+	// the sketch array, the tracker and the heap are reused for every sequence
+	sketcher->sketch = calloc(sketchSize, sizeof(uint64_t));
+	sketcher->sketch_capacity = sketchSize;
+	sketcher->tracker = hmInit(sketchSize);
+	sketcher->kmvSketch = initHeap(sketchSize);
+	if (sketcher->sketch == NULL || sketcher->tracker == NULL || sketcher->kmvSketch == NULL) {
+		destroySketcher(sketcher);
+		return NULL;
+	}
+	return sketcher;
 }
 
 /*
-	sketchSequence runs k-mer decomposition on a sequence
-	k-mers are hashed and can then be added to a bloom filter or kmv sketch
+	initScaledSketcher allocates a sketcher for scaled (FracMinHash) sketches
+	the sketch keeps every distinct hashed k-mer below max_hash/scale, so it grows with the sequence
+	and the fraction of it found in a reference is an unbiased estimate of containment
 	arguments:
-		str - the sequence
-		len - the sequence length
-		k - k-mer size
-		sketchSize - sketchSize
-		bf - pointer to a bloom filter
-		sketchPtr - pointer to a sketch (which has been initalised to == sketchSize)
+		kSize - k-mer size
+		scale - keep 1/scale of the hash space
 */
-void sketchSequence(const char* str, int len, int k, int sketchSize, struct bloom* bf, uint64_t* sketchPtr) {
+sketcher_t* initScaledSketcher(int kSize, int scale) {
+	assert(kSize > 0 && kSize <= SKETCH_MAX_K);
+	assert(scale > 0);
 
-	// TODO: sketchSize must be < HASHMAP_SIZE,
-	// either need checks to make sure this is correct
-	// or reimplement to have dynamic allocation for HASHMAP
-	assert(sketchSize < HASHMAP_SIZE);
+	sketcher_t* sketcher = calloc(1, sizeof(sketcher_t));
+	if (sketcher == NULL) return NULL;
+	sketcher->k_size = kSize;
+	sketcher->scale = scale;
+	sketcher->kmer_loop = selectKmerLoop(kSize);
+	sketcher->arena = arenaInit(ARENA_BLOCK_SIZE, ARENA_MAX_RETAIN);
+	if (sketcher->arena == NULL) {
+		free(sketcher);
+		return NULL;
+	}
 
-    // check k-mer size and seq length
-	assert(len > 0 && (k > 0 && k <= 31) && k <= len);
+	// hashed k-mers are hash64(kmer) << 8 | k, so they span 2k+8 bits (the whole word once k >= 28)
+	uint64_t maxHash = 2 * kSize + 8 >= 64 ? UINT64_MAX : (1ULL << (2 * kSize + 8)) - 1;
+	sketcher->threshold = maxHash / scale;
+	return sketcher;
+}
 
-    // declare the variables
-	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kmer[2] = {0,0}, hashedKmer = 0;
-	int i , l, kmer_span = 0;
+// destroySketcher frees a sketcher and everything it owns
+void destroySketcher(sketcher_t* sketcher) {
+	if (sketcher == NULL) return;
+	destroy(sketcher->kmvSketch);
+	hmDestroy(sketcher->tracker);
+	if (sketcher->scale == 0) free(sketcher->sketch);
+	arenaDestroy(sketcher->arena);
+	free(sketcher);
+}
 
-    // set up the heap for the sketch
-    node_t* kmvSketch;
-	int currentHeapSize = 0;
+// scratchAlloc gets per-sequence scratch space from the sketcher's arena
+static void* scratchAlloc(sketcher_t* sketcher, size_t size) {
+	void* ptr = arenaAlloc(sketcher->arena, size);
+	if (ptr == NULL) {
+		slog(0, SLOG_ERROR, "could not allocate sketcher scratch space");
+		exit(1);
+	}
+	return ptr;
+}
 
-    // iterate over the sequence
-	for (i = l = 0; i < len; i++) {
+// startScratch resets the arena and takes the packed sequence scratch space for a sequence of len bases
+static void startScratch(sketcher_t* sketcher, int len) {
+	arenaReset(sketcher->arena);
+	sketcher->packed = scratchAlloc(sketcher, seqpackWords(len) * sizeof(uint64_t));
+	sketcher->nmask = scratchAlloc(sketcher, seqpackWords(len) * sizeof(uint32_t));
+	if (sketcher->scale > 0) {
+		sketcher->sketch = NULL;
+		sketcher->sketch_capacity = 0;
+	}
+}
 
-        // lookup base
-		int c = seq_nt4_table[(uint8_t)str[i]];
+// growSketch makes sure a scaled sketch can hold n more hashed k-mers
+// the old sketch is left in the arena until the next reset, which with doubling is at most the same again
+static void growSketch(sketcher_t* sketcher, int n) {
+	if (sketcher->sketch_length + n <= sketcher->sketch_capacity) return;
+	int capacity = sketcher->sketch_capacity ? sketcher->sketch_capacity : KMERHASH_BATCH;
+	while (capacity < sketcher->sketch_length + n) capacity *= 2;
+	uint64_t* sketch = scratchAlloc(sketcher, capacity * sizeof(uint64_t));
+	if (sketcher->sketch_length) memcpy(sketch, sketcher->sketch, sketcher->sketch_length * sizeof(uint64_t));
+	sketcher->sketch = sketch;
+	sketcher->sketch_capacity = capacity;
+}
 
-        // only accept a/c/t/g
-		if (c < 4) {
-			int z;
-            kmer_span = l + 1 < k? l + 1 : k;
+// cmpHash orders hashed k-mers for qsort
+static int cmpHash(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
 
-            // get the forward and reverse k-mers
-			kmer[0] = (kmer[0] << 2 | c) & mask;
-			kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1;
+// finishScaledSketch sorts the collected hashed k-mers, drops the duplicates and returns how many are left
+static int finishScaledSketch(sketcher_t* sketcher) {
+	uint64_t* sketch = sketcher->sketch;
+	int n = sketcher->sketch_length, i, m = 0;
+	sketcher->sketch_length = 0;
+	if (n == 0) return 0;
+	qsort(sketch, n, sizeof(uint64_t), cmpHash);
+	for (i = 1; i < n; i++) {
+		sketch[++m] = sketch[i];
+		m -= sketch[m] == sketch[m - 1];
+	}
+	return m + 1;
+}
 
-            // skip symmetrical k-mers
-			if (kmer[0] == kmer[1]) continue;
-			z = kmer[0] < kmer[1]? 0 : 1; // strand
-			l++;
+// addHashes adds a batch of hashed k-mers to the bloom filter and/or KMV sketch
+static void addHashes(sketcher_t* sketcher, const uint64_t* hashes, int n, struct bloom* bf) {
+	int idx[KMERHASH_BATCH], i, j;
+	hashmap_t* tracker = sketcher->tracker;
+	heap_t* kmvSketch = sketcher->kmvSketch;
 
-            // hash the canonical k-mer
-			if (l >= k && kmer_span < 256) {
-				hashedKmer = hash64(kmer[z], mask) << 8 | kmer_span;
-			}
-		} else l = 0, kmer_span = 0;
-        if (i < k) continue;
+	// add the hashed k-mers to the bloom filter if required
+	if (bf != NULL) {
+		for (i = 0; i < n; i++) bloom_add_hash(bf, hashes[i]);
+	}
 
-		// add the hashed k-mer to the bloom filter if required
-		if (bf != NULL) {
-			bloom_add(bf, &hashedKmer, k);
+	// count them if required
+	if (sketcher->hll != NULL) {
+		for (i = 0; i < n; i++) hllAdd(sketcher->hll, hashes[i]);
+	}
+
+	// scaled sketches keep everything under the threshold
+	// every hashed k-mer is written and the length only advances for the keepers, so there's no branch to mispredict
+	if (sketcher->scale > 0) {
+		growSketch(sketcher, n);
+		uint64_t* sketch = sketcher->sketch + sketcher->sketch_length, threshold = sketcher->threshold;
+		int m = 0;
+		for (i = 0; i < n; i++) {
+			sketch[m] = hashes[i];
+			m += hashes[i] < threshold;
 		}
+		sketcher->sketch_length += m;
+		return;
+	}
+
+	// bloom-only sketchers don't keep a KMV sketch
+	if (sketcher->sketch_size == 0) return;
+
+	// fill the sketch one at a time until it is at capacity
+	for (i = 0; i < n && !isFull(kmvSketch); i++) {
+
+		// check if the hashed k-mer is already in the sketch
+		if (hmSearch(tracker, hashes[i])) continue;
+
+		// add the hashed k-mer to the sketch and the tracker
+		push(kmvSketch, hashes[i]);
+		hmInsert(tracker, hashes[i]);
+	}
+	if (i == n) return;
+
+	// then only look at the hashed k-mers that are below the current max, which is most of the time none of them
+	int m = filterBelow(hashes + i, n - i, peek(kmvSketch), idx);
+	for (j = 0; j < m; j++) {
+		uint64_t hashedKmer = hashes[i + idx[j]];
+
+		// the max may have dropped since the filter, and the hashed k-mer may already be in the current sketch
+		if (peek(kmvSketch) <= hashedKmer || hmSearch(tracker, hashedKmer)) continue;
+
+		// otherwise, replace the current max in the sketch with the new hashed k-mer
+		hmDelete(tracker, peek(kmvSketch));
+		replaceTop(kmvSketch, hashedKmer);
+		hmInsert(tracker, hashedKmer);
+	}
+}
 
-		// now we have a hashed k-mer, first check if the sketch isn't at capacity yet
-		if (currentHeapSize < sketchSize) {
-
-			// check if the hashed k-mer is already in the sketch
-			if (hmSearch(hashedKmer)) continue;
-			
-			// add the hashed k-mer to the sketch and the tracker
-			if (currentHeapSize == 0) {
-				  kmvSketch = initHeap(hashedKmer); // special case for first minimum in sketch, which is needed to init the heap
-			} else {
-				push(&kmvSketch, hashedKmer);
+// addKmers hashes a batch of canonical k-mers and adds them
+static void addKmers(sketcher_t* sketcher, const uint64_t* kmers, int n, uint64_t mask, struct bloom* bf) {
+	uint64_t hashes[KMERHASH_BATCH];
+	hash64Batch(kmers, n, mask, sketcher->k_size, hashes);
+	addHashes(sketcher, hashes, n, bf);
+}
+
+/*
+	sketchLongKmers is the k-mer loop for k > 31, which keeps the forward and reverse k-mers in 128 bits
+	the canonical k-mers are reduced to 64 bits with hash128 and then treated like any other hashed k-mer
+*/
+static void sketchLongKmers(sketcher_t* sketcher, int len, struct bloom* bf) {
+	int k = sketcher->k_size;
+	unsigned __int128 shift1 = 2 * (k - 1), mask = ((unsigned __int128)1 << 2 * k) - 1, fwd = 0, rev = 0;
+	uint64_t hashes[KMERHASH_BATCH];
+	int w, j, l = 0, n = 0;
+	for (w = 0; w < seqpackWords(len); w++) {
+		uint64_t bases = sketcher->packed[w];
+		uint32_t ns = sketcher->nmask[w];
+		int end = len - w * SEQPACK_BLOCK < SEQPACK_BLOCK ? len - w * SEQPACK_BLOCK : SEQPACK_BLOCK;
+		for (j = 0; j < end; j++, bases >>= 2) {
+			if (ns >> j & 1) {
+				l = 0;
+				continue;
+			}
+			// roll the k-mers as in sketchKmers, just in 128 bits
+			unsigned __int128 c = bases & 3;
+			fwd = (fwd << 2 | c) & mask;
+			rev = (rev >> 2) | (3^c) << shift1;
+			if (++l < k || fwd == rev) continue;
+
+			// there's no batched hash for 128-bit k-mers, so the hashing is done here
+			unsigned __int128 canon = fwd < rev? fwd : rev;
+			hashes[n++] = hash128((uint64_t)canon, (uint64_t)(canon >> 64)) << 8 | k;
+			if (n == KMERHASH_BATCH) {
+				addHashes(sketcher, hashes, n, bf);
+				n = 0;
 			}
-			assert(hmInsert(hashedKmer) == true);
-			currentHeapSize++;
-			continue;
 		}
+	}
+	addHashes(sketcher, hashes, n, bf);
+}
 
-		// continue if the current max is smaller than the new hashed k-mer
-		if (peek(&kmvSketch) <= hashedKmer) continue;
+/*
+	kmerLoop is the k-mer loop for k <= 31, which rolls the forward and reverse k-mers over the packed sequence
+	the canonical k-mers are collected and then hashed and filtered in batches (see kmerhash.c)
+	it is always inlined, so that the kernels below which pass a constant k get their shifts and masks folded
+*/
+static inline __attribute__((always_inline)) void kmerLoop(sketcher_t* sketcher, int len, struct bloom* bf, const int k) {
 
-		// continue if the hashed k-mer is already in the current sketch
-		if (hmSearch(hashedKmer)) continue;
+	// declare the variables
+	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, fwd = 0, rev = 0, kmers[KMERHASH_BATCH];
+	int w, j, l = 0, n = 0;
 
-		// otherwise, the final option is to pop the current max from the sketch and add in the new hashed k-mer
-		hmDelete(peek(&kmvSketch));
-		pop(&kmvSketch);
-		push(&kmvSketch, hashedKmer);
-		hmInsert(hashedKmer);
+	// iterate over the packed sequence, a block at a time
+	for (w = 0; w < seqpackWords(len); w++) {
+		uint64_t bases = sketcher->packed[w];
+		uint32_t ns = sketcher->nmask[w];
+		int end = len - w * SEQPACK_BLOCK < SEQPACK_BLOCK ? len - w * SEQPACK_BLOCK : SEQPACK_BLOCK;
+		for (j = 0; j < end; j++, bases >>= 2) {
+
+			// an N (or anything else that isn't a/c/t/g) breaks the k-mer
+			if (ns >> j & 1) {
+				l = 0;
+				continue;
+			}
+
+			// get the forward and reverse k-mers
+			uint64_t c = bases & 3;
+			fwd = (fwd << 2 | c) & mask;
+			rev = (rev >> 2) | (3ULL^c) << shift1;
+
+			// wait for a full k-mer, and skip symmetrical k-mers
+			if (++l < k || fwd == rev) continue;
+
+			// collect the canonical k-mer, and hash the batch once it is full
+			kmers[n++] = fwd < rev? fwd : rev;
+			if (n == KMERHASH_BATCH) {
+				addKmers(sketcher, kmers, n, mask, bf);
+				n = 0;
+			}
+		}
 	}
+	addKmers(sketcher, kmers, n, mask, bf);
+}
 
-	// the sequence has now been sketched, so collect the minimums from the heap
-	if (sketchPtr != NULL) {
-		
-		// sanity check
-		assert(isEmpty(&kmvSketch) == false);
+// sketchKmers is the generic k-mer loop for k <= 31
+static void sketchKmers(sketcher_t* sketcher, int len, struct bloom* bf) {
+	kmerLoop(sketcher, len, bf, sketcher->k_size);
+}
 
-		// add the minimums from the kmvSketch heap to the provided sketch array
-		getSketch(&kmvSketch, sketchSize, sketchPtr);
+// SKETCH_KERNEL defines sketchKmers<K>, a copy of the k-mer loop specialised for one k
+#define SKETCH_KERNEL(K) \
+	static void sketchKmers##K(sketcher_t* sketcher, int len, struct bloom* bf) { \
+		kmerLoop(sketcher, len, bf, K); \
 	}
 
-	// free the kmvSketch heap and the hashmap
-	destroy(&kmvSketch);
-	hmDestroy();
-}
\ No newline at end of file
+// the specialised kernels, for the k-mer sizes that are used the most
+SKETCH_KERNEL(7)
+SKETCH_KERNEL(15)
+SKETCH_KERNEL(21)
+SKETCH_KERNEL(31)
+
+// selectKmerLoop returns the k-mer loop for a k-mer size
+static kmerLoopFunc_t selectKmerLoop(int k) {
+	switch (k) {
+		case 7: return sketchKmers7;
+		case 15: return sketchKmers15;
+		case 21: return sketchKmers21;
+		case 31: return sketchKmers31;
+		default: return k <= 31 ? sketchKmers : sketchLongKmers;
+	}
+}
+
+/*
+	sketchSequence runs k-mer decomposition on a sequence
+	every window of k A/C/G/T bases gives a k-mer (symmetrical k-mers are skipped), which is hashed
+	and can then be added to a bloom filter, a HyperLogLog (sketcher->hll) or kmv sketch
+	the sequence is packed to 2 bits per base first, so the rolling loop never looks at the raw bases,
+	then the k-mers are rolled by the sketcher's k-mer loop (see selectKmerLoop)
+	the sketcher is not thread safe, so each thread should use its own
+	per-sequence scratch comes from the sketcher's arena, so a scaled sketch is only valid until the next call
+	arguments:
+		sketcher - the sketcher to use (which also receives the sketch)
+		str - the sequence
+		len - the sequence length
+		bf - pointer to a bloom filter (or NULL)
+	returns:
+		the number of minimums written to sketcher->sketch (for a scaled sketcher, the sorted distinct hashed k-mers below the threshold)
+*/
+int sketchSequence(sketcher_t* sketcher, const char* str, int len, struct bloom* bf) {
+	int k = sketcher->k_size, sketchSize = sketcher->sketch_size;
+	heap_t* kmvSketch = sketcher->kmvSketch;
+
+	// check k-mer size and seq length
+	assert(len > 0 && k <= len);
+
+	// pack the sequence into fresh scratch space (everything from the last sequence is dropped)
+	startScratch(sketcher, len);
+	seqpack(str, len, sketcher->packed, sketcher->nmask);
+
+	// run the k-mer loop
+	sketcher->kmer_loop(sketcher, len, bf);
+	if (sketcher->scale > 0) return finishScaledSketch(sketcher);
+	if (sketchSize == 0) return 0;
+
+	// the sequence has now been sketched, so collect the minimums from the heap
+	int sketchLength = getSketch(kmvSketch, sketcher->sketch);
+
+	// empty the kmvSketch heap and the hashmap, ready for the next sequence
+	resetHeap(kmvSketch);
+	hmClear(sketcher->tracker);
+	return sketchLength;
+}
@@ -3,11 +3,50 @@
 
 #include <stdint.h>
 
+#include "arena.h"
 #include "bloom.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "hll.h"
+
+// SKETCH_MAX_K is the largest supported k-mer size (k-mers above 31 bases use the 128-bit kernel)
+#define SKETCH_MAX_K 63
+
+struct sketcher;
+
+// kmerLoopFunc_t rolls the k-mers over the packed sequence in a sketcher's scratch space and adds them
+typedef void (*kmerLoopFunc_t)(struct sketcher *sketcher, int len, struct bloom *bf);
+
+/*
+    sketcher_t holds the state needed to sketch one sequence at a time
+    - each thread should own its own sketcher and reuse it for every sequence
+    - a sketchSize of 0 creates a sketcher that only adds k-mers to a bloom filter
+    - a scaled sketcher (initScaledSketcher) keeps every k-mer hashing below max_hash/scale instead of a fixed number of minimums
+*/
+typedef struct sketcher
+{
+    int k_size;
+    int sketch_size;
+    int scale;          // 0 for a KMV sketch, otherwise the scaled sketch keeps 1/scale of the hash space
+    uint64_t threshold; // scaled sketches keep hashed k-mers below this value
+    int sketch_length;  // the number of hashed k-mers collected so far for a scaled sketch
+    int sketch_capacity; // the number of values sketch can hold
+    uint64_t *sketch;   // the minimums from the most recent sequence (sketch_size values, or sketch_length for a scaled sketch in the arena)
+    hashmap_t *tracker; // tracks which hashed k-mers are currently in the KMV sketch
+    heap_t *kmvSketch;  // the KMV sketch heap
+    arena_t *arena;     // per-sequence scratch (the packed sequence and scaled sketch), reset at the start of each sequence
+    uint64_t *packed;   // the 2-bit packed sequence (from the arena)
+    uint32_t *nmask;    // the N-mask of the packed sequence (from the arena)
+    hll_t *hll;         // counts the distinct hashed k-mers when set (can be shared between sketchers)
+    kmerLoopFunc_t kmer_loop; // the k-mer loop for k_size, picked when the sketcher is created
+} sketcher_t;
 
 /*
     function prototypes
 */
-void sketchSequence(const char *str, int len, int k, int sketchSize, struct bloom *bf, uint64_t *sketchPtr);
+sketcher_t *initSketcher(int kSize, int sketchSize);
+sketcher_t *initScaledSketcher(int kSize, int scale);
+void destroySketcher(sketcher_t *sketcher);
+int sketchSequence(sketcher_t *sketcher, const char *str, int len, struct bloom *bf);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,121 @@
+#ifndef BENCH_BLOOM
+#define BENCH_BLOOM
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../bloom.h"
+
+/*
+  benchmark comparing the standard and the blocked bloom filter layouts
+  usage: bench_bloom [numEntries] [fpRate]
+
+  the filter is filled with numEntries hashed k-mers and then queried with the
+  same number of absent keys (to get the false positive rate and the
+  negative query rate) and present keys (to get the positive query rate)
+
+  each layout is run through the byte entry points (which hash the key with
+  murmurhash2) and the 64 bit hash entry points that antman uses
+*/
+
+#define BENCH_DEFAULT_ENTRIES 50000000
+#define BENCH_DEFAULT_FP_RATE 0.001
+
+// splitmix64 gives a stream of well mixed 64 bit keys
+static inline uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// benchType fills and queries one filter layout
+static int benchType(int type, int useHash, int numEntries, double fpRate)
+{
+  struct bloom bloom;
+  if (bloom_init_type(&bloom, numEntries, fpRate, type) != 0)
+  {
+    fprintf(stderr, "could not init bloom filter\n");
+    return 1;
+  }
+  uint64_t i, key;
+  long hits = 0;
+
+  // fill with even keys
+  double t0 = now();
+  for (i = 0; i < (uint64_t)numEntries; i++)
+  {
+    key = splitmix64(2 * i);
+    if (useHash)
+      bloom_add_hash(&bloom, key);
+    else
+      bloom_add(&bloom, &key, sizeof(uint64_t));
+  }
+  double t1 = now();
+
+  // query absent (odd) keys
+  for (i = 0; i < (uint64_t)numEntries; i++)
+  {
+    key = splitmix64(2 * i + 1);
+    hits += useHash ? bloom_check_hash(&bloom, key) : bloom_check(&bloom, &key, sizeof(uint64_t));
+  }
+  double t2 = now();
+
+  // query present keys
+  long found = 0;
+  for (i = 0; i < (uint64_t)numEntries; i++)
+  {
+    key = splitmix64(2 * i);
+    found += useHash ? bloom_check_hash(&bloom, key) : bloom_check(&bloom, &key, sizeof(uint64_t));
+  }
+  double t3 = now();
+  if (found != numEntries)
+  {
+    fprintf(stderr, "bloom filter returned a false negative\n");
+    return 1;
+  }
+  fprintf(stderr, "%10s\t%6s\t%8.1f\t%10.6f\t%12.2f\t%12.2f\t%12.2f\n",
+          type == BLOOM_BLOCKED ? "blocked" : "standard",
+          useHash ? "hash" : "bytes",
+          bloom.bytes / 1048576.0,
+          (double)hits / numEntries,
+          numEntries / (t1 - t0) / 1e6,
+          numEntries / (t2 - t1) / 1e6,
+          numEntries / (t3 - t2) / 1e6);
+  bloom_free(&bloom);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  int numEntries = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_ENTRIES;
+  double fpRate = (argc > 2) ? atof(argv[2]) : BENCH_DEFAULT_FP_RATE;
+  fprintf(stderr, "bench_bloom: %d entries, target fp rate %g\n", numEntries, fpRate);
+  fprintf(stderr, "%10s\t%6s\t%8s\t%10s\t%12s\t%12s\t%12s\n", "layout", "api", "MiB", "fp rate", "add (M/s)", "absent (M/s)", "present (M/s)");
+  int type, useHash;
+  for (type = BLOOM_STANDARD; type <= BLOOM_BLOCKED; type++)
+  {
+    for (useHash = 0; useHash <= 1; useHash++)
+    {
+      if (benchType(type, useHash, numEntries, fpRate) != 0)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+#endif
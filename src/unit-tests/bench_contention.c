@@ -0,0 +1,131 @@
+#ifndef BENCH_CONTENTION
+#define BENCH_CONTENTION
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../bloom.h"
+
+/*
+  contention benchmark for the white list bloom filter read path
+  usage: bench_contention [numEntries] [queriesPerThread]
+
+  each thread checks sketches of 128 hashed k-mers against a shared filter,
+  either holding a global mutex around each sketch (the old processFastq read
+  path) or reading the frozen filter without any locking
+*/
+
+#define BENCH_DEFAULT_ENTRIES 10000000
+#define BENCH_DEFAULT_QUERIES 2000000
+#define BENCH_SKETCH_SIZE 128
+#define BENCH_MAX_THREADS 64
+
+pthread_mutex_t benchMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// benchArgs
+typedef struct benchArgs
+{
+  struct bloom *bloom;
+  uint64_t seed;
+  long queries;
+  int useMutex;
+  long hits;
+} benchArgs_t;
+
+// splitmix64 gives a stream of well mixed 64 bit keys
+static inline uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// queryWorker checks one thread's share of the queries, a sketch at a time
+static void *queryWorker(void *arg)
+{
+  benchArgs_t *args = arg;
+  long i;
+  int j;
+  uint64_t key = args->seed;
+  for (i = 0; i < args->queries; i += BENCH_SKETCH_SIZE)
+  {
+    if (args->useMutex)
+      pthread_mutex_lock(&benchMutex);
+    for (j = 0; j < BENCH_SKETCH_SIZE; j++)
+    {
+      key = splitmix64(key);
+      args->hits += bloom_check_hash(args->bloom, key);
+    }
+    if (args->useMutex)
+      pthread_mutex_unlock(&benchMutex);
+  }
+  return NULL;
+}
+
+// runThreads times numThreads concurrent query workers
+static double runThreads(struct bloom *bloom, int numThreads, long queriesPerThread, int useMutex)
+{
+  pthread_t threads[BENCH_MAX_THREADS];
+  benchArgs_t args[BENCH_MAX_THREADS];
+  int i;
+  double t0 = now();
+  for (i = 0; i < numThreads; i++)
+  {
+    args[i].bloom = bloom;
+    args[i].seed = (uint64_t)i << 40;
+    args[i].queries = queriesPerThread;
+    args[i].useMutex = useMutex;
+    args[i].hits = 0;
+    pthread_create(&threads[i], NULL, queryWorker, &args[i]);
+  }
+  for (i = 0; i < numThreads; i++)
+    pthread_join(threads[i], NULL);
+  double t1 = now();
+  return (double)numThreads * queriesPerThread / (t1 - t0) / 1e6;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  int numEntries = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_ENTRIES;
+  long queriesPerThread = (argc > 2) ? atol(argv[2]) : BENCH_DEFAULT_QUERIES;
+  struct bloom bloom;
+  uint64_t i;
+  if (bloom_init(&bloom, numEntries, 0.001) != 0)
+  {
+    fprintf(stderr, "could not init bloom filter\n");
+    return 1;
+  }
+  for (i = 0; i < (uint64_t)numEntries; i++)
+    bloom_add_hash(&bloom, splitmix64(i));
+  bloom_freeze(&bloom);
+
+  fprintf(stderr, "bench_contention: %d entries, %ld queries per thread, %ld online CPUs\n", numEntries, queriesPerThread, sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(stderr, "%8s\t%14s\t%14s\t%8s\n", "threads", "mutex (M/s)", "frozen (M/s)", "speedup");
+  int numThreads;
+  for (numThreads = 1; numThreads <= BENCH_MAX_THREADS; numThreads *= 2)
+  {
+    double locked = runThreads(&bloom, numThreads, queriesPerThread, 1);
+    double frozen = runThreads(&bloom, numThreads, queriesPerThread, 0);
+    fprintf(stderr, "%8d\t%14.2f\t%14.2f\t%7.2fx\n", numThreads, locked, frozen, frozen / locked);
+  }
+  bloom_free(&bloom);
+  return 0;
+}
+
+#endif
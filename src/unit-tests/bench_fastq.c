@@ -0,0 +1,164 @@
+#ifndef BENCH_FASTQ
+#define BENCH_FASTQ
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "../fastqmap.h"
+#include "../gzreader.h"
+#include "../kseq.h"
+
+/*
+  benchmark comparing the FASTQ parsers on an uncompressed file
+  usage: bench_fastq [megabytes] [readLength]
+
+  a FASTQ file of the given size is written and then parsed with kseq over
+  gzread (the original path), kseq over the gzreader, and the mapped parser
+
+  use a size bigger than the page cache to include the cost of reading from disk
+*/
+
+#define BENCH_DEFAULT_MB 2048
+#define BENCH_DEFAULT_READ_LENGTH 10000
+#define BENCH_FASTQ_FILE "./bench.fastq"
+
+// kseq reads through benchRead, which calls whichever read function is being benchmarked
+static int (*readFunc)(void *fp, void *buf, unsigned int len);
+static int benchRead(void *fp, void *buf, unsigned int len)
+{
+  return readFunc(fp, buf, len);
+}
+KSEQ_INIT(void *, benchRead)
+
+// gzreadFunc and gzrReadFunc adapt gzread and gzrRead to readFunc
+static int gzreadFunc(void *fp, void *buf, unsigned int len)
+{
+  return gzread((gzFile)fp, buf, len);
+}
+static int gzrReadFunc(void *fp, void *buf, unsigned int len)
+{
+  return gzrRead((gzReader_t *)fp, buf, len);
+}
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// sumSeq stops the parsers being optimised away
+static uint64_t sumSeq(const char *seq, int len)
+{
+  return (unsigned char)seq[0] + (unsigned char)seq[len - 1] + len;
+}
+
+// benchKseq parses the file with kseq
+static void benchKseq(void *fp, long *numReads, uint64_t *sum)
+{
+  kseq_t *seq = kseq_init(fp);
+  int l;
+  while ((l = kseq_read(seq)) >= 0)
+  {
+    (*numReads)++;
+    *sum += sumSeq(seq->seq.s, l);
+  }
+  kseq_destroy(seq);
+}
+
+// benchGzread parses the file with kseq over gzread (the original path)
+static double benchGzread(long *numReads, uint64_t *sum)
+{
+  double t0 = now();
+  gzFile fp = gzopen(BENCH_FASTQ_FILE, "r");
+  readFunc = gzreadFunc;
+  benchKseq(fp, numReads, sum);
+  gzclose(fp);
+  return now() - t0;
+}
+
+// benchGzreader parses the file with kseq over the gzreader
+static double benchGzreader(long *numReads, uint64_t *sum)
+{
+  double t0 = now();
+  gzReader_t *fp = gzrOpen(BENCH_FASTQ_FILE, 1, NULL, 0);
+  readFunc = gzrReadFunc;
+  benchKseq(fp, numReads, sum);
+  gzrClose(fp);
+  return now() - t0;
+}
+
+// benchMapped parses the file with the mapped parser
+static double benchMapped(long *numReads, uint64_t *sum)
+{
+  double t0 = now();
+  fastqMap_t *fqm = fqmOpen(BENCH_FASTQ_FILE);
+  fastqRecord_t record;
+  int l;
+  while ((l = fqmNext(fqm, &record)) >= 0)
+  {
+    (*numReads)++;
+    *sum += sumSeq(record.seq, l);
+  }
+  fqmClose(fqm);
+  return now() - t0;
+}
+
+int main(int argc, char **argv)
+{
+  long size = (argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_MB) * 1048576;
+  int readLength = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_READ_LENGTH;
+
+  // write the FASTQ file
+  FILE *fp = fopen(BENCH_FASTQ_FILE, "w");
+  if (!fp)
+  {
+    fprintf(stderr, "could not write %s\n", BENCH_FASTQ_FILE);
+    return 1;
+  }
+  char *seq = malloc(readLength + 1), *qual = malloc(readLength + 1);
+  uint64_t x = 42;
+  long written = 0, i;
+  int r;
+  for (r = 0; written < size; r++)
+  {
+    for (i = 0; i < readLength; i++)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      seq[i] = "ACGT"[x & 3];
+      qual[i] = '!' + (x >> 8) % 40;
+    }
+    seq[readLength] = qual[readLength] = '\0';
+    written += fprintf(fp, "@read%d\n%s\n+\n%s\n", r, seq, qual);
+  }
+  fclose(fp);
+  free(seq);
+  free(qual);
+
+  printf("bench_fastq: %ld MiB, %d reads of %dbp\n", written / 1048576, r, readLength);
+  printf("%16s\t%10s\t%10s\n", "parser", "seconds", "MiB/s");
+  double (*benches[])(long *, uint64_t *) = {benchGzread, benchGzreader, benchMapped};
+  const char *names[] = {"kseq+gzread", "kseq+gzreader", "mapped"};
+  uint64_t firstSum = 0;
+  int b;
+  for (b = 0; b < 3; b++)
+  {
+    long numReads = 0;
+    uint64_t sum = 0;
+    double secs = benches[b](&numReads, &sum);
+    if (numReads != r || (b && sum != firstSum))
+      fprintf(stderr, "%s parsed %ld reads, expected %d\n", names[b], numReads, r);
+    firstSum = b ? firstSum : sum;
+    printf("%16s\t%10.2f\t%10.1f\n", names[b], secs, written / 1048576.0 / secs);
+  }
+  remove(BENCH_FASTQ_FILE);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef BENCH_GZREADER
+#define BENCH_GZREADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "../gzreader.h"
+
+/*
+  benchmark comparing gzread with the gzreader for gzip and BGZF files
+  usage: bench_gzreader [megabytes] [threads]
+
+  a FASTQ-like file of the given size is written as a single gzip member and as
+  BGZF, and each is decompressed with gzread and with the gzreader
+  without a thread count, the BGZF file is read with 1 to BENCH_MAX_THREADS inflate threads
+*/
+
+#define BENCH_DEFAULT_MB 128
+#define BENCH_MAX_THREADS 8
+#define BENCH_GZIP "./bench.gzreader.fastq.gz"
+#define BENCH_BGZF "./bench.gzreader.bgzf.fastq.gz"
+#define BENCH_BUFFER_SIZE 16384
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// putLE writes a little endian integer
+static void putLE(unsigned char *buf, uint32_t x, int n)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    buf[i] = (x >> (8 * i)) & 0xff;
+}
+
+// writeBGZF writes data as BGZF blocks, followed by the empty EOF block
+static void writeBGZF(const char *filepath, const char *data, long len)
+{
+  FILE *fp = fopen(filepath, "wb");
+  unsigned char block[65536];
+  long start = 0;
+  int last = 0;
+  while (!last)
+  {
+    int n = len - start < 65280 ? len - start : 65280;
+    last = (n == 0);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in = (unsigned char *)data + start;
+    zs.avail_in = n;
+    zs.next_out = block + 18;
+    zs.avail_out = sizeof(block) - 26;
+    deflate(&zs, Z_FINISH);
+    int clen = zs.total_out;
+    deflateEnd(&zs);
+    unsigned char header[18] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0};
+    putLE(header + 16, clen + 25, 2);
+    memcpy(block, header, 18);
+    putLE(block + 18 + clen, crc32(crc32(0L, Z_NULL, 0), (unsigned char *)data + start, n), 4);
+    putLE(block + 22 + clen, n, 4);
+    fwrite(block, 1, clen + 26, fp);
+    start += n;
+  }
+  fclose(fp);
+}
+
+// benchGzread decompresses a file with gzread and returns MB/s
+static double benchGzread(const char *filepath, long len)
+{
+  char buf[BENCH_BUFFER_SIZE];
+  double t0 = now();
+  gzFile gz = gzopen(filepath, "r");
+  long got = 0;
+  int n;
+  while ((n = gzread(gz, buf, sizeof(buf))) > 0)
+    got += n;
+  gzclose(gz);
+  if (got != len)
+    fprintf(stderr, "gzread returned %ld bytes, expected %ld\n", got, len);
+  return len / 1048576.0 / (now() - t0);
+}
+
+// benchGzreader decompresses a file with the gzreader and returns MB/s
+static double benchGzreader(const char *filepath, long len, int numThreads)
+{
+  char buf[BENCH_BUFFER_SIZE];
+  double t0 = now();
+  gzReader_t *reader = gzrOpen(filepath, numThreads, NULL, 0);
+  long got = 0;
+  int n;
+  while ((n = gzrRead(reader, buf, sizeof(buf))) > 0)
+    got += n;
+  gzrClose(reader);
+  if (got != len)
+    fprintf(stderr, "gzrRead returned %ld bytes, expected %ld\n", got, len);
+  return len / 1048576.0 / (now() - t0);
+}
+
+int main(int argc, char **argv)
+{
+  long len = (argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_MB) * 1048576;
+  int numThreads = argc > 2 ? atoi(argv[2]) : 0;
+
+  // make some FASTQ-like data and write both files
+  char *data = malloc(len);
+  long i;
+  uint64_t x = 42;
+  for (i = 0; i < len; i++)
+  {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    data[i] = (i % 101 == 100) ? '\n' : "ACGT"[x & 3];
+  }
+  gzFile gz = gzopen(BENCH_GZIP, "wb");
+  gzwrite(gz, data, len);
+  gzclose(gz);
+  writeBGZF(BENCH_BGZF, data, len);
+  free(data);
+
+  printf("bench_gzreader: %ld MiB\n", len / 1048576);
+  printf("%10s\t%8s\t%12s\t%12s\n", "format", "threads", "gzread MB/s", "gzreader MB/s");
+  printf("%10s\t%8d\t%12.1f\t%12.1f\n", "gzip", 1, benchGzread(BENCH_GZIP, len), benchGzreader(BENCH_GZIP, len, 1));
+  double gzreadRate = benchGzread(BENCH_BGZF, len);
+  int t;
+  for (t = numThreads ? numThreads : 1; t <= (numThreads ? numThreads : BENCH_MAX_THREADS); t *= 2)
+    printf("%10s\t%8d\t%12.1f\t%12.1f\n", "bgzf", t, gzreadRate, benchGzreader(BENCH_BGZF, len, t));
+  remove(BENCH_GZIP);
+  remove(BENCH_BGZF);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef BENCH_HEAP
+#define BENCH_HEAP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../heap.c"
+
+/*
+  microbenchmark comparing the array bottom-k heap against the old linked-list KMV heap
+  usage: bench_heap [numValues]
+*/
+
+#define BENCH_DEFAULT_VALUES 20000000
+
+// listNode is the node from the old linked-list heap (kept here as the benchmark baseline)
+typedef struct listNode
+{
+  struct listNode *next;
+  uint64_t minimum;
+} listNode_t;
+
+static listNode_t *listInit(uint64_t minimum)
+{
+  listNode_t *tmp = (listNode_t *)malloc(sizeof(listNode_t));
+  tmp->next = NULL;
+  tmp->minimum = minimum;
+  return tmp;
+}
+
+static void listPop(listNode_t **head)
+{
+  listNode_t *tmp = *head;
+  (*head) = (*head)->next;
+  free(tmp);
+}
+
+static void listPush(listNode_t **head, uint64_t minimum)
+{
+  listNode_t *tmp = listInit(minimum);
+  listNode_t *start = (*head);
+  if ((*head)->minimum < minimum)
+  {
+    tmp->next = *head;
+    (*head) = tmp;
+  }
+  else
+  {
+    while (start->next != NULL && start->next->minimum > minimum)
+    {
+      start = start->next;
+    }
+    tmp->next = start->next;
+    start->next = tmp;
+  }
+}
+
+static void listDestroy(listNode_t **head)
+{
+  listNode_t *tmp;
+  while ((tmp = *head) != NULL)
+  {
+    (*head) = (*head)->next;
+    free(tmp);
+  }
+}
+
+// xorshift64 gives a cheap stream of pseudo-random hashed k-mers
+static inline uint64_t xorshift64(uint64_t *state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// benchList runs a bottom-k selection over the stream using the linked-list heap
+static uint64_t benchList(uint64_t *values, long numValues, int k)
+{
+  listNode_t *head = NULL;
+  int size = 0;
+  long i;
+  for (i = 0; i < numValues; i++)
+  {
+    if (size < k)
+    {
+      if (size == 0)
+        head = listInit(values[i]);
+      else
+        listPush(&head, values[i]);
+      size++;
+      continue;
+    }
+    if (head->minimum <= values[i])
+      continue;
+    listPop(&head);
+    listPush(&head, values[i]);
+  }
+  uint64_t max = head->minimum;
+  listDestroy(&head);
+  return max;
+}
+
+// benchArray runs a bottom-k selection over the stream using the array heap
+static uint64_t benchArray(uint64_t *values, long numValues, int k)
+{
+  heap_t *heap = initHeap(k);
+  long i;
+  for (i = 0; i < numValues; i++)
+  {
+    if (!isFull(heap))
+    {
+      push(heap, values[i]);
+      continue;
+    }
+    if (peek(heap) <= values[i])
+      continue;
+    replaceTop(heap, values[i]);
+  }
+  uint64_t max = peek(heap);
+  destroy(heap);
+  return max;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  long numValues = (argc > 1) ? atol(argv[1]) : BENCH_DEFAULT_VALUES;
+  int sketchSizes[] = {128, 1000, 4096};
+  int numSizes = sizeof(sketchSizes) / sizeof(sketchSizes[0]);
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  long i;
+  int j;
+
+  uint64_t *values = malloc(numValues * sizeof(uint64_t));
+  if (!values)
+  {
+    fprintf(stderr, "could not allocate benchmark values\n");
+    return 1;
+  }
+
+  // random values model the hashed k-mers from a long read
+  for (i = 0; i < numValues; i++)
+    values[i] = xorshift64(&state);
+
+  fprintf(stderr, "bench_heap: bottom-k over %ld random hashed k-mers\n", numValues);
+  fprintf(stderr, "%8s\t%14s\t%14s\t%8s\n", "k", "list (ns/val)", "array (ns/val)", "speedup");
+  for (j = 0; j < numSizes; j++)
+  {
+    int k = sketchSizes[j];
+    double t0 = now();
+    uint64_t listMax = benchList(values, numValues, k);
+    double t1 = now();
+    uint64_t arrayMax = benchArray(values, numValues, k);
+    double t2 = now();
+    if (listMax != arrayMax)
+    {
+      fprintf(stderr, "heaps disagree for k=%d\n", k);
+      free(values);
+      return 1;
+    }
+    fprintf(stderr, "%8d\t%14.2f\t%14.2f\t%7.1fx\n", k, (t1 - t0) * 1e9 / numValues, (t2 - t1) * 1e9 / numValues, (t1 - t0) / (t2 - t1));
+  }
+
+  // the descending stream makes every value replace the current max
+  for (i = 0; i < numValues / 100; i++)
+    values[i] = (uint64_t)(numValues - i);
+  fprintf(stderr, "bench_heap: worst case (descending) over %ld values\n", numValues / 100);
+  for (j = 0; j < numSizes; j++)
+  {
+    int k = sketchSizes[j];
+    double t0 = now();
+    benchList(values, numValues / 100, k);
+    double t1 = now();
+    benchArray(values, numValues / 100, k);
+    double t2 = now();
+    fprintf(stderr, "%8d\t%14.2f\t%14.2f\t%7.1fx\n", k, (t1 - t0) * 1e9 / (numValues / 100), (t2 - t1) * 1e9 / (numValues / 100), (t1 - t0) / (t2 - t1));
+  }
+  free(values);
+  return 0;
+}
+
+#endif
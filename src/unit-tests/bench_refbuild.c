@@ -0,0 +1,95 @@
+#ifndef BENCH_REFBUILD
+#define BENCH_REFBUILD
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../bloom.h"
+#include "../sequence.h"
+
+/*
+  benchmark for building the white list bloom filter with processRef
+  usage: bench_refbuild [megabases] [kSize]
+
+  a multi-FASTA reference of the given size is written, and then loaded into a
+  bloom filter with 1 to BENCH_MAX_THREADS workers, to show how the build scales
+  with the number of cores
+*/
+
+#define BENCH_DEFAULT_MBP 64
+#define BENCH_DEFAULT_K 21
+#define BENCH_RECORDS 8
+#define BENCH_MAX_THREADS 8
+#define BENCH_FASTA "./bench.refbuild.fasta"
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+  long len = (argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_MBP) * 1000000;
+  int kSize = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_K;
+
+  // write the reference as a few long records
+  FILE *fp = fopen(BENCH_FASTA, "w");
+  if (!fp)
+  {
+    fprintf(stderr, "could not write %s\n", BENCH_FASTA);
+    return 1;
+  }
+  uint64_t x = 42;
+  long i;
+  int r;
+  for (r = 0; r < BENCH_RECORDS; r++)
+  {
+    fprintf(fp, ">record%d\n", r);
+    for (i = 0; i < len / BENCH_RECORDS; i++)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      fputc("ACGT"[x & 3], fp);
+      if (i % 80 == 79)
+        fputc('\n', fp);
+    }
+    fputc('\n', fp);
+  }
+  fclose(fp);
+
+  // build the filter with more and more workers
+  double rates[BENCH_MAX_THREADS + 1];
+  int t;
+  for (t = 1; t <= BENCH_MAX_THREADS; t *= 2)
+  {
+    struct bloom bf;
+    if (bloom_init(&bf, len, 0.001) != 0)
+    {
+      fprintf(stderr, "could not init the bloom filter\n");
+      return 1;
+    }
+    double t0 = now();
+    if (processRef(BENCH_FASTA, &bf, kSize, t, NULL, 0) < 0)
+    {
+      fprintf(stderr, "could not build the bloom filter\n");
+      return 1;
+    }
+    rates[t] = len / 1e6 / (now() - t0);
+    bloom_free(&bf);
+  }
+  remove(BENCH_FASTA);
+
+  printf("bench_refbuild: %ld Mbp, k=%d\n", len / 1000000, kSize);
+  printf("%8s\t%10s\t%8s\n", "threads", "Mbp/s", "speedup");
+  for (t = 1; t <= BENCH_MAX_THREADS; t *= 2)
+    printf("%8d\t%10.1f\t%7.2fx\n", t, rates[t], rates[t] / rates[1]);
+  return 0;
+}
+
+#endif
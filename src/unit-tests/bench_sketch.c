@@ -0,0 +1,284 @@
+#ifndef BENCH_SKETCH
+#define BENCH_SKETCH
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../fastqmap.h"
+#include "../hashmap.h"
+#include "../heap.h"
+#include "../kmerhash.h"
+#include "../seqpack.h"
+#include "../sketch.c"
+
+/*
+  benchmark for the sketcher, in bases per second
+  usage: bench_sketch [reads.fastq] [kSize] [sketchSize]
+
+  the reads come from an uncompressed FASTQ file if one is given (e.g. some real
+  nanopore reads), otherwise 20000 random 10kb reads with the odd N are used
+
+  the 2-bit packing is timed with the scalar and AVX2 kernels, the batched
+  hashing with the scalar, AVX2 and AVX-512 kernels, and the whole sketch is
+  timed with the original byte at a time loop and the packed, batched loop,
+  and as a scaled sketch keeping 1/1000 of the hashed k-mers
+
+  the k-mer loop is also timed on its own (with a bloom-only sketcher and no
+  bloom filter, so it is just packing, rolling and hashing) for each of the
+  specialised k-mer sizes, against the generic loop (sketch.c is included
+  directly so the generic loop can be swapped in)
+*/
+
+#define BENCH_NUM_READS 20000
+#define BENCH_READ_LENGTH 10000
+#define BENCH_DEFAULT_K_SIZE 21
+#define BENCH_DEFAULT_SKETCH_SIZE 128
+
+// reads_t holds the benchmark reads
+typedef struct reads
+{
+  const char **seqs;
+  int *lens;
+  int num;
+  long bases;
+} reads_t;
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// seq_nt4_table is the lookup table used by sketch.c before the packed loop
+static unsigned char seq_nt4_table[256];
+
+// legacySketch is the byte at a time sketch loop that the packed loop replaced
+static int legacySketch(sketcher_t *sketcher, const char *str, int len)
+{
+  int k = sketcher->k_size;
+  uint64_t shift1 = 2 * (k - 1), mask = (1ULL << 2 * k) - 1, kmer[2] = {0, 0}, hashedKmer = 0;
+  int i, l, kmer_span = 0;
+  for (i = l = 0; i < len; i++)
+  {
+    int c = seq_nt4_table[(uint8_t)str[i]];
+    if (c < 4)
+    {
+      int z;
+      kmer_span = l + 1 < k ? l + 1 : k;
+      kmer[0] = (kmer[0] << 2 | c) & mask;
+      kmer[1] = (kmer[1] >> 2) | (3ULL ^ c) << shift1;
+      if (kmer[0] == kmer[1])
+        continue;
+      z = kmer[0] < kmer[1] ? 0 : 1;
+      l++;
+      if (l >= k && kmer_span < 256)
+        hashedKmer = hash64(kmer[z], mask) << 8 | kmer_span;
+    }
+    else
+      l = 0, kmer_span = 0;
+    if (i < k)
+      continue;
+    if (!isFull(sketcher->kmvSketch))
+    {
+      if (hmSearch(sketcher->tracker, hashedKmer))
+        continue;
+      push(sketcher->kmvSketch, hashedKmer);
+      hmInsert(sketcher->tracker, hashedKmer);
+      continue;
+    }
+    if (peek(sketcher->kmvSketch) <= hashedKmer)
+      continue;
+    if (hmSearch(sketcher->tracker, hashedKmer))
+      continue;
+    hmDelete(sketcher->tracker, peek(sketcher->kmvSketch));
+    replaceTop(sketcher->kmvSketch, hashedKmer);
+    hmInsert(sketcher->tracker, hashedKmer);
+  }
+  int sketchLength = getSketch(sketcher->kmvSketch, sketcher->sketch);
+  resetHeap(sketcher->kmvSketch);
+  hmClear(sketcher->tracker);
+  return sketchLength;
+}
+
+// benchPack times a packing kernel over all the reads and returns bases per second
+static double benchPack(reads_t *reads, seqpackFunc_t pack)
+{
+  int maxLen = 0, i;
+  for (i = 0; i < reads->num; i++)
+    maxLen = reads->lens[i] > maxLen ? reads->lens[i] : maxLen;
+  uint64_t *packed = malloc(seqpackWords(maxLen) * sizeof(uint64_t));
+  uint32_t *nmask = malloc(seqpackWords(maxLen) * sizeof(uint32_t));
+  uint64_t check = 0;
+  double t0 = now();
+  for (i = 0; i < reads->num; i++)
+  {
+    pack(reads->seqs[i], reads->lens[i], packed, nmask);
+    check += packed[0] ^ nmask[0];
+  }
+  double secs = now() - t0;
+  free(packed);
+  free(nmask);
+  if (check == 42)
+    printf(" ");
+  return reads->bases / secs;
+}
+
+// benchHash times a batched hash kernel and returns k-mers per second
+static double benchHash(hashBatchFunc_t hash, int kSize)
+{
+  uint64_t kmers[KMERHASH_BATCH], hashes[KMERHASH_BATCH], mask = (1ULL << 2 * kSize) - 1, check = 0;
+  int i, rounds = 200000;
+  for (i = 0; i < KMERHASH_BATCH; i++)
+    kmers[i] = (i * 0x9E3779B97F4A7C15ULL) & mask;
+  double t0 = now();
+  for (i = 0; i < rounds; i++)
+  {
+    kmers[0] = i;
+    hash(kmers, KMERHASH_BATCH, mask, kSize, hashes);
+    check += hashes[i % KMERHASH_BATCH];
+  }
+  double secs = now() - t0;
+  if (check == 42)
+    printf(" ");
+  return (double)rounds * KMERHASH_BATCH / secs;
+}
+
+// benchSketch times a sketch loop over all the reads and returns bases per second
+// a scale above 0 times a scaled sketch instead (which the legacy loop doesn't support)
+static double benchSketch(reads_t *reads, int kSize, int sketchSize, int scale, int legacy)
+{
+  sketcher_t *sketcher = scale > 0 ? initScaledSketcher(kSize, scale) : initSketcher(kSize, sketchSize);
+  long total = 0;
+  int i;
+  double t0 = now();
+  for (i = 0; i < reads->num; i++)
+  {
+    if (reads->lens[i] < kSize)
+      continue;
+    total += legacy ? legacySketch(sketcher, reads->seqs[i], reads->lens[i]) : sketchSequence(sketcher, reads->seqs[i], reads->lens[i], NULL);
+  }
+  double secs = now() - t0;
+  destroySketcher(sketcher);
+  if (total == 42)
+    printf(" ");
+  return reads->bases / secs;
+}
+
+// benchLoop times a k-mer loop over all the reads and returns bases per second
+static double benchLoop(reads_t *reads, int kSize, kmerLoopFunc_t loop)
+{
+  sketcher_t *sketcher = initSketcher(kSize, 0);
+  sketcher->kmer_loop = loop;
+  int i;
+  double t0 = now();
+  for (i = 0; i < reads->num; i++)
+  {
+    if (reads->lens[i] >= kSize)
+      sketchSequence(sketcher, reads->seqs[i], reads->lens[i], NULL);
+  }
+  double secs = now() - t0;
+  destroySketcher(sketcher);
+  return reads->bases / secs;
+}
+
+int main(int argc, char **argv)
+{
+  int kSize = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_K_SIZE;
+  int sketchSize = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_SKETCH_SIZE;
+  memset(seq_nt4_table, 4, sizeof(seq_nt4_table));
+  seq_nt4_table['A'] = seq_nt4_table['a'] = 0;
+  seq_nt4_table['C'] = seq_nt4_table['c'] = 1;
+  seq_nt4_table['G'] = seq_nt4_table['g'] = 2;
+  seq_nt4_table['T'] = seq_nt4_table['t'] = seq_nt4_table['U'] = seq_nt4_table['u'] = 3;
+
+  // load or make the reads
+  reads_t reads = {NULL, NULL, 0, 0};
+  fastqMap_t *fqm = NULL;
+  if (argc > 1)
+  {
+    fqm = fqmOpen(argv[1]);
+    if (!fqm)
+    {
+      fprintf(stderr, "could not map %s (it must be uncompressed)\n", argv[1]);
+      return 1;
+    }
+    int cap = 1024, l;
+    fastqRecord_t record;
+    reads.seqs = malloc(cap * sizeof(char *));
+    reads.lens = malloc(cap * sizeof(int));
+    while ((l = fqmNext(fqm, &record)) >= 0)
+    {
+      if (reads.num == cap)
+      {
+        cap *= 2;
+        reads.seqs = realloc(reads.seqs, cap * sizeof(char *));
+        reads.lens = realloc(reads.lens, cap * sizeof(int));
+      }
+      reads.seqs[reads.num] = record.seq;
+      reads.lens[reads.num++] = l;
+      reads.bases += l;
+    }
+  }
+  else
+  {
+    reads.num = BENCH_NUM_READS;
+    reads.seqs = malloc(reads.num * sizeof(char *));
+    reads.lens = malloc(reads.num * sizeof(int));
+    uint64_t x = 42;
+    int r, i;
+    for (r = 0; r < reads.num; r++)
+    {
+      char *seq = malloc(BENCH_READ_LENGTH);
+      for (i = 0; i < BENCH_READ_LENGTH; i++)
+      {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        seq[i] = (x & 0xfff) == 0 ? 'N' : "ACGT"[(x >> 20) & 3];
+      }
+      reads.seqs[r] = seq;
+      reads.lens[r] = BENCH_READ_LENGTH;
+      reads.bases += BENCH_READ_LENGTH;
+    }
+  }
+
+  printf("bench_sketch: %d reads, %ld bases, k=%d, sketch size=%d\n", reads.num, reads.bases, kSize, sketchSize);
+  printf("%24s\t%12s\n", "", "M/s");
+  printf("%24s\t%12.1f\n", "pack (scalar)", benchPack(&reads, seqpackScalar) / 1e6);
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+    printf("%24s\t%12.1f\n", "pack (avx2)", benchPack(&reads, seqpackAVX2) / 1e6);
+#endif
+  printf("%24s\t%12.1f\n", "hash (scalar)", benchHash(hash64BatchScalar, kSize) / 1e6);
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+    printf("%24s\t%12.1f\n", "hash (avx2)", benchHash(hash64BatchAVX2, kSize) / 1e6);
+  if (__builtin_cpu_supports("avx512f"))
+    printf("%24s\t%12.1f\n", "hash (avx512)", benchHash(hash64BatchAVX512, kSize) / 1e6);
+#endif
+  printf("%24s\t%12.1f\n", "sketch (byte loop)", benchSketch(&reads, kSize, sketchSize, 0, 1) / 1e6);
+  printf("%24s\t%12.1f\n", "sketch (packed loop)", benchSketch(&reads, kSize, sketchSize, 0, 0) / 1e6);
+  printf("%24s\t%12.1f\n", "sketch (scaled 1/1000)", benchSketch(&reads, kSize, sketchSize, 1000, 0) / 1e6);
+
+  // the specialised k-mer loops against the generic one
+  int specialised[] = {7, 15, 21, 31}, s;
+  printf("\n%24s\t%12s\t%12s\n", "k-mer loop", "generic M/s", "folded M/s");
+  for (s = 0; s < 4; s++)
+  {
+    char label[32];
+    snprintf(label, sizeof(label), "k=%d", specialised[s]);
+    double generic = benchLoop(&reads, specialised[s], sketchKmers);
+    double folded = benchLoop(&reads, specialised[s], selectKmerLoop(specialised[s]));
+    printf("%24s\t%12.1f\t%12.1f\n", label, generic / 1e6, folded / 1e6);
+  }
+  fqmClose(fqm);
+  return 0;
+}
+
+#endif
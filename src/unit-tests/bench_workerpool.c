@@ -0,0 +1,86 @@
+#ifndef BENCH_WORKERPOOL
+#define BENCH_WORKERPOOL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../workerpool.h"
+
+/*
+  benchmark for the workerpool scheduling overhead, in jobs per second
+  usage: bench_workerpool [numJobs] [jobWork]
+
+  the jobs are tiny (jobWork rounds of integer mixing), so this is mostly the cost
+  of queueing, waking and stealing. they are either all added by the main thread
+  (the watcher pattern, through the injection queue), or fanned out from inside the
+  pool by a reader job (the read batch pattern, through the worker deques)
+*/
+
+#define BENCH_DEFAULT_JOBS 1000000
+#define BENCH_DEFAULT_WORK 200
+#define BENCH_MAX_THREADS 16
+
+static tpool_t *pool;
+static long numJobs;
+static int jobWork;
+static volatile unsigned long sink;
+
+// now returns a monotonic timestamp in seconds
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// tinyJob does a little work
+static void tinyJob(void *arg)
+{
+  unsigned long x = (unsigned long)arg;
+  int i;
+  for (i = 0; i < jobWork; i++)
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+  if (x == 42)
+    sink = x;
+}
+
+// readerJob adds all the jobs from inside the pool
+static void readerJob(void *arg)
+{
+  long i;
+  for (i = 0; i < numJobs; i++)
+    tpool_add_work(pool, tinyJob, (void *)i);
+}
+
+// run times numJobs jobs on numThreads workers and returns jobs per second
+static double run(int numThreads, int nested)
+{
+  long i;
+  pool = tpool_create(numThreads);
+  double t0 = now();
+  if (nested)
+    tpool_add_work(pool, readerJob, NULL);
+  else
+    for (i = 0; i < numJobs; i++)
+      tpool_add_work(pool, tinyJob, (void *)i);
+  tpool_wait(pool);
+  double secs = now() - t0;
+  tpool_destroy(pool);
+  return numJobs / secs;
+}
+
+int main(int argc, char **argv)
+{
+  numJobs = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_JOBS;
+  jobWork = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_WORK;
+  printf("bench_workerpool: %ld jobs, %d rounds of work per job, %ld online CPUs\n", numJobs, jobWork, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s\t%16s\t%16s\n", "threads", "injected (M/s)", "nested (M/s)");
+  int numThreads;
+  for (numThreads = 1; numThreads <= BENCH_MAX_THREADS; numThreads *= 2)
+    printf("%8d\t%16.2f\t%16.2f\n", numThreads, run(numThreads, 0) / 1e6, run(numThreads, 1) / 1e6);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef TEST_ARENA
+#define TEST_ARENA
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "minunit.h"
+#include "../arena.h"
+
+#define BLOCK_SIZE 4096
+#define MAX_RETAIN 65536
+#define ERR_alloc "could not allocate"
+#define ERR_arena1 "arena allocation is not aligned"
+#define ERR_arena2 "arena allocations overlap"
+#define ERR_arena3 "reset arena did not reuse its block"
+#define ERR_arena4 "grown arena was not coalesced on reset"
+#define ERR_arena5 "arena kept more than its retain limit"
+
+int tests_run = 0;
+
+/*
+  test allocations are aligned, distinct, and reused after a reset
+*/
+static char *test_arenaAlloc()
+{
+  arena_t *arena = arenaInit(BLOCK_SIZE, MAX_RETAIN);
+  if (!arena)
+    return ERR_alloc;
+  unsigned char *ptrs[100];
+  int i, j;
+  for (i = 0; i < 100; i++)
+  {
+    if (!(ptrs[i] = arenaAlloc(arena, i + 1)))
+      return ERR_alloc;
+    if ((uintptr_t)ptrs[i] % ARENA_ALIGN)
+      return ERR_arena1;
+    memset(ptrs[i], i, i + 1);
+  }
+  for (i = 0; i < 100; i++)
+  {
+    for (j = 0; j <= i; j++)
+    {
+      if (ptrs[i][j] != i)
+        return ERR_arena2;
+    }
+  }
+
+  // the same allocations after a reset should come from the same (now single) block
+  arenaReset(arena);
+  size_t capacity = arenaCapacity(arena);
+  unsigned char *first = arenaAlloc(arena, 1);
+  for (i = 1; i < 100; i++)
+    arenaAlloc(arena, i + 1);
+  arenaReset(arena);
+  if (arenaAlloc(arena, 1) != first || arenaCapacity(arena) != capacity)
+    return ERR_arena3;
+  arenaDestroy(arena);
+  return 0;
+}
+
+/*
+  test the arena grows, coalesces on reset, and gives back anything over the retain limit
+*/
+static char *test_arenaGrow()
+{
+  arena_t *arena = arenaInit(BLOCK_SIZE, MAX_RETAIN);
+  if (!arena)
+    return ERR_alloc;
+
+  // a read that needs a few blocks leaves one block big enough for it next time
+  int i;
+  for (i = 0; i < 10; i++)
+  {
+    if (!arenaAlloc(arena, 2000))
+      return ERR_alloc;
+  }
+  size_t grown = arenaCapacity(arena);
+  arenaReset(arena);
+  if (arenaCapacity(arena) != grown || arena->head->next != NULL)
+    return ERR_arena4;
+  for (i = 0; i < 10; i++)
+    arenaAlloc(arena, 2000);
+  if (arena->head->next != NULL)
+    return ERR_arena4;
+
+  // a huge read is given back
+  if (!arenaAlloc(arena, MAX_RETAIN * 2))
+    return ERR_alloc;
+  arenaReset(arena);
+  if (arenaCapacity(arena) != BLOCK_SIZE)
+    return ERR_arena5;
+  arenaDestroy(arena);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_arenaAlloc);
+  mu_run_test(test_arenaGrow);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tarena_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
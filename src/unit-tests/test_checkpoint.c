@@ -0,0 +1,233 @@
+#ifndef TEST_CHECKPOINT
+#define TEST_CHECKPOINT
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../bloom.h"
+#include "../checkpoint.h"
+#include "../watcher.h"
+#include "../workerpool.h"
+
+#define TMP_STATE "./tmp.checkpoint.state"
+#define TMP_FASTQ "./tmp.checkpoint.fastq"
+#define NUM_READS 600
+#define ERR_checkpoint1 "could not set up the checkpoint"
+#define ERR_checkpoint2 "finished jobs were left on the checkpoint"
+#define ERR_checkpoint3 "the state file did not hold the unfinished files"
+#define ERR_checkpoint4 "an empty checkpoint left a state file behind"
+#define ERR_checkpoint5 "a malformed state file was not rejected"
+#define ERR_checkpoint6 "a resumed file did not skip the reads that were already done"
+#define ERR_checkpoint7 "a file dispatched after stopping was not kept on the checkpoint"
+#define ERR_checkpoint8 "not every read in a wrapped FASTQ file was sketched"
+#define ERR_checkpoint9 "a FASTQ file that couldn't be parsed was not failed"
+
+int tests_run = 0;
+
+static int numResumed;
+static long resumedReads;
+static char resumedPath[64];
+
+// resumeFile records the files read back from a state file
+static void resumeFile(const char *filepath, long readsDone, void *arg)
+{
+  numResumed++;
+  resumedReads = readsDone;
+  snprintf(resumedPath, sizeof(resumedPath), "%s", filepath);
+}
+
+/*
+  test unfinished files are written to a state file and read back
+*/
+static char *test_checkpoint()
+{
+  checkpoint_t *checkpoint = checkpointInit();
+  if (checkpoint == NULL)
+    return ERR_checkpoint1;
+  fastqJob_t *job1 = checkpointAdd(checkpoint, "/data/reads1.fastq", 0);
+  fastqJob_t *job2 = checkpointAdd(checkpoint, "/data/reads 2.fastq", 0);
+  if (job1 == NULL || job2 == NULL || checkpoint->numJobs != 2)
+    return ERR_checkpoint1;
+  job2->readsDone = 4096;
+  checkpointFinish(job1);
+  if (checkpoint->numJobs != 1 || checkpoint->jobs != job2)
+    return ERR_checkpoint2;
+
+  // the file left on the checkpoint is resumed from where it got to
+  if (checkpointWrite(checkpoint, TMP_STATE) != 0)
+    return ERR_checkpoint3;
+  numResumed = 0;
+  if (checkpointLoad(TMP_STATE, resumeFile, NULL) != 1 || numResumed != 1)
+    return ERR_checkpoint3;
+  if (resumedReads != 4096 || strcmp(resumedPath, "/data/reads 2.fastq") != 0)
+    return ERR_checkpoint3;
+
+  // a copy keeps the job's place, and is independent of the original
+  checkpoint_t *snapshot = checkpointInit();
+  checkpointCopy(snapshot, checkpoint);
+  if (snapshot->numJobs != 1 || snapshot->jobs == job2 || snapshot->jobs->readsDone != 4096)
+    return ERR_checkpoint3;
+  checkpointDestroy(snapshot);
+  if (checkpoint->numJobs != 1)
+    return ERR_checkpoint3;
+
+  // once everything is finished, the state file goes
+  checkpointFinish(job2);
+  if (checkpointWrite(checkpoint, TMP_STATE) != 0 || access(TMP_STATE, F_OK) == 0)
+    return ERR_checkpoint4;
+  if (checkpointLoad(TMP_STATE, resumeFile, NULL) != 0)
+    return ERR_checkpoint4;
+  checkpointDestroy(checkpoint);
+
+  // a malformed state file is rejected
+  FILE *fp = fopen(TMP_STATE, "w");
+  fprintf(fp, "not a number\t/data/reads1.fastq\n");
+  fclose(fp);
+  if (checkpointLoad(TMP_STATE, resumeFile, NULL) != -1)
+    return ERR_checkpoint5;
+  remove(TMP_STATE);
+  return 0;
+}
+
+/*
+  test files are resumed part way through, and are kept on the checkpoint if the daemon is stopping
+*/
+static char *test_resume()
+{
+  struct bloom bf;
+  if (bloom_init(&bf, 1000, 0.01) != 0)
+    return ERR_checkpoint1;
+  FILE *fp = fopen(TMP_FASTQ, "w");
+  int i;
+  for (i = 0; i < NUM_READS; i++)
+    fprintf(fp, "@read%d\nACGTACGTAAACCCGGGTTT\n+\nIIIIIIIIIIIIIIIIIIII\n", i);
+  fclose(fp);
+  fastqStats_t stats = {0, 0, 0, 0};
+  watcherArgs_t wargs;
+  wargs.stats = &stats;
+  wargs.checkpoint = checkpointInit();
+  wargs.numCpus = 0;
+  wargs.bloomFilter = &bf;
+  wargs.k_size = 7;
+  wargs.sketch_size = 16;
+  wargs.sketch_scale = 0;
+  wargs.ref_kmers = 1000;
+  wargs.fp_rate = 0.01;
+  wargs.workerPool = tpool_create(2);
+  if (wargs.checkpoint == NULL || wargs.workerPool == NULL)
+    return ERR_checkpoint1;
+
+  // a resumed file only sketches the rest of its reads, and leaves the checkpoint once it is finished
+  if (dispatchFastq(&wargs, TMP_FASTQ, 300) != 0)
+    return ERR_checkpoint6;
+  tpool_wait(wargs.workerPool);
+  if (stats.files != 1 || stats.reads != NUM_READS - 300 || wargs.checkpoint->numJobs != 0)
+    return ERR_checkpoint6;
+
+  // once the daemon is stopping, files are cancelled and keep their place
+  checkpointStop(wargs.checkpoint);
+  if (dispatchFastq(&wargs, TMP_FASTQ, 100) != 0)
+    return ERR_checkpoint7;
+  tpool_wait(wargs.workerPool);
+  if (stats.files != 1 || wargs.checkpoint->numJobs != 1 || wargs.checkpoint->jobs->readsDone != 100)
+    return ERR_checkpoint7;
+
+  // clean up the test
+  tpool_destroy(wargs.workerPool);
+  checkpointDestroy(wargs.checkpoint);
+  bloom_free(&bf);
+  remove(TMP_FASTQ);
+  return 0;
+}
+
+/*
+  test a FASTQ file which isn't four line records is read to the end, and a file that can't be parsed is failed
+*/
+static char *test_wrapped()
+{
+  struct bloom bf;
+  if (bloom_init(&bf, 1000, 0.01) != 0)
+    return ERR_checkpoint1;
+  fastqStats_t stats = {0, 0, 0, 0};
+  watcherArgs_t wargs;
+  wargs.stats = &stats;
+  wargs.checkpoint = checkpointInit();
+  wargs.numCpus = 0;
+  wargs.bloomFilter = &bf;
+  wargs.k_size = 7;
+  wargs.sketch_size = 16;
+  wargs.sketch_scale = 0;
+  wargs.ref_kmers = 1000;
+  wargs.fp_rate = 0.01;
+  wargs.workerPool = tpool_create(2);
+  if (wargs.checkpoint == NULL || wargs.workerPool == NULL)
+    return ERR_checkpoint1;
+
+  // the mapped parser takes the four line records, and kseq reads the wrapped ones after them
+  FILE *fp = fopen(TMP_FASTQ, "w");
+  int i;
+  for (i = 0; i < NUM_READS / 2; i++)
+    fprintf(fp, "@read%d\nACGTACGTAAACCCGGGTTT\n+\nIIIIIIIIIIIIIIIIIIII\n", i);
+  for (; i < NUM_READS; i++)
+    fprintf(fp, "@read%d\nACGTACGTAA\nACCCGGGTTT\n+\nIIIIIIIIII\nIIIIIIIIII\n", i);
+  fclose(fp);
+  if (dispatchFastq(&wargs, TMP_FASTQ, 0) != 0)
+    return ERR_checkpoint8;
+  tpool_wait(wargs.workerPool);
+  if (stats.files != 1 || stats.reads != NUM_READS || stats.sketched != NUM_READS || wargs.checkpoint->numJobs != 0)
+    return ERR_checkpoint8;
+
+  // a truncated record fails the file, which is taken off the checkpoint
+  fp = fopen(TMP_FASTQ, "w");
+  for (i = 0; i < NUM_READS; i++)
+    fprintf(fp, "@read%d\nACGTACGTAAACCCGGGTTT\n+\nIIIIIIIIIIIIIIIIIIII\n", i);
+  fprintf(fp, "@truncated\nACGTACGTAAACCCGGGTTT\n+\nIIII\n");
+  fclose(fp);
+  if (dispatchFastq(&wargs, TMP_FASTQ, 0) != 0)
+    return ERR_checkpoint9;
+  tpool_wait(wargs.workerPool);
+  if (stats.files != 1 || stats.failed != 1 || wargs.checkpoint->numJobs != 0)
+    return ERR_checkpoint9;
+
+  // clean up the test
+  tpool_destroy(wargs.workerPool);
+  checkpointDestroy(wargs.checkpoint);
+  bloom_free(&bf);
+  remove(TMP_FASTQ);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_checkpoint);
+  mu_run_test(test_resume);
+  mu_run_test(test_wrapped);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tcheckpoint_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "minunit.h"
 #include "../config.h"
@@ -15,6 +17,9 @@
 #define ERR_initConf4 "loaded conf file does not match original conf"
 #define ERR_checkConf1 "check failed for existing conf file"
 #define ERR_checkConf2 "could not create new conf file during the checkConfig function"
+#define ERR_cpuList1 "a valid CPU list was not read correctly"
+#define ERR_cpuList2 "a malformed CPU list was accepted"
+#define ERR_threads "auto threads did not follow the CPU list"
 
 int tests_run = 0;
 
@@ -26,9 +31,15 @@ static char *test_initConf()
 
   // create a config
   config_t *tmp = initConfig();
-  tmp->pid = 666;
   if (tmp == 0)
     return ERR_initConf1;
+  tmp->pid = 666;
+  tmp->bloom_blocked = true;
+  tmp->sketch_scale = 100;
+  tmp->ref_kmers = 18240;
+  tmp->queue_capacity = 16;
+  tmp->num_threads = 12;
+  tmp->cpu_list = strdup("0-3,8");
 
   // write it to disk
   if (writeConfig(tmp, TMP_CONFIG) != 0)
@@ -40,6 +51,18 @@ static char *test_initConf()
     return ERR_initConf3;
   if (tmp->pid != tmp2->pid)
     return ERR_initConf4;
+  if (tmp->bloom_blocked != tmp2->bloom_blocked)
+    return ERR_initConf4;
+  if (tmp->sketch_scale != tmp2->sketch_scale)
+    return ERR_initConf4;
+  if (tmp->ref_kmers != tmp2->ref_kmers)
+    return ERR_initConf4;
+  if (tmp->queue_capacity != tmp2->queue_capacity)
+    return ERR_initConf4;
+  if (tmp->num_threads != tmp2->num_threads)
+    return ERR_initConf4;
+  if (tmp2->cpu_list == NULL || strcmp(tmp->cpu_list, tmp2->cpu_list) != 0)
+    return ERR_initConf4;
 
   // clean up the test
   destroyConfig(tmp);
@@ -48,12 +71,44 @@ static char *test_initConf()
   return 0;
 }
 
+/*
+  test CPU lists are read correctly, malformed ones are rejected, and auto threads follow the list
+*/
+static char *test_cpuList()
+{
+  int *cpus;
+  int expected[] = {0, 1, 2, 3, 8, 10, 11};
+  int n = parseCPUList("0-3,8,10-11", &cpus);
+  if (n != 7 || memcmp(cpus, expected, sizeof(expected)) != 0)
+    return ERR_cpuList1;
+  free(cpus);
+  const char *bad[] = {"", ",", "1,", "3-1", "a", "1-", "-1", "1,,2", "0-99999", "1 2"};
+  int i;
+  for (i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++)
+    if (parseCPUList(bad[i], &cpus) != -1 || cpus != NULL)
+      return ERR_cpuList2;
+
+  // auto is one thread per listed CPU, or per online CPU without a list
+  config_t *tmp = initConfig();
+  if (getNumThreads(tmp) < 1)
+    return ERR_threads;
+  tmp->cpu_list = strdup("2-5");
+  if (getNumThreads(tmp) != 4)
+    return ERR_threads;
+  tmp->num_threads = 3;
+  if (getNumThreads(tmp) != 3)
+    return ERR_threads;
+  destroyConfig(tmp);
+  return 0;
+}
+
 /*
   helper function to run all the tests
 */
 static char *all_tests()
 {
   mu_run_test(test_initConf);
+  mu_run_test(test_cpuList);
   return 0;
 }
 
@@ -0,0 +1,104 @@
+#ifndef TEST_FASTQMAP
+#define TEST_FASTQMAP
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "minunit.h"
+#include "../fastqmap.h"
+
+#define TMP_FASTQ "./tmp.fastqmap.fastq"
+#define TMP_FASTQ_GZ "./tmp.fastqmap.fastq.gz"
+#define ERR_fastqMap1 "could not map the FASTQ file"
+#define ERR_fastqMap2 "record does not match the file"
+#define ERR_fastqMap3 "end of file not reported"
+#define ERR_fastqMap4 "malformed record not reported"
+#define ERR_fastqMap5 "gzipped file was mapped"
+
+int tests_run = 0;
+
+// writeFile writes a string to a file
+static void writeFile(const char *filepath, const char *contents)
+{
+  FILE *fp = fopen(filepath, "wb");
+  fputs(contents, fp);
+  fclose(fp);
+}
+
+/*
+  test records are returned as views into the mapped file
+*/
+static char *test_fastqMap()
+{
+  // two records, one with windows line endings, separated by a blank line and with no final newline
+  writeFile(TMP_FASTQ, "@read1 runid=1\nACGTN\n+\nIIIII\n\n@read2\r\nGGCC\r\n+read2\r\n!!!!");
+  fastqMap_t *fqm = fqmOpen(TMP_FASTQ);
+  if (!fqm)
+    return ERR_fastqMap1;
+  fastqRecord_t record;
+  if (fqmNext(fqm, &record) != 5 || strncmp(record.name, "read1 runid=1", record.nameLen) != 0 || strncmp(record.seq, "ACGTN", 5) != 0)
+    return ERR_fastqMap2;
+  if (fqmNext(fqm, &record) != 4 || record.nameLen != 5 || strncmp(record.seq, "GGCC", 4) != 0 || strncmp(record.qual, "!!!!", 4) != 0)
+    return ERR_fastqMap2;
+  if (fqmNext(fqm, &record) != -1)
+    return ERR_fastqMap3;
+  fqmClose(fqm);
+
+  // quality length doesn't match the sequence
+  writeFile(TMP_FASTQ, "@read1\nACGT\n+\nIII\n");
+  fqm = fqmOpen(TMP_FASTQ);
+  if (fqmNext(fqm, &record) != -2)
+    return ERR_fastqMap4;
+  fqmClose(fqm);
+
+  // empty files have no records
+  writeFile(TMP_FASTQ, "");
+  fqm = fqmOpen(TMP_FASTQ);
+  if (!fqm || fqmNext(fqm, &record) != -1)
+    return ERR_fastqMap3;
+  fqmClose(fqm);
+
+  // gzipped files are left for the gzreader
+  gzFile gz = gzopen(TMP_FASTQ_GZ, "wb");
+  gzputs(gz, "@read1\nACGT\n+\nIIII\n");
+  gzclose(gz);
+  if (fqmOpen(TMP_FASTQ_GZ) != NULL)
+    return ERR_fastqMap5;
+
+  // clean up the test
+  remove(TMP_FASTQ);
+  remove(TMP_FASTQ_GZ);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_fastqMap);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tfastqmap_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef TEST_GZREADER
+#define TEST_GZREADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "minunit.h"
+#include "../gzreader.h"
+
+#define TMP_PLAIN "./tmp.gzreader.fastq"
+#define TMP_GZIP "./tmp.gzreader.fastq.gz"
+#define TMP_BGZF "./tmp.gzreader.bgzf.fastq.gz"
+#define DATA_SIZE 1000000
+#define BGZF_INPUT_SIZE 65280
+#define ERR_gzreader1 "could not set up the test files"
+#define ERR_gzreader2 "could not open the file"
+#define ERR_gzreader3 "decompressed data does not match the original"
+#define ERR_gzreader4 "BGZF was not detected"
+#define ERR_gzreader5 "corrupt BGZF block was not reported"
+
+int tests_run = 0;
+
+// putLE writes a little endian integer
+static void putLE(unsigned char *buf, uint32_t x, int n)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    buf[i] = (x >> (8 * i)) & 0xff;
+}
+
+// writeBGZF writes data as BGZF blocks, followed by the empty EOF block
+static int writeBGZF(const char *filepath, const char *data, int len)
+{
+  FILE *fp = fopen(filepath, "wb");
+  if (!fp)
+    return 1;
+  unsigned char block[65536];
+  int start = 0;
+  do
+  {
+    int n = len - start < BGZF_INPUT_SIZE ? len - start : BGZF_INPUT_SIZE;
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in = (unsigned char *)data + start;
+    zs.avail_in = n;
+    zs.next_out = block + 18;
+    zs.avail_out = sizeof(block) - 26;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+      return 1;
+    int clen = zs.total_out;
+    deflateEnd(&zs);
+    unsigned char header[18] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0};
+    putLE(header + 16, clen + 25, 2);
+    memcpy(block, header, 18);
+    putLE(block + 18 + clen, crc32(crc32(0L, Z_NULL, 0), (unsigned char *)data + start, n), 4);
+    putLE(block + 22 + clen, n, 4);
+    fwrite(block, 1, clen + 26, fp);
+    start += n;
+  } while (start < len);
+  fclose(fp);
+  return 0;
+}
+
+// readAll decompresses a file with the gzreader and checks it against the original
+static char *readAll(const char *filepath, const char *data, int len, bool bgzf)
+{
+  gzReader_t *reader = gzrOpen(filepath, 3, NULL, 0);
+  if (!reader)
+    return ERR_gzreader2;
+  if (gzrIsBGZF(reader) != bgzf)
+    return ERR_gzreader4;
+  char *buf = malloc(len + 1000);
+  int got = 0, n;
+  while ((n = gzrRead(reader, buf + got, 999)) > 0)
+    got += n;
+  gzrClose(reader);
+  if (n != 0 || got != len || memcmp(buf, data, len) != 0)
+    return ERR_gzreader3;
+  free(buf);
+  return 0;
+}
+
+/*
+  test plain, gzipped and BGZF files all decompress to the original
+*/
+static char *test_gzreader()
+{
+  char *data = malloc(DATA_SIZE);
+  int i;
+  srand(42);
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = (i % 61 == 60) ? '\n' : "ACGT"[rand() % 4];
+
+  // uncompressed
+  FILE *fp = fopen(TMP_PLAIN, "wb");
+  if (!fp)
+    return ERR_gzreader1;
+  fwrite(data, 1, DATA_SIZE, fp);
+  fclose(fp);
+
+  // multi-member gzip
+  gzFile gz = gzopen(TMP_GZIP, "wb");
+  gzwrite(gz, data, DATA_SIZE / 2);
+  gzclose(gz);
+  gz = gzopen(TMP_GZIP, "ab");
+  gzwrite(gz, data + DATA_SIZE / 2, DATA_SIZE - DATA_SIZE / 2);
+  gzclose(gz);
+
+  // BGZF
+  if (writeBGZF(TMP_BGZF, data, DATA_SIZE) != 0 || writeBGZF(TMP_BGZF ".eof", "", 0) != 0)
+    return ERR_gzreader1;
+  fp = fopen(TMP_BGZF, "ab");
+  FILE *eof = fopen(TMP_BGZF ".eof", "rb");
+  unsigned char eofBlock[64];
+  fwrite(eofBlock, 1, fread(eofBlock, 1, sizeof(eofBlock), eof), fp);
+  fclose(eof);
+  fclose(fp);
+
+  char *err;
+  if ((err = readAll(TMP_PLAIN, data, DATA_SIZE, false)))
+    return err;
+  if ((err = readAll(TMP_GZIP, data, DATA_SIZE, false)))
+    return err;
+  if ((err = readAll(TMP_BGZF, data, DATA_SIZE, true)))
+    return err;
+
+  // corrupt a BGZF block
+  fp = fopen(TMP_BGZF, "r+b");
+  fseek(fp, 100000, SEEK_SET);
+  fputc(fgetc(fp) ^ 0xff, fp);
+  fclose(fp);
+  gzReader_t *reader = gzrOpen(TMP_BGZF, 3, NULL, 0);
+  char buf[4096];
+  int n;
+  while ((n = gzrRead(reader, buf, sizeof(buf))) > 0)
+    ;
+  gzrClose(reader);
+  if (n != -1)
+    return ERR_gzreader5;
+
+  // clean up the test
+  free(data);
+  remove(TMP_PLAIN);
+  remove(TMP_GZIP);
+  remove(TMP_BGZF);
+  remove(TMP_BGZF ".eof");
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_gzreader);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tgzreader_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
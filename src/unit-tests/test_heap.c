@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "minunit.h"
 #include "../heap.c"
@@ -12,6 +13,8 @@
 #define ERR_initHeap3 "could not destroy the heap"
 #define ERR_minHeap1 "heap not printed"
 #define ERR_minHeap2 "heap not min sorted"
+#define ERR_minHeap3 "heap not full"
+#define ERR_bottomK "heap did not keep the bottom-k values"
 #define ERR_alloc "could not allocate"
 
 int tests_run = 0;
@@ -23,29 +26,38 @@ static char *test_initHeap()
 {
 
   // create a heap with one minimum
-  node_t *testHeap;
+  heap_t *testHeap;
   uint64_t minimum = 1234;
-  testHeap = initHeap(minimum);
+  testHeap = initHeap(4);
+  if (!testHeap)
+  {
+    return ERR_alloc;
+  }
+  if (!isEmpty(testHeap))
+  {
+    return ERR_initHeap1;
+  }
+  push(testHeap, minimum);
 
   // check the heap was created and has a node in it
-  if (isEmpty(&testHeap))
+  if (isEmpty(testHeap) || heapSize(testHeap) != 1)
   {
     return ERR_initHeap1;
   }
 
   // check the node holds the right value
-  if (peek(&testHeap) != minimum)
+  if (peek(testHeap) != minimum)
   {
     return ERR_initHeap2;
   }
 
-  // check the heap can be destroyed
-  destroy(&testHeap);
-  if (!isEmpty(&testHeap))
+  // check the heap can be reset
+  resetHeap(testHeap);
+  if (!isEmpty(testHeap))
   {
     return ERR_initHeap3;
   }
-
+  destroy(testHeap);
   return 0;
 }
 
@@ -55,41 +67,95 @@ static char *test_initHeap()
 static char *test_minHeap()
 {
   uint64_t valA = 1234, valB = 1, valC = 42;
-  node_t *testHeap = initHeap(valA);
-  push(&testHeap, valB);
-  push(&testHeap, valC);
+  heap_t *testHeap = initHeap(3);
+  if (!testHeap)
+  {
+    return ERR_alloc;
+  }
+  push(testHeap, valA);
+  push(testHeap, valB);
+  push(testHeap, valC);
+  if (!isFull(testHeap))
+  {
+    return ERR_minHeap3;
+  }
 
-  // check the heap can be printed and is in order
+  // check the heap can be printed and contains every value, with the largest first
   uint64_t *heapValues = calloc(3, sizeof(uint64_t));
   if (!heapValues)
   {
     return ERR_alloc;
   }
-  getSketch(&testHeap, 3, heapValues);
-  if (heapValues[0] != valA || heapValues[1] != valC || heapValues[2] != valB)
+  if (getSketch(testHeap, heapValues) != 3)
+    return ERR_minHeap1;
+  if (heapValues[0] != valA || (heapValues[1] + heapValues[2]) != (valB + valC))
     return ERR_minHeap1;
   free(heapValues);
 
   // check the peek, pop and destroy functions
-  if (peek(&testHeap) != valA)
+  if (peek(testHeap) != valA)
   {
     return ERR_minHeap2;
   }
-  pop(&testHeap);
-  if (peek(&testHeap) != valC)
+  pop(testHeap);
+  if (peek(testHeap) != valC)
   {
     return ERR_minHeap2;
   }
-  pop(&testHeap);
-  if (peek(&testHeap) != valB)
+  pop(testHeap);
+  if (peek(testHeap) != valB)
   {
     return ERR_minHeap2;
   }
-  destroy(&testHeap);
-  if (!isEmpty(&testHeap))
+  pop(testHeap);
+  if (!isEmpty(testHeap))
   {
     return ERR_initHeap3;
   }
+  destroy(testHeap);
+  return 0;
+}
+
+/*
+  test the heap keeps the bottom-k values when the top is replaced
+*/
+static char *test_bottomK()
+{
+  int k = 16, i;
+  uint64_t val;
+  heap_t *testHeap = initHeap(k);
+  if (!testHeap)
+  {
+    return ERR_alloc;
+  }
+
+  // stream 1000 values in descending order, keeping the smallest k
+  for (val = 1000; val > 0; val--)
+  {
+    if (!isFull(testHeap))
+    {
+      push(testHeap, val);
+    }
+    else if (val < peek(testHeap))
+    {
+      replaceTop(testHeap, val);
+    }
+  }
+  if (peek(testHeap) != (uint64_t)k)
+  {
+    return ERR_bottomK;
+  }
+
+  // popping should now return k, k-1 ... 1
+  for (i = k; i > 0; i--)
+  {
+    if (peek(testHeap) != (uint64_t)i)
+    {
+      return ERR_bottomK;
+    }
+    pop(testHeap);
+  }
+  destroy(testHeap);
   return 0;
 }
 
@@ -100,6 +166,7 @@ static char *all_tests()
 {
   mu_run_test(test_initHeap);
   mu_run_test(test_minHeap);
+  mu_run_test(test_bottomK);
   return 0;
 }
 
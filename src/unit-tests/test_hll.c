@@ -0,0 +1,139 @@
+#ifndef TEST_HLL
+#define TEST_HLL
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "minunit.h"
+#include "../hll.h"
+
+#define NUM_THREADS 4
+#define ERR_alloc "could not allocate"
+#define ERR_hll1 "empty HyperLogLog should estimate 0"
+#define ERR_hll2 "HyperLogLog estimate is too far from the true count"
+#define ERR_hll3 "duplicates changed the HyperLogLog estimate"
+#define ERR_hll4 "shared HyperLogLog lost updates"
+
+int tests_run = 0;
+
+// hashedKmer makes a hashed k-mer in the same form as the sketcher (hash << 8 | k) for a small k
+static uint64_t hashedKmer(uint64_t i)
+{
+  return (i * 0x9E3779B97F4A7C15ULL & ((1ULL << 42) - 1)) << 8 | 21;
+}
+
+/*
+  test the estimates are within a few standard errors over a range of counts
+*/
+static char *test_hllEstimate()
+{
+  long counts[] = {10, 1000, 50000, 2000000};
+  int c;
+  for (c = 0; c < 4; c++)
+  {
+    hll_t *hll = hllInit(HLL_PRECISION);
+    if (!hll)
+      return ERR_alloc;
+    if (hllEstimate(hll) != 0.0)
+      return ERR_hll1;
+    long i;
+    for (i = 0; i < counts[c]; i++)
+      hllAdd(hll, hashedKmer(i));
+    double estimate = hllEstimate(hll);
+    if (fabs(estimate - counts[c]) > 0.03 * counts[c] + 1)
+      return ERR_hll2;
+
+    // adding everything again should not change anything
+    for (i = 0; i < counts[c]; i++)
+      hllAdd(hll, hashedKmer(i));
+    if (hllEstimate(hll) != estimate)
+      return ERR_hll3;
+    hllDestroy(hll);
+  }
+  return 0;
+}
+
+// hllWorker_t is a slice of the k-mers for one thread
+typedef struct hllWorker
+{
+  hll_t *hll;
+  long start;
+  long end;
+} hllWorker_t;
+
+static void *addRange(void *arg)
+{
+  hllWorker_t *w = arg;
+  long i;
+  for (i = w->start; i < w->end; i++)
+    hllAdd(w->hll, hashedKmer(i));
+  return NULL;
+}
+
+/*
+  test threads sharing a HyperLogLog give the same registers as a single thread
+*/
+static char *test_hllShared()
+{
+  long n = 1000000;
+  int t, i;
+  hll_t *shared = hllInit(HLL_PRECISION), *single = hllInit(HLL_PRECISION);
+  if (!shared || !single)
+    return ERR_alloc;
+  pthread_t threads[NUM_THREADS];
+  hllWorker_t workers[NUM_THREADS];
+  for (t = 0; t < NUM_THREADS; t++)
+  {
+    workers[t].hll = shared;
+    workers[t].start = t * n / NUM_THREADS;
+    workers[t].end = (t + 1) * n / NUM_THREADS;
+    pthread_create(&threads[t], NULL, addRange, &workers[t]);
+  }
+  hllWorker_t all = {single, 0, n};
+  addRange(&all);
+  for (t = 0; t < NUM_THREADS; t++)
+    pthread_join(threads[t], NULL);
+  for (i = 0; i < single->m; i++)
+  {
+    if (shared->registers[i] != single->registers[i])
+      return ERR_hll4;
+  }
+  hllDestroy(shared);
+  hllDestroy(single);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_hllEstimate);
+  mu_run_test(test_hllShared);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\thll_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
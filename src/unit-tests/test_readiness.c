@@ -0,0 +1,195 @@
+#ifndef TEST_READINESS
+#define TEST_READINESS
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../bloom.h"
+#include "../readiness.h"
+#include "../slog.h"
+#include "../watcher.h"
+#include "../workerpool.h"
+
+#define TMP_FASTQ1 "./tmp.readiness1.fastq"
+#define TMP_FASTQ2 "./tmp.readiness2.fastq"
+#define TMP_FASTQ3 "./tmp.readiness3.fastq"
+#define QUIET_MS 200
+#define ERR_readiness1 "could not set up the readiness stage"
+#define ERR_readiness2 "complete file was not dispatched exactly once"
+#define ERR_readiness3 "pending file was dispatched while still changing"
+#define ERR_readiness4 "pending file was not dispatched exactly once after going quiet"
+#define ERR_readiness5 "files were not held back while the workerpool queue was full"
+#define ERR_readiness6 "held back files were not dispatched once the workerpool queue had room"
+
+int tests_run = 0;
+
+static volatile int gateOpen;
+static volatile int gateWaiting;
+
+// gateJob holds a worker until the gate is opened
+static void gateJob(void *arg)
+{
+  __atomic_add_fetch(&gateWaiting, 1, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&gateOpen, __ATOMIC_SEQ_CST))
+    usleep(1000);
+}
+
+// writeRead appends a FASTQ read to a file
+static void writeRead(const char *filepath)
+{
+  FILE *fp = fopen(filepath, "a");
+  fprintf(fp, "@read\nACGTACGTAAACCCGGGTTT\n+\nIIIIIIIIIIIIIIIIIIII\n");
+  fclose(fp);
+}
+
+/*
+  test files are only dispatched once, and only once they have been written
+*/
+static char *test_readiness()
+{
+  struct bloom bf;
+  if (bloom_init(&bf, 1000, 0.01) != 0)
+    return ERR_readiness1;
+  watcherArgs_t wargs;
+  wargs.stats = NULL;
+  wargs.checkpoint = NULL;
+  wargs.numCpus = 0;
+  wargs.bloomFilter = &bf;
+  wargs.k_size = 7;
+  wargs.sketch_size = 16;
+  wargs.sketch_scale = 0;
+  wargs.ref_kmers = 1000;
+  wargs.fp_rate = 0.01;
+  wargs.workerPool = tpool_create(2);
+  readiness_t *readiness = readinessInit(&wargs, QUIET_MS);
+  if (readiness == NULL)
+    return ERR_readiness1;
+
+  // a complete file is dispatched straight away, and repeated events are ignored
+  writeRead(TMP_FASTQ1);
+  readinessNotify(readiness, TMP_FASTQ1, true);
+  readinessNotify(readiness, TMP_FASTQ1, true);
+  readinessNotify(readiness, TMP_FASTQ1, false);
+  if (readinessDispatched(readiness) != 1)
+    return ERR_readiness2;
+
+  // a pending file is held back while it keeps changing
+  int i;
+  for (i = 0; i < 5; i++)
+  {
+    writeRead(TMP_FASTQ2);
+    readinessNotify(readiness, TMP_FASTQ2, false);
+    usleep(QUIET_MS * 1000 / 2);
+  }
+  if (readinessDispatched(readiness) != 1)
+    return ERR_readiness3;
+
+  // and is dispatched once it goes quiet
+  usleep(QUIET_MS * 1000 * 3);
+  readinessNotify(readiness, TMP_FASTQ2, true);
+  if (readinessDispatched(readiness) != 2)
+    return ERR_readiness4;
+
+  // clean up the test
+  readinessDestroy(readiness);
+  tpool_wait(wargs.workerPool);
+  tpool_destroy(wargs.workerPool);
+  bloom_free(&bf);
+  remove(TMP_FASTQ1);
+  remove(TMP_FASTQ2);
+  return 0;
+}
+
+/*
+  test files are held back while the workerpool queue is full, and sent on in order once it has room
+*/
+static char *test_backpressure()
+{
+  struct bloom bf;
+  if (bloom_init(&bf, 1000, 0.01) != 0)
+    return ERR_readiness1;
+  watcherArgs_t wargs;
+  wargs.stats = NULL;
+  wargs.checkpoint = NULL;
+  wargs.numCpus = 0;
+  wargs.bloomFilter = &bf;
+  wargs.k_size = 7;
+  wargs.sketch_size = 16;
+  wargs.sketch_scale = 0;
+  wargs.ref_kmers = 1000;
+  wargs.fp_rate = 0.01;
+  wargs.workerPool = tpool_create_bounded(2, 1);
+  readiness_t *readiness = readinessInit(&wargs, QUIET_MS);
+  if (readiness == NULL)
+    return ERR_readiness1;
+
+  // keep both workers busy, so the queue fills after one file
+  gateOpen = 0;
+  gateWaiting = 0;
+  tpool_add_work(wargs.workerPool, gateJob, NULL);
+  tpool_add_work(wargs.workerPool, gateJob, NULL);
+  while (gateWaiting != 2)
+    usleep(1000);
+  writeRead(TMP_FASTQ1);
+  writeRead(TMP_FASTQ2);
+  writeRead(TMP_FASTQ3);
+  readinessNotify(readiness, TMP_FASTQ1, true);
+  readinessNotify(readiness, TMP_FASTQ2, true);
+  readinessNotify(readiness, TMP_FASTQ3, true);
+  readinessNotify(readiness, TMP_FASTQ3, true);
+  if (readinessDispatched(readiness) != 1 || readinessDeferred(readiness) != 2)
+    return ERR_readiness5;
+  if (tpool_high_water(wargs.workerPool) != 1)
+    return ERR_readiness5;
+
+  // open the gate and the held back files follow
+  gateOpen = 1;
+  int i;
+  for (i = 0; i < 100 && readinessDispatched(readiness) != 3; i++)
+    usleep(READINESS_RETRY_MS * 1000);
+  if (readinessDispatched(readiness) != 3 || readinessDeferred(readiness) != 0)
+    return ERR_readiness6;
+
+  // clean up the test
+  readinessDestroy(readiness);
+  tpool_wait(wargs.workerPool);
+  tpool_destroy(wargs.workerPool);
+  bloom_free(&bf);
+  remove(TMP_FASTQ1);
+  remove(TMP_FASTQ2);
+  remove(TMP_FASTQ3);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_readiness);
+  mu_run_test(test_backpressure);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\treadiness_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
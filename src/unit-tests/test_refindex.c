@@ -0,0 +1,115 @@
+#ifndef TEST_REFINDEX
+#define TEST_REFINDEX
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "minunit.h"
+#include "../bloom.h"
+#include "../config.h"
+#include "../refindex.h"
+
+#define TMP_REF "./tmp.ref.fasta"
+#define TMP_INDEX "./tmp.ref.index"
+#define ERR_refIndex1 "could not set up the test reference"
+#define ERR_refIndex2 "could not write the reference index"
+#define ERR_refIndex3 "could not load the reference index"
+#define ERR_refIndex4 "loaded bloom filter does not match the original"
+#define ERR_refIndex5 "stale reference index was loaded"
+
+int tests_run = 0;
+
+/*
+  test the reference index can be written, mapped and invalidated
+*/
+static char *test_refIndex()
+{
+  int types[] = {BLOOM_STANDARD, BLOOM_BLOCKED}, t;
+  for (t = 0; t < 2; t++)
+  {
+
+    // write a white list and build a bloom filter for it
+    FILE *fp = fopen(TMP_REF, "w");
+    if (!fp)
+      return ERR_refIndex1;
+    fprintf(fp, ">ref\nACGTACGTAAACCCGGGTTT\n");
+    fclose(fp);
+    config_t *conf = initConfig();
+    conf->white_list = strdup(TMP_REF);
+    conf->bloom_blocked = (types[t] == BLOOM_BLOCKED);
+    struct bloom bf;
+    if (bloom_init_type(&bf, conf->bloom_max_elements, conf->bloom_fp_rate, types[t]) != 0)
+      return ERR_refIndex1;
+    uint64_t i;
+    for (i = 0; i < 1000; i++)
+      bloom_add_hash(&bf, i << 8 | 7);
+    bloom_freeze(&bf);
+    conf->ref_kmers = 1000;
+    if (writeRefIndex(TMP_INDEX, conf, &bf) != 0)
+      return ERR_refIndex2;
+
+    // map it back in and check it gives the same answers (and the same k-mer count)
+    struct bloom mapped;
+    conf->ref_kmers = 0;
+    if (loadRefIndex(TMP_INDEX, conf, &mapped) != 0)
+      return ERR_refIndex3;
+    if (!mapped.frozen || mapped.bytes != bf.bytes || mapped.hashes != bf.hashes || conf->ref_kmers != 1000)
+      return ERR_refIndex4;
+    for (i = 0; i < 2000; i++)
+    {
+      if (bloom_check_hash(&mapped, i << 8 | 7) != bloom_check_hash(&bf, i << 8 | 7))
+        return ERR_refIndex4;
+    }
+    bloom_free(&mapped);
+
+    // changing the settings or the white list should make the index stale
+    conf->k_size++;
+    if (loadRefIndex(TMP_INDEX, conf, &mapped) == 0)
+      return ERR_refIndex5;
+    conf->k_size--;
+    fp = fopen(TMP_REF, "a");
+    fprintf(fp, ">ref2\nACGTACGTAAACCCGGGTTTA\n");
+    fclose(fp);
+    if (loadRefIndex(TMP_INDEX, conf, &mapped) == 0)
+      return ERR_refIndex5;
+
+    // clean up the test
+    bloom_free(&bf);
+    destroyConfig(conf);
+    remove(TMP_REF);
+    remove(TMP_INDEX);
+  }
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_refIndex);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\trefindex_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
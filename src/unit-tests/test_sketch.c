@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "minunit.h"
 #include "../sketch.c"
@@ -11,18 +13,33 @@
 #include "../heap.c"
 #include "../bloom.c"
 #include "../murmurhash2.c"
+#include "../seqpack.c"
+#include "../kmerhash.c"
 
 #define ERR_sketchRead1 "could not sketch read"
+#define ERR_sketchRead2 "sketch contains duplicate values"
 #define ERR_initHashMap1 "hashmap was overfilled"
 #define ERR_initHashMap2 "value not added to hashmap"
 #define ERR_initHashMap3 "value not found in map prior to delete from hashmap"
 #define ERR_initHashMap4 "hashmap did not empty"
+#define ERR_initHashMap5 "hashmap capacity is too small"
+#define ERR_initHashMap6 "value lost when growing the hashmap"
 #define ERR_bloomfilter "could not init bloom filter"
 #define ERR_bloomfilter1 "bf should read false for any check when no elements have been added yet"
 #define ERR_bloomfilter2 "bf should not produce false negatives"
 #define ERR_bloomfilter3 "bf has returned a false positive (which does happen...)"
+#define ERR_bloomfilter4 "bf false positive rate is too high for hashed k-mers"
+#define ERR_bloomfilter5 "frozen bf should refuse adds but allow checks"
 #define ERR_sketch1 "bf did not return k-mer known to be in the sequence (fn)"
 #define ERR_sketch2 "bf returned k-mer known to not be in the sequence (fp)"
+#define ERR_sketch3 "sketch does not match the brute force bottom k"
+#define ERR_sketch4 "scaled sketch does not match the brute force hashes under the threshold"
+#define ERR_sketch5 "k > 31 sketch does not match the brute force hashes"
+#define ERR_sketch6 "specialised k-mer loop does not match the generic loop"
+#define ERR_seqpack1 "scalar packing does not match the lookup table"
+#define ERR_seqpack2 "AVX2 packing does not match scalar packing"
+#define ERR_kmerhash1 "batched hashes do not match hash64"
+#define ERR_kmerhash2 "filtered hashes do not match the threshold"
 #define ERR_alloc "could not allocate"
 
 int tests_run = 0;
@@ -51,77 +68,568 @@ unsigned int jenkins(const void *_str)
 static char *test_hashmap()
 {
 
-  // create a hashmap and fill it to capacity
-  uint64_t i;
-  for (i = 0; i < HASHMAP_SIZE; i++)
+  // create a hashmap and fill it to capacity (one slot is always left empty)
+  hashmap_t *hm = hmInit(128);
+  if (!hm)
   {
-    if (!hmInsert(i))
+    return ERR_alloc;
+  }
+  uint64_t i, capacity = hmCapacity(hm);
+  if (capacity < 256)
+  {
+    return ERR_initHashMap5;
+  }
+  for (i = 0; i < capacity - 1; i++)
+  {
+    if (!hmInsert(hm, i << 8))
     {
       return ERR_initHashMap2;
     }
   }
 
   // make sure hashmap can't be overfilled
-  if (hmInsert(HASHMAP_SIZE))
+  if (hmInsert(hm, capacity << 8))
   {
     return ERR_initHashMap1;
   }
 
   // check that the values are in the map
-  for (i = 0; i < HASHMAP_SIZE; i++)
+  for (i = 0; i < capacity - 1; i++)
   {
-    if (!hmSearch(i))
+    if (!hmSearch(hm, i << 8))
     {
-      return ERR_initHashMap2;
+      return ERR_initHashMap3;
+    }
+  }
+
+  // delete every other value and check the probe chains still find the rest
+  for (i = 0; i < capacity - 1; i += 2)
+  {
+    hmDelete(hm, i << 8);
+  }
+  for (i = 0; i < capacity - 1; i++)
+  {
+    if (hmSearch(hm, i << 8) != (i % 2 == 1))
+    {
+      return ERR_initHashMap3;
     }
   }
 
-  // delete values from the hashmap
-  for (i = 0; i < HASHMAP_SIZE; i++)
+  // delete the remaining values
+  for (i = 1; i < capacity - 1; i += 2)
   {
-    hmDelete(i);
+    hmDelete(hm, i << 8);
   }
 
   // check the hashmap is empty now all values were deleted
-  for (i = 0; i < HASHMAP_SIZE; i++)
+  for (i = 0; i < capacity - 1; i++)
   {
-    if (hmSearch(i))
+    if (hmSearch(hm, i << 8))
     {
       return ERR_initHashMap4;
     }
   }
-  hmDestroy();
+
+  // check a clear empties the hashmap
+  for (i = 0; i < 100; i++)
+  {
+    hmInsert(hm, i);
+  }
+  hmClear(hm);
+  for (i = 0; i < 100; i++)
+  {
+    if (hmSearch(hm, i))
+    {
+      return ERR_initHashMap4;
+    }
+  }
+
+  // check growing keeps the current values but not the cleared ones
+  for (i = 100; i < 200; i++)
+  {
+    hmInsert(hm, i);
+  }
+  if (hmGrow(hm, 1000) != 0 || hmCapacity(hm) < 2000 || hmCount(hm) != 100)
+  {
+    return ERR_initHashMap5;
+  }
+  for (i = 0; i < 200; i++)
+  {
+    if (hmSearch(hm, i) != (i >= 100))
+    {
+      return ERR_initHashMap6;
+    }
+  }
+  hmDestroy(hm);
   return 0;
 }
 
+// nt4 is the lookup table used to check the packed codes (4 is not A/C/G/T/U)
+static int nt4(char c)
+{
+  switch (c | 0x20)
+  {
+  case 'a':
+    return 0;
+  case 'c':
+    return 1;
+  case 'g':
+    return 2;
+  case 't':
+  case 'u':
+    return 3;
+  default:
+    return 4;
+  }
+}
+
+// randomSeq fills a sequence with mixed case bases and the odd N or other character
+static void randomSeq(char *seq, int len, uint64_t *state)
+{
+  int i;
+  for (i = 0; i < len; i++)
+  {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    int r = *state >> 56;
+    seq[i] = r < 4 ? "Nn-@"[r] : "ACGTacgtUu"[r % 10];
+  }
+}
+
+// spreadMask widens an N-mask to cover both bits of each base
+static uint64_t spreadMask(uint32_t nmask)
+{
+  uint64_t spread = 0;
+  int i;
+  for (i = 0; i < 32; i++)
+    spread |= (uint64_t)(nmask >> i & 1) * 3 << (2 * i);
+  return spread;
+}
+
 /*
-  test the bloom filter
+  test the 2-bit packing against a lookup table, for every length up to a few blocks
 */
-static char *test_bloomfilter()
+static char *test_seqpack()
 {
-  char *testString1 = "hello, world!";
-  char *testString2 = "world, hello!";
-  int testStringLen = 13;
+  char seq[200];
+  uint64_t packed[8], packed2[8], state = 7;
+  uint32_t nmask[8], nmask2[8];
+  int len, i;
+  for (len = 1; len < 200; len++)
+  {
+    randomSeq(seq, len, &state);
+    seqpackScalar(seq, len, packed, nmask);
+    for (i = 0; i < len; i++)
+    {
+      int code = packed[i / SEQPACK_BLOCK] >> (2 * (i % SEQPACK_BLOCK)) & 3;
+      int n = nmask[i / SEQPACK_BLOCK] >> (i % SEQPACK_BLOCK) & 1;
+      if (n != (nt4(seq[i]) == 4) || (!n && code != nt4(seq[i])))
+      {
+        return ERR_seqpack1;
+      }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+      seqpackAVX2(seq, len, packed2, nmask2);
+      for (i = 0; i < seqpackWords(len); i++)
+      {
+        uint64_t used = (len - i * SEQPACK_BLOCK >= SEQPACK_BLOCK) ? ~0ULL : (1ULL << 2 * (len - i * SEQPACK_BLOCK)) - 1;
+        if (nmask[i] != nmask2[i] || ((packed[i] ^ packed2[i]) & used & ~spreadMask(nmask[i])))
+        {
+          return ERR_seqpack2;
+        }
+      }
+    }
+#endif
+  }
+  return 0;
+}
 
-  struct bloom bloom;
-  if (bloom_init(&bloom, 1000000, 0.01) != 0)
+// checkKernels runs a pair of batched kernels against hash64 and a plain threshold check
+static char *checkKernels(hashBatchFunc_t hash, filterBelowFunc_t filter)
+{
+  uint64_t kmers[KMERHASH_BATCH], hashes[KMERHASH_BATCH], state = 3;
+  int idx[KMERHASH_BATCH], k, n, i;
+  for (k = 1; k <= 31; k += 5)
   {
-    return ERR_bloomfilter;
+    uint64_t mask = (1ULL << 2 * k) - 1;
+    for (n = 0; n <= KMERHASH_BATCH; n += 37)
+    {
+      for (i = 0; i < n; i++)
+      {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        kmers[i] = state & mask;
+      }
+      hash(kmers, n, mask, k, hashes);
+      for (i = 0; i < n; i++)
+      {
+        if (hashes[i] != (hash64(kmers[i], mask) << 8 | k))
+        {
+          return ERR_kmerhash1;
+        }
+      }
+
+      // use the middle hash as the threshold, so about half are below it (including some with the top bit set)
+      uint64_t threshold = n ? hashes[n / 2] : 0;
+      int m = filter(hashes, n, threshold, idx), j = 0;
+      for (i = 0; i < n; i++)
+      {
+        if (hashes[i] < threshold && (j >= m || idx[j++] != i))
+        {
+          return ERR_kmerhash2;
+        }
+      }
+      if (j != m)
+      {
+        return ERR_kmerhash2;
+      }
+    }
   }
-  if (bloom_check(&bloom, testString1, testStringLen))
+  return 0;
+}
+
+/*
+  test the batched hash and filter kernels which the CPU supports
+*/
+static char *test_kmerhash()
+{
+  char *err = checkKernels(hash64BatchScalar, filterBelowScalar);
+#if defined(__x86_64__) || defined(__i386__)
+  if (!err && __builtin_cpu_supports("avx2"))
   {
-    return ERR_bloomfilter1;
+    err = checkKernels(hash64BatchAVX2, filterBelowAVX2);
   }
-  bloom_add(&bloom, testString1, testStringLen);
-  if (!bloom_check(&bloom, testString1, testStringLen))
+  if (!err && __builtin_cpu_supports("avx512f"))
   {
-    return ERR_bloomfilter2;
+    err = checkKernels(hash64BatchAVX512, filterBelowAVX512);
   }
-  if (bloom_check(&bloom, testString2, testStringLen))
+#endif
+  return err;
+}
+
+// compareHashes sorts hashed k-mers
+static int compareHashes(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+  test the sketch holds the bottom k of every valid k-mer window, found by brute force
+*/
+// bruteForceHashes hashes every window of k valid bases and returns the number of distinct hashed k-mers (sorted into all)
+static int bruteForceHashes(const char *seq, int seqLen, int kSize, uint64_t *all)
+{
+  uint64_t mask = kSize < 32 ? (1ULL << 2 * kSize) - 1 : UINT64_MAX;
+  int numAll = 0, numDistinct = 0, i, j;
+  for (i = 0; i + kSize <= seqLen; i++)
   {
-    return ERR_bloomfilter3;
+    unsigned __int128 fwd = 0, rev = 0;
+    for (j = 0; j < kSize && nt4(seq[i + j]) < 4; j++)
+    {
+      fwd = fwd << 2 | nt4(seq[i + j]);
+      rev |= (unsigned __int128)(3 - nt4(seq[i + j])) << (2 * j);
+    }
+    if (j == kSize && fwd != rev)
+    {
+      unsigned __int128 canon = fwd < rev ? fwd : rev;
+      uint64_t hash = kSize < 32 ? hash64((uint64_t)canon, mask) : hash128((uint64_t)canon, (uint64_t)(canon >> 64));
+      all[numAll++] = hash << 8 | kSize;
+    }
+  }
+  qsort(all, numAll, sizeof(uint64_t), compareHashes);
+  for (i = 0; i < numAll; i++)
+  {
+    if (numDistinct == 0 || all[i] != all[numDistinct - 1])
+    {
+      all[numDistinct++] = all[i];
+    }
+  }
+  return numDistinct;
+}
+
+static char *test_sketchKmers()
+{
+  int seqLen = 5000, kSize = 15, sketchSize = 200;
+  uint64_t state = 11;
+  char *seq = malloc(seqLen);
+  uint64_t *all = malloc(seqLen * sizeof(uint64_t));
+  if (!seq || !all)
+  {
+    return ERR_alloc;
+  }
+  randomSeq(seq, seqLen, &state);
+  sketcher_t *sketcher = initSketcher(kSize, sketchSize);
+  int sketchLength = sketchSequence(sketcher, seq, seqLen, NULL);
+
+  // take the distinct bottom k and compare with the sketch
+  int numDistinct = bruteForceHashes(seq, seqLen, kSize, all);
+  int expected = numDistinct < sketchSize ? numDistinct : sketchSize;
+  qsort(sketcher->sketch, sketchLength, sizeof(uint64_t), compareHashes);
+  if (sketchLength != expected || memcmp(sketcher->sketch, all, expected * sizeof(uint64_t)) != 0)
+  {
+    return ERR_sketch3;
+  }
+  destroySketcher(sketcher);
+  free(seq);
+  free(all);
+  return 0;
+}
+
+/*
+  test the 128-bit kernel for k > 31, with both KMV and scaled sketches
+*/
+static char *test_longKmers()
+{
+  int seqLen = 20000, sketchSize = 200, kSizes[] = {32, 45, 63}, s;
+  uint64_t state = 99;
+  char *seq = malloc(seqLen);
+  uint64_t *all = malloc(seqLen * sizeof(uint64_t));
+  if (!seq || !all)
+  {
+    return ERR_alloc;
+  }
+  randomSeq(seq, seqLen, &state);
+  for (s = 0; s < 3; s++)
+  {
+    int numDistinct = bruteForceHashes(seq, seqLen, kSizes[s], all);
+
+    // the KMV sketch should be the bottom k
+    sketcher_t *sketcher = initSketcher(kSizes[s], sketchSize);
+    if (!sketcher)
+    {
+      return ERR_alloc;
+    }
+    int sketchLength = sketchSequence(sketcher, seq, seqLen, NULL);
+    int expected = numDistinct < sketchSize ? numDistinct : sketchSize;
+    qsort(sketcher->sketch, sketchLength, sizeof(uint64_t), compareHashes);
+    if (expected == 0 || sketchLength != expected || memcmp(sketcher->sketch, all, expected * sizeof(uint64_t)) != 0)
+    {
+      return ERR_sketch5;
+    }
+    destroySketcher(sketcher);
+
+    // the scaled sketch should be everything under the threshold
+    sketcher = initScaledSketcher(kSizes[s], 20);
+    if (!sketcher)
+    {
+      return ERR_alloc;
+    }
+    sketchLength = sketchSequence(sketcher, seq, seqLen, NULL);
+    for (expected = 0; expected < numDistinct && all[expected] < sketcher->threshold; expected++)
+      ;
+    if (expected == 0 || sketchLength != expected || memcmp(sketcher->sketch, all, expected * sizeof(uint64_t)) != 0)
+    {
+      return ERR_sketch5;
+    }
+    destroySketcher(sketcher);
+  }
+  free(seq);
+  free(all);
+  return 0;
+}
+
+/*
+  test the specialised k-mer loops give the same sketches as the generic loop
+*/
+static char *test_kmerLoops()
+{
+  int seqLen = 20000, kSizes[] = {7, 15, 21, 31}, s;
+  uint64_t state = 5;
+  char *seq = malloc(seqLen);
+  uint64_t *specialised = malloc(seqLen * sizeof(uint64_t));
+  if (!seq || !specialised)
+  {
+    return ERR_alloc;
+  }
+  randomSeq(seq, seqLen, &state);
+  for (s = 0; s < 4; s++)
+  {
+    sketcher_t *sketcher = initScaledSketcher(kSizes[s], 1);
+    if (!sketcher || sketcher->kmer_loop == sketchKmers)
+    {
+      return ERR_sketch6;
+    }
+    int n = sketchSequence(sketcher, seq, seqLen, NULL);
+    memcpy(specialised, sketcher->sketch, n * sizeof(uint64_t));
+    sketcher->kmer_loop = sketchKmers;
+    if (n == 0 || sketchSequence(sketcher, seq, seqLen, NULL) != n || memcmp(specialised, sketcher->sketch, n * sizeof(uint64_t)) != 0)
+    {
+      return ERR_sketch6;
+    }
+    destroySketcher(sketcher);
+  }
+  free(seq);
+  free(specialised);
+  return 0;
+}
+
+/*
+  test the scaled sketch is exactly the distinct hashed k-mers under the threshold
+*/
+static char *test_scaledSketch()
+{
+  int seqLen = 20000, scales[] = {1, 10, 100}, kSizes[] = {11, 21, 31}, s, i;
+  uint64_t state = 7;
+  char *seq = malloc(seqLen);
+  uint64_t *all = malloc(seqLen * sizeof(uint64_t));
+  if (!seq || !all)
+  {
+    return ERR_alloc;
+  }
+  randomSeq(seq, seqLen, &state);
+  for (s = 0; s < 3; s++)
+  {
+    sketcher_t *sketcher = initScaledSketcher(kSizes[s], scales[s]);
+    if (!sketcher)
+    {
+      return ERR_alloc;
+    }
+
+    // sketch twice to check the sketcher resets between sequences
+    int sketchLength = sketchSequence(sketcher, seq, seqLen, NULL);
+    if (sketchSequence(sketcher, seq, seqLen, NULL) != sketchLength)
+    {
+      return ERR_sketch4;
+    }
+    int numDistinct = bruteForceHashes(seq, seqLen, kSizes[s], all), expected = 0;
+    for (i = 0; i < numDistinct && all[i] < sketcher->threshold; i++)
+    {
+      expected++;
+    }
+    if (expected == 0 || sketchLength != expected || memcmp(sketcher->sketch, all, expected * sizeof(uint64_t)) != 0)
+    {
+      return ERR_sketch4;
+    }
+    destroySketcher(sketcher);
+  }
+  free(seq);
+  free(all);
+  return 0;
+}
+
+/*
+  test the sequence sketching with a sketch larger than the old hashmap size
+*/
+static char *test_largeSketch()
+{
+  int seqLen = 20000, sketchSize = 1000, i;
+  uint64_t state = 42;
+  char *seq = malloc(seqLen + 1);
+  if (!seq)
+  {
+    return ERR_alloc;
+  }
+  for (i = 0; i < seqLen; i++)
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    seq[i] = "ACGT"[state >> 62];
+  }
+  seq[seqLen] = 0;
+  sketcher_t *sketcher = initSketcher(21, sketchSize);
+  if (!sketcher)
+  {
+    return ERR_alloc;
+  }
+  if (sketchSequence(sketcher, seq, seqLen, NULL) != sketchSize)
+  {
+    return ERR_sketchRead1;
+  }
+
+  // the sketch should hold distinct values
+  int j;
+  for (i = 0; i < sketchSize; i++)
+  {
+    for (j = i + 1; j < sketchSize; j++)
+    {
+      if (sketcher->sketch[i] == sketcher->sketch[j])
+      {
+        return ERR_sketchRead2;
+      }
+    }
+  }
+  destroySketcher(sketcher);
+  free(seq);
+  return 0;
+}
+
+/*
+  test the bloom filter (both layouts)
+*/
+static char *test_bloomfilter()
+{
+  char *testString1 = "hello, world!";
+  char *testString2 = "world, hello!";
+  int testStringLen = 13;
+  int types[] = {BLOOM_STANDARD, BLOOM_BLOCKED}, t;
+
+  for (t = 0; t < 2; t++)
+  {
+    struct bloom bloom;
+    if (bloom_init_type(&bloom, 1000000, 0.01, types[t]) != 0)
+    {
+      return ERR_bloomfilter;
+    }
+    if (bloom_check(&bloom, testString1, testStringLen))
+    {
+      return ERR_bloomfilter1;
+    }
+    bloom_add(&bloom, testString1, testStringLen);
+    if (!bloom_check(&bloom, testString1, testStringLen))
+    {
+      return ERR_bloomfilter2;
+    }
+    if (bloom_check(&bloom, testString2, testStringLen))
+    {
+      return ERR_bloomfilter3;
+    }
+
+    // fill the filter to capacity and check there are no false negatives
+    uint64_t i;
+    for (i = 0; i < 1000000; i++)
+    {
+      bloom_add(&bloom, &i, sizeof(uint64_t));
+    }
+    for (i = 0; i < 1000000; i++)
+    {
+      if (!bloom_check(&bloom, &i, sizeof(uint64_t)))
+      {
+        return ERR_bloomfilter2;
+      }
+    }
+    bloom_free(&bloom);
+
+    // hashed k-mers only use the low bits, so check the hash entry point still spreads them
+    long fp = 0;
+    if (bloom_init_type(&bloom, 1000000, 0.01, types[t]) != 0)
+    {
+      return ERR_bloomfilter;
+    }
+    for (i = 0; i < 1000000; i++)
+    {
+      bloom_add_hash(&bloom, i << 8 | 7);
+    }
+    for (i = 0; i < 1000000; i++)
+    {
+      if (!bloom_check_hash(&bloom, i << 8 | 7))
+      {
+        return ERR_bloomfilter2;
+      }
+      fp += bloom_check_hash(&bloom, (i + 1000000) << 8 | 7);
+    }
+    if (fp > 20000)
+    {
+      return ERR_bloomfilter4;
+    }
+
+    // a frozen filter can still be checked but not added to
+    bloom_freeze(&bloom);
+    if (bloom_add_hash(&bloom, 1ULL << 40) != -1 || !bloom_check_hash(&bloom, 7))
+    {
+      return ERR_bloomfilter5;
+    }
+    bloom_free(&bloom);
   }
-  bloom_free(&bloom);
   return 0;
 }
 
@@ -143,26 +651,35 @@ static char *test_sketchSeq()
   int sketchSize = 4;
   uint64_t hashedKmer = 14595;
   uint64_t dummyHashedKmer = 14596;
-  uint64_t *sketch = calloc(3, sizeof(uint64_t));
-  if (!sketch)
+  sketcher_t *sketcher = initSketcher(kSize, sketchSize);
+  if (!sketcher)
   {
     return ERR_alloc;
   }
-  sketchSequence(seq, seqLen, kSize, sketchSize, &bloom, sketch);
+  if (sketchSequence(sketcher, seq, seqLen, &bloom) == 0)
+  {
+    return ERR_sketchRead1;
+  }
 
   // confirm the bloom filter worked
-  if (!bloom_check(&bloom, &hashedKmer, kSize))
+  if (!bloom_check_hash(&bloom, hashedKmer))
   {
     return ERR_sketch1;
   }
-  if (bloom_check(&bloom, &dummyHashedKmer, kSize))
+  if (bloom_check_hash(&bloom, dummyHashedKmer))
   {
     return ERR_sketch2;
   }
 
   // TODO: validate the sketch
 
-  free(sketch);
+  // the sketcher should be reusable for the next sequence
+  if (sketchSequence(sketcher, seq, seqLen, NULL) == 0)
+  {
+    return ERR_sketchRead1;
+  }
+
+  destroySketcher(sketcher);
   bloom_free(&bloom);
   return 0;
 }
@@ -175,6 +692,13 @@ static char *all_tests()
   mu_run_test(test_hashmap);
   mu_run_test(test_bloomfilter);
   mu_run_test(test_sketchSeq);
+  mu_run_test(test_largeSketch);
+  mu_run_test(test_seqpack);
+  mu_run_test(test_kmerhash);
+  mu_run_test(test_sketchKmers);
+  mu_run_test(test_scaledSketch);
+  mu_run_test(test_longKmers);
+  mu_run_test(test_kmerLoops);
   return 0;
 }
 
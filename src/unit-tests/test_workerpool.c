@@ -0,0 +1,372 @@
+#ifndef TEST_WORKERPOOL
+#define TEST_WORKERPOOL
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../workerpool.h"
+
+#define NUM_JOBS 100000
+#define FAN_OUT 4
+#define TREE_DEPTH 7
+#define ERR_create "could not create a workerpool"
+#define ERR_pool1 "not every job ran before tpool_wait returned"
+#define ERR_pool2 "not every nested job ran before tpool_wait returned"
+#define ERR_pool3 "parked workers missed a job"
+#define ERR_pool4 "a full queue took more work than its capacity"
+#define ERR_pool5 "a full queue did not drain once the workers were free"
+#define ERR_pool6 "a pinned worker ran on the wrong CPU"
+#define ERR_pool7 "tpool_wait_timeout did not time out on a stuck job"
+#define ERR_pool8 "tpool_wait_timeout timed out after the jobs had finished"
+#define ERR_future1 "a future did not complete with its job"
+#define ERR_future2 "a completion callback did not run exactly once"
+#define ERR_future3 "a deferred future did not complete with its result"
+#define ERR_future4 "a dropped job's future was not cancelled"
+#define ERR_future5 "the drop hook was not called for each dropped job"
+
+int tests_run = 0;
+
+static tpool_t *pool;
+static long counter;
+static volatile int gateOpen;
+
+// gateJob bumps the counter and then holds its worker until the gate is opened
+static void gateJob(void *arg)
+{
+  __atomic_add_fetch(&counter, 1, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&gateOpen, __ATOMIC_SEQ_CST))
+    usleep(1000);
+}
+
+// countJob bumps the counter
+static void countJob(void *arg)
+{
+  __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+}
+
+// treeJob bumps the counter and adds FAN_OUT children from inside the pool, until TREE_DEPTH
+static void treeJob(void *arg)
+{
+  long depth = (long)arg, i;
+  __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+  if (depth == TREE_DEPTH)
+    return;
+  for (i = 0; i < FAN_OUT; i++)
+    tpool_add_work(pool, treeJob, (void *)(depth + 1));
+}
+
+/*
+  test jobs added from outside the pool all run before tpool_wait returns
+*/
+static char *test_injected()
+{
+  pool = tpool_create(4);
+  if (!pool)
+    return ERR_create;
+  int round, i;
+  for (round = 0; round < 3; round++)
+  {
+    counter = 0;
+    for (i = 0; i < NUM_JOBS; i++)
+      tpool_add_work(pool, countJob, NULL);
+    tpool_wait(pool);
+    if (__atomic_load_n(&counter, __ATOMIC_RELAXED) != NUM_JOBS)
+      return ERR_pool1;
+  }
+  tpool_destroy(pool);
+  return 0;
+}
+
+/*
+  test jobs added by jobs (which go on the worker deques and get stolen) are waited for too, including by a single worker
+*/
+static char *test_nested()
+{
+  long expected = 0, level = 1;
+  int d;
+  for (d = 0; d <= TREE_DEPTH; d++, level *= FAN_OUT)
+    expected += level;
+  size_t sizes[] = {1, 8};
+  int i;
+  for (i = 0; i < 2; i++)
+  {
+    pool = tpool_create(sizes[i]);
+    if (!pool)
+      return ERR_create;
+    counter = 0;
+    tpool_add_work(pool, treeJob, (void *)0);
+    tpool_wait(pool);
+    if (__atomic_load_n(&counter, __ATOMIC_RELAXED) != expected)
+      return ERR_pool2;
+    tpool_destroy(pool);
+  }
+  return 0;
+}
+
+/*
+  test parked workers are woken for new work, and that the pool can be destroyed with work still queued
+*/
+static char *test_parking()
+{
+  pool = tpool_create(4);
+  if (!pool)
+    return ERR_create;
+  int i;
+  for (i = 0; i < 20; i++)
+  {
+    counter = 0;
+    usleep(1000);
+    tpool_add_work(pool, countJob, NULL);
+    tpool_wait(pool);
+    if (counter != 1)
+      return ERR_pool3;
+  }
+  for (i = 0; i < 1000; i++)
+    tpool_add_work(pool, countJob, NULL);
+  tpool_destroy(pool);
+  return 0;
+}
+
+/*
+  test a bounded queue turns away (or holds up) work once it is full, and records its high-water mark
+*/
+static char *test_bounded()
+{
+  pool = tpool_create_bounded(2, 4);
+  if (!pool)
+    return ERR_create;
+  if (tpool_capacity(pool) != 4)
+    return ERR_create;
+
+  // hold both workers, then fill the queue
+  counter = 0;
+  gateOpen = 0;
+  tpool_add_work(pool, gateJob, NULL);
+  tpool_add_work(pool, gateJob, NULL);
+  while (__atomic_load_n(&counter, __ATOMIC_SEQ_CST) != 2)
+    usleep(1000);
+  int i;
+  for (i = 0; i < 4; i++)
+    if (!tpool_try_add_work(pool, countJob, NULL))
+      return ERR_pool4;
+  if (tpool_try_add_work(pool, countJob, NULL))
+    return ERR_pool4;
+  if (tpool_high_water(pool) != 4)
+    return ERR_pool4;
+
+  // let the workers go, and a blocking add waits for room rather than failing
+  gateOpen = 1;
+  for (i = 0; i < 1000; i++)
+    if (!tpool_add_work(pool, countJob, NULL))
+      return ERR_pool5;
+  tpool_wait(pool);
+  if (__atomic_load_n(&counter, __ATOMIC_SEQ_CST) != 1006)
+    return ERR_pool5;
+  if (tpool_high_water(pool) != 4)
+    return ERR_pool4;
+  tpool_destroy(pool);
+  return 0;
+}
+
+// callbackCounter counts completion callbacks
+static void callbackCounter(tpool_future_t *future, void *cbArg)
+{
+  __atomic_add_fetch((long *)cbArg, 1, __ATOMIC_SEQ_CST);
+}
+
+// finishLater completes a deferred future with a result (it runs as a separate job)
+static void finishLater(void *arg)
+{
+  usleep(10000);
+  long *result = malloc(sizeof(long));
+  *result = 42;
+  tpool_future_complete((tpool_future_t *)arg, TPOOL_DONE, result);
+}
+
+// deferJob hands its future to another job to complete
+static void deferJob(void *arg)
+{
+  tpool_add_work(pool, finishLater, tpool_defer());
+}
+
+// openGateLater opens the gate after a short wait (it runs on its own thread)
+static void *openGateLater(void *arg)
+{
+  usleep(50000);
+  __atomic_store_n(&gateOpen, 1, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+// dropped counts the jobs passed to the drop hook
+static long dropped;
+
+// dropCounter is a drop hook which counts the dropped countJobs
+static void dropCounter(thread_func_t func, void *arg)
+{
+  if (func == countJob && arg == &dropped)
+    dropped++;
+}
+
+/*
+  test futures report their status, result and timing, and run their callbacks once
+*/
+static char *test_futures()
+{
+  pool = tpool_create(4);
+  if (!pool)
+    return ERR_create;
+
+  // a plain job completes when it returns
+  long callbacks = 0;
+  counter = 0;
+  tpool_future_t *future = tpool_add_task(pool, countJob, NULL, callbackCounter, &callbacks);
+  if (future == NULL || tpool_future_wait(future) != TPOOL_DONE || counter != 1)
+    return ERR_future1;
+  if (callbacks != 1 || tpool_future_result(future) != NULL)
+    return ERR_future2;
+  double queued = -1, ran = -1;
+  tpool_future_times(future, &queued, &ran);
+  if (queued < 0 || ran < 0)
+    return ERR_future1;
+  tpool_future_release(future);
+
+  // a deferred job completes when its future is completed, with the result it was given
+  future = tpool_add_task(pool, deferJob, NULL, callbackCounter, &callbacks);
+  if (future == NULL || tpool_future_wait(future) != TPOOL_DONE)
+    return ERR_future3;
+  if (tpool_future_result(future) == NULL || *(long *)tpool_future_result(future) != 42)
+    return ERR_future3;
+  tpool_future_times(future, NULL, &ran);
+  if (ran < 0.005 || callbacks != 2)
+    return ERR_future3;
+  tpool_future_release(future);
+
+  // fire and forget, with just the callback
+  int i;
+  for (i = 0; i < 1000; i++)
+    tpool_future_release(tpool_add_task(pool, countJob, NULL, callbackCounter, &callbacks));
+  tpool_wait(pool);
+  if (__atomic_load_n(&callbacks, __ATOMIC_SEQ_CST) != 1002)
+    return ERR_future2;
+  tpool_destroy(pool);
+
+  // jobs dropped by tpool_destroy are cancelled (the gate opens once destroy has stopped the pool)
+  pool = tpool_create(2);
+  counter = 0;
+  gateOpen = 0;
+  tpool_add_work(pool, gateJob, NULL);
+  tpool_add_work(pool, gateJob, NULL);
+  while (__atomic_load_n(&counter, __ATOMIC_SEQ_CST) != 2)
+    usleep(1000);
+  future = tpool_add_task(pool, countJob, &dropped, NULL, NULL);
+  if (future == NULL || tpool_future_status(future) != TPOOL_PENDING)
+    return ERR_future4;
+  tpool_add_work(pool, countJob, &dropped);
+  dropped = 0;
+  tpool_set_drop(pool, dropCounter);
+  pthread_t opener;
+  pthread_create(&opener, NULL, openGateLater, NULL);
+  tpool_destroy(pool);
+  pthread_join(opener, NULL);
+  if (tpool_future_wait(future) != TPOOL_CANCELLED || counter != 2)
+    return ERR_future4;
+  if (dropped != 2)
+    return ERR_future5;
+  tpool_future_release(future);
+  return 0;
+}
+
+/*
+  test tpool_wait_timeout gives up on a stuck job, and returns once it is freed
+*/
+static char *test_wait_timeout()
+{
+  pool = tpool_create(2);
+  if (!pool)
+    return ERR_create;
+  counter = 0;
+  gateOpen = 0;
+  tpool_add_work(pool, gateJob, NULL);
+  if (tpool_wait_timeout(pool, 0.05))
+    return ERR_pool7;
+  __atomic_store_n(&gateOpen, 1, __ATOMIC_SEQ_CST);
+  if (!tpool_wait_timeout(pool, 10) || counter != 1)
+    return ERR_pool8;
+  tpool_destroy(pool);
+  return 0;
+}
+
+#ifdef __linux__
+static int wrongCPU;
+
+// cpuJob checks it is running on CPU 0
+static void cpuJob(void *arg)
+{
+  if (sched_getcpu() != 0)
+    __atomic_store_n(&wrongCPU, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+  test pinned workers only run on their CPUs
+*/
+static char *test_pinned()
+{
+  int cpus[] = {0};
+  pool = tpool_create_pinned(3, 0, cpus, 1);
+  if (!pool)
+    return ERR_create;
+  wrongCPU = 0;
+  int i;
+  for (i = 0; i < 1000; i++)
+    tpool_add_work(pool, cpuJob, NULL);
+  tpool_wait(pool);
+  tpool_destroy(pool);
+  if (wrongCPU)
+    return ERR_pool6;
+  return 0;
+}
+#endif
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_injected);
+  mu_run_test(test_nested);
+  mu_run_test(test_parking);
+  mu_run_test(test_bounded);
+  mu_run_test(test_futures);
+  mu_run_test(test_wait_timeout);
+#ifdef __linux__
+  mu_run_test(test_pinned);
+#endif
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tworkerpool_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "watcher.h"
+#include "readiness.h"
 #include "sequence.h"
 #include "slog.h"
 
@@ -16,14 +17,124 @@ char *getExt(const char *filename)
     return dot + 1;
 }
 
-// watcherCallback is a test callback function for when the watcher spots a change
-void watcherCallback(fsw_cevent const *const events, const unsigned int event_num, void *args)
+// isFastq returns true if the filepath has a FASTQ extension (which can be gzipped)
+// TODO: this is just an extension test for now, will make it more robust...
+bool isFastq(const char *filepath)
+{
+    char *ext = getExt(filepath);
+    if (strcmp(ext, "gz") == 0)
+    {
+        size_t len = strlen(filepath);
+        return (len > 9 && strcmp(filepath + len - 9, ".fastq.gz") == 0) || (len > 6 && strcmp(filepath + len - 6, ".fq.gz") == 0);
+    }
+    return (strcmp(ext, "fastq") == 0) || (strcmp(ext, "fq") == 0);
+}
+
+/*
+    fastqFinished is called by the workerpool as soon as a FASTQ file has been processed, and adds its result to the stats
+    - files which were read to the end (or couldn't be read at all) are taken off the checkpoint
+    - files which were stopped by a shutdown (or never started) stay on the checkpoint, to be resumed
+    - it owns the file's watcher arguments, and frees them
+*/
+static void fastqFinished(tpool_future_t *future, void *args)
 {
-    watcherArgs_t *wargs;
-    wargs = (watcherArgs_t *)args;
+    watcherArgs_t *wargs = (watcherArgs_t *)args;
+    fastqStats_t *stats = wargs->stats;
+    fastqResult_t *result = (fastqResult_t *)tpool_future_result(future);
+    tpool_status_t status = tpool_future_status(future);
+    if (status == TPOOL_CANCELLED)
+    {
+        slog(0, SLOG_LIVE, "\t- [watcher]:\tstopped %s after %ld reads", wargs->filepath, wargs->job->readsDone);
+        if (wargs->job->checkpoint == NULL)
+            checkpointFinish(wargs->job);
+        free(wargs);
+        return;
+    }
+    checkpointFinish(wargs->job);
+    free(wargs);
+    if (result == NULL)
+        return;
+    double queued, ran;
+    tpool_future_times(future, &queued, &ran);
+    if (status != TPOOL_DONE)
+    {
+        slog(0, SLOG_WARN, "\t- [watcher]:\tgave up on %s", result->filepath);
+        if (stats)
+            __atomic_add_fetch(&stats->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slog(0, SLOG_LIVE, "\t- [watcher]:\t%s took %.2fs (after %.2fs in the queue)", result->filepath, ran, queued);
+    if (stats)
+    {
+        __atomic_add_fetch(&stats->files, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->reads, result->numReads, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->sketched, result->numSketched, __ATOMIC_RELAXED);
+    }
+}
+
+// dispatchFastq sends a FASTQ file to the workerpool for processing, skipping the first readsDone reads (which were sketched by an earlier daemon)
+// returns 0 on success, DISPATCH_FULL if the workerpool queue is full (so the caller can try again later), or 1 on error
+int dispatchFastq(watcherArgs_t *wargs, const char *filepath, long readsDone)
+{
+    if (strlen(filepath) >= sizeof(wargs->filepath))
+    {
+        slog(0, SLOG_ERROR, "\t- filepath too long: %s", filepath);
+        return 1;
+    }
+
+    // create a copy of wargs which contains the newly found file (fastqFinished frees it)
+    watcherArgs_t *wargs2 = malloc(sizeof(watcherArgs_t));
+    if (wargs2 == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate watcher arguments");
+        return 1;
+    }
+    wargs2->workerPool = wargs->workerPool;
+    wargs2->stats = wargs->stats;
+    wargs2->checkpoint = wargs->checkpoint;
+    wargs2->cpus = wargs->cpus;
+    wargs2->numCpus = wargs->numCpus;
+    wargs2->bloomFilter = wargs->bloomFilter;
+    wargs2->k_size = wargs->k_size;
+    wargs2->sketch_size = wargs->sketch_size;
+    wargs2->sketch_scale = wargs->sketch_scale;
+    wargs2->ref_kmers = wargs->ref_kmers;
+    wargs2->fp_rate = wargs->fp_rate;
+    strcpy(wargs2->filepath, filepath);
+
+    // put the file on the checkpoint until it has been read to the end
+    wargs2->job = checkpointAdd(wargs->checkpoint, filepath, readsDone);
+    if (wargs2->job == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate a checkpoint job");
+        free(wargs2);
+        return 1;
+    }
+
+    // process the fastq file using the workerpool (without waiting for room, so the watcher never stalls)
+    // only the completion callback is needed, so the future is released straight away
+    tpool_future_t *future = tpool_try_add_task(wargs->workerPool, processFastq, wargs2, fastqFinished, wargs2);
+    if (future == NULL)
+    {
+        checkpointFinish(wargs2->job);
+        free(wargs2);
+        if (tpool_capacity(wargs->workerPool) != 0)
+            return DISPATCH_FULL;
+        slog(0, SLOG_ERROR, "\t- failed to send the filepath to the workerpool");
+        return 1;
+    }
+    tpool_future_release(future);
+    return 0;
+}
 
-    // set the flags from libfswatch that we want to check events against
-    int fileCheckList = Created | IsFile;
+#ifdef AM_USE_FSWATCH
+
+// watcherCallback is the libfswatch callback, which passes FASTQ file events on to the readiness stage
+// fswatch can't say when a file has been closed, so only files moved into place are treated as complete
+void watcherCallback(fsw_cevent const *const events, const unsigned int event_num, void *args)
+{
+    readiness_t *readiness;
+    readiness = (readiness_t *)args;
 
     //NoOp = 0,                     /**< No event has occurred. */
     //PlatformSpecific = (1 << 0),  /**< Platform-specific placeholder for event type that cannot currently be mapped. */
@@ -48,9 +159,7 @@ void watcherCallback(fsw_cevent const *const events, const unsigned int event_nu
         fsw_cevent const *e = &events[i];
 
         // check if the event concerns a filetype we are interested in
-        // TODO: this is just an extension test for now, will make it more robust...
-        char *ext = getExt(e->path);
-        if ((strcmp(ext, "fastq") == 0) || (strcmp(ext, "fq") == 0))
+        if (isFastq(e->path))
         {
             // combine the flags for the event into a bitmask
             unsigned int setFlags = 0;
@@ -60,40 +169,21 @@ void watcherCallback(fsw_cevent const *const events, const unsigned int event_nu
             }
 
             // use the bitmask to determine how to handle the event
-            if ((setFlags & fileCheckList) == fileCheckList)
+            if ((setFlags & IsFile) != IsFile)
             {
-                slog(0, SLOG_LIVE, "\t- [watcher]:\tfound a FASTQ file: %s", e->path);
+                continue;
             }
-            else
+            if ((setFlags & MovedTo) == MovedTo)
             {
-                if ((setFlags & 1 << 3) == 1 << 3)
-                {
-                    slog(0, SLOG_LIVE, "\t- [watcher]:\tignoring a deleted file");
-                }
-                else
-                {
-                    slog(0, SLOG_LIVE, "\t- [watcher]:\tignoring a file modification"); // TODO: is this catch right?
-                }
-                continue;
+                slog(0, SLOG_LIVE, "\t- [watcher]:\tfound a FASTQ file: %s", e->path);
+                readinessNotify(readiness, e->path, true);
             }
-
-            // create a modifed wargs which contains the newly found file
-            // TODO: this is really clunky, make it better
-            watcherArgs_t *wargs2 = malloc(sizeof(watcherArgs_t));
-            if (wargs2 == NULL)
-                slog(0, SLOG_ERROR, "could not allocate watcher arguments");
-            wargs2->workerPool = wargs->workerPool;
-            wargs2->bloomFilter = wargs->bloomFilter;
-            wargs2->k_size = wargs->k_size;
-            wargs2->sketch_size = wargs->sketch_size;
-            wargs2->fp_rate = wargs2->fp_rate;
-            strcpy(wargs2->filepath, events[i].path);
-
-            // process the fastq file using the workerpool
-            if (!tpool_add_work(wargs->workerPool, processFastq, wargs2))
+            else
             {
-                slog(0, SLOG_ERROR, "\t- failed to send the filepath to the workerpool");
+                // this includes deletions, which the readiness stage drops once the file has gone
+                readinessNotify(readiness, e->path, false);
             }
         }
     }
 }
+#endif
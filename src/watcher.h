@@ -1,19 +1,44 @@
 #ifndef WATCHER_H
 #define WATCHER_H
 
+#include <limits.h>
+#include <stdbool.h>
+
+#ifdef AM_USE_FSWATCH
 #include <libfswatch/c/libfswatch.h>
+#endif
 
 #include "bloom.h"
+#include "checkpoint.h"
 #include "workerpool.h"
 
+// DISPATCH_FULL is returned by dispatchFastq when the workerpool queue has no room for the file
+#define DISPATCH_FULL 2
+
+// fastqStats_t adds up the results of the FASTQ files that have been processed
+typedef struct fastqStats
+{
+    long files;    // files finished
+    long failed;   // files that couldn't be read
+    long reads;    // reads in the finished files
+    long sketched; // reads that were sketched
+} fastqStats_t;
+
 // watcherArgs_t
 typedef struct watcherArgs
 {
     tpool_t *workerPool;
+    fastqStats_t *stats; // updated as each file finishes (can be NULL)
+    checkpoint_t *checkpoint; // tracks the files that haven't been finished (can be NULL)
+    fastqJob_t *job;     // the file's place on the checkpoint (set by dispatchFastq)
+    const int *cpus;     // the CPUs the daemon is kept on (used for the inflate threads)
+    int numCpus;         // 0 if the daemon can run anywhere
     struct bloom *bloomFilter;
-    char filepath[50];
+    char filepath[PATH_MAX];
     int k_size;
     int sketch_size;
+    int sketch_scale;
+    int ref_kmers;
     double fp_rate;
 } watcherArgs_t;
 
@@ -21,6 +46,10 @@ typedef struct watcherArgs
     function prototypes
 */
 char *getExt(const char *filename);
+bool isFastq(const char *filepath);
+int dispatchFastq(watcherArgs_t *wargs, const char *filepath, long readsDone);
+#ifdef AM_USE_FSWATCH
 void watcherCallback(fsw_cevent const *const events, const unsigned int event_num, void *args);
+#endif
 
 #endif
\ No newline at end of file
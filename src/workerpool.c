@@ -1,34 +1,237 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "workerpool.h"
 #include "slog.h"
 
 /*
-    the worker pool is a simple linked list which stores the function to call and its arguments
+    the worker pool is a work-stealing scheduler
+
+    - each worker has its own Chase-Lev deque, which only it pushes to and pops from (LIFO, at the bottom)
+    - idle workers steal from the top of the other deques (FIFO), so the oldest work is shared out first
+    - work submitted from outside the pool (e.g. the watcher thread) goes on a global injection queue, which is
+      a ring buffer behind a mutex
+    - the injection queue can be given a capacity, after which submitters from outside the pool block (or are
+      turned away by tpool_try_add_work) until a worker takes something off it
+    - work submitted by a job that is running on a worker goes straight onto that worker's deque
+    - workers with nothing to do park on a condition variable, and each submission wakes at most one of them
+    - workers can be pinned to a list of CPUs; a pinned worker pins itself before it allocates anything, so its
+      deque and the per-thread buffers it goes on to create (sketchers, arenas) are first touched on, and so placed
+      on, its own NUMA node
+    - jobs added with tpool_add_task get a future, which records the job's status, result and timing and can run a
+      callback when the job completes; a job can defer its completion (e.g. until work it has fanned out is done)
 */
 
+// TPOOL_DEQUE_SIZE is the starting capacity of each worker's deque (it doubles when full)
+#define TPOOL_DEQUE_SIZE 256
+
+// TPOOL_INJECT_SIZE is the starting size of an unbounded injection queue (it doubles when full)
+#define TPOOL_INJECT_SIZE 64
+
 // tpool_work
 typedef struct tpool_work
 {
     thread_func_t func;
     void *arg;
-    struct tpool_work *next;
+    tpool_future_t *future; // NULL for jobs added with tpool_add_work
 } tpool_work_t;
 
+// tpool_future
+struct tpool_future
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;      // signals waiters once the future is done
+    int refs;                 // the submitter, plus the pool until the future is complete
+    tpool_status_t status;
+    bool done;                // set once the callback has run
+    void *result;             // freed with the future
+    tpool_callback_t callback;
+    void *cb_arg;
+    uint64_t submitted;       // ns on the monotonic clock
+    uint64_t started;
+    uint64_t finished;
+};
+
+// tpool_array is the circular buffer behind a deque (old buffers are kept until the pool is destroyed, as thieves may still be reading them)
+typedef struct tpool_array
+{
+    int64_t size;
+    struct tpool_array *prev;
+    tpool_work_t *buf[];
+} tpool_array_t;
+
+// tpool_worker holds a worker's deque
+typedef struct tpool_worker
+{
+    struct tpool *tp;
+    pthread_t thread;
+    int64_t top;           // thieves take from here
+    int64_t bottom;        // the owner pushes and pops here
+    tpool_array_t *array;  // the current buffer
+    uint64_t seed;         // for picking a victim to steal from
+    int cpu;               // the CPU the worker is pinned to (-1 if it can run anywhere)
+} tpool_worker_t;
+
 // tpool
 struct tpool
 {
-    tpool_work_t *work_first;    // pop objects
-    tpool_work_t *work_last;     // push objects
-    pthread_mutex_t work_mutex;  // thread lock
-    pthread_cond_t work_cond;    // signals the threads that there is work to be processed
-    pthread_cond_t working_cond; // signals when there are no threads processing
-    size_t working_cnt;          // how many threads are actively processing work
-    size_t thread_cnt;           // helps us prevent running threads from being destroyed prematurely
+    tpool_worker_t *workers;     // one per thread
+    size_t thread_cnt;           // the number of workers
+    tpool_work_t **inject;       // injection queue ring buffer
+    size_t inject_size;          // slots in the ring buffer
+    size_t inject_head;          // the next slot to pop
+    size_t inject_cnt;           // items on the injection queue
+    size_t inject_limit;         // the capacity of the injection queue (0 if unbounded)
+    size_t inject_high;          // the most items there have been on the injection queue
+    size_t blocked;              // submitters waiting for room on the injection queue
+    pthread_mutex_t work_mutex;  // protects the injection queue
+    pthread_cond_t space_cond;   // signals a blocked submitter that there is room on the injection queue
+    size_t queued;               // items waiting on the injection queue and the deques
+    size_t pending;              // items submitted but not yet finished
+    size_t sleeping;             // how many workers are parked
+    pthread_mutex_t park_mutex;  // used to park and wake the workers
+    pthread_cond_t park_cond;    // signals a parked worker that there is work
+    pthread_cond_t working_cond; // signals when there are no items pending (and when a worker has started)
+    size_t started;              // workers which have allocated their deques
     bool stop;                   // used to stop the threads
+    tpool_drop_t drop;           // called for each job that tpool_destroy drops (can be NULL)
 };
 
+// currentWorker is the worker running on this thread (NULL for threads outside any pool)
+static __thread tpool_worker_t *currentWorker = NULL;
+
+// currentFuture is the future of the job running on this thread (NULL if it doesn't have one)
+static __thread tpool_future_t *currentFuture = NULL;
+
+// tpool_now returns the monotonic clock in ns
+static uint64_t tpool_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// tpool_future_create makes a pending future, with a reference for the submitter and one for the pool
+static tpool_future_t *tpool_future_create(tpool_callback_t callback, void *cbArg)
+{
+    tpool_future_t *future = calloc(1, sizeof(tpool_future_t));
+    if (future == NULL)
+        return NULL;
+    pthread_mutex_init(&(future->mutex), NULL);
+    pthread_cond_init(&(future->cond), NULL);
+    future->refs = 2;
+    future->status = TPOOL_PENDING;
+    future->callback = callback;
+    future->cb_arg = cbArg;
+    future->submitted = tpool_now();
+    return future;
+}
+
+// tpool_future_release drops a reference to a future, and frees it (and its result) once nothing holds it
+void tpool_future_release(tpool_future_t *future)
+{
+    if (future == NULL)
+        return;
+    pthread_mutex_lock(&(future->mutex));
+    int refs = --future->refs;
+    pthread_mutex_unlock(&(future->mutex));
+    if (refs != 0)
+        return;
+    pthread_mutex_destroy(&(future->mutex));
+    pthread_cond_destroy(&(future->cond));
+    free(future->result);
+    free(future);
+}
+
+/*
+    tpool_future_complete finishes a future
+    - status should be TPOOL_DONE, TPOOL_FAILED or TPOOL_CANCELLED, and result (which can be NULL) is owned by the future from now on
+    - the callback is run on the calling thread before any waiters are woken
+    - it is only needed for jobs which have called tpool_defer, the pool completes all the others
+*/
+void tpool_future_complete(tpool_future_t *future, tpool_status_t status, void *result)
+{
+    if (future == NULL)
+        return;
+    pthread_mutex_lock(&(future->mutex));
+    if (future->status != TPOOL_PENDING && future->status != TPOOL_RUNNING)
+    {
+        pthread_mutex_unlock(&(future->mutex));
+        free(result);
+        return;
+    }
+    future->status = status;
+    future->result = result;
+    future->finished = tpool_now();
+    if (future->started == 0)
+        future->started = future->finished;
+    pthread_mutex_unlock(&(future->mutex));
+    if (future->callback != NULL)
+        future->callback(future, future->cb_arg);
+    pthread_mutex_lock(&(future->mutex));
+    future->done = true;
+    pthread_cond_broadcast(&(future->cond));
+    pthread_mutex_unlock(&(future->mutex));
+    tpool_future_release(future);
+}
+
+// tpool_defer hands the running job's future (and the pool's reference to it) over to the job, which must then complete it
+// returns NULL if the job doesn't have a future, or has already taken it
+tpool_future_t *tpool_defer()
+{
+    tpool_future_t *future = currentFuture;
+    currentFuture = NULL;
+    return future;
+}
+
+// tpool_future_wait blocks until a future is done, and returns its status
+tpool_status_t tpool_future_wait(tpool_future_t *future)
+{
+    pthread_mutex_lock(&(future->mutex));
+    while (!future->done)
+        pthread_cond_wait(&(future->cond), &(future->mutex));
+    tpool_status_t status = future->status;
+    pthread_mutex_unlock(&(future->mutex));
+    return status;
+}
+
+// tpool_future_status returns the current status of a future
+tpool_status_t tpool_future_status(tpool_future_t *future)
+{
+    pthread_mutex_lock(&(future->mutex));
+    tpool_status_t status = future->status;
+    pthread_mutex_unlock(&(future->mutex));
+    return status;
+}
+
+// tpool_future_result returns the result of a completed future (NULL if there isn't one, or it isn't complete)
+void *tpool_future_result(tpool_future_t *future)
+{
+    pthread_mutex_lock(&(future->mutex));
+    void *result = future->result;
+    pthread_mutex_unlock(&(future->mutex));
+    return result;
+}
+
+// tpool_future_times gets how long a job waited to start and how long it ran for, in seconds (so far, if it is still going)
+void tpool_future_times(tpool_future_t *future, double *queued, double *ran)
+{
+    pthread_mutex_lock(&(future->mutex));
+    uint64_t now = tpool_now();
+    uint64_t started = future->started ? future->started : now;
+    uint64_t finished = future->finished ? future->finished : now;
+    pthread_mutex_unlock(&(future->mutex));
+    if (queued != NULL)
+        *queued = (started - future->submitted) * 1e-9;
+    if (ran != NULL)
+        *ran = (finished - started) * 1e-9;
+}
+
 // tpool_work_create is used to create a work object
 static tpool_work_t *tpool_work_create(thread_func_t func, void *arg)
 {
@@ -36,9 +239,11 @@ static tpool_work_t *tpool_work_create(thread_func_t func, void *arg)
     if (func == NULL)
         return NULL;
     work = malloc(sizeof(*work));
+    if (work == NULL)
+        return NULL;
     work->func = func;
     work->arg = arg;
-    work->next = NULL;
+    work->future = NULL;
     return work;
 }
 
@@ -50,153 +255,405 @@ static void tpool_work_destroy(tpool_work_t *work)
     free(work);
 }
 
-// tpool_work_get pulls work off the queue and maintains the linked list
-static tpool_work_t *tpool_work_get(tpool_t *tp)
+// tpool_array_create makes a deque buffer (size must be a power of 2)
+static tpool_array_t *tpool_array_create(int64_t size, tpool_array_t *prev)
 {
-    tpool_work_t *work;
-
-    if (tp == NULL)
+    tpool_array_t *a = malloc(sizeof(tpool_array_t) + size * sizeof(tpool_work_t *));
+    if (a == NULL)
         return NULL;
+    a->size = size;
+    a->prev = prev;
+    return a;
+}
 
-    work = tp->work_first;
-    if (work == NULL)
-        return NULL;
+// tpool_deque_push adds work to the bottom of the calling worker's deque (owner only)
+static bool tpool_deque_push(tpool_worker_t *w, tpool_work_t *work)
+{
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    tpool_array_t *a = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+
+    // grow the buffer if it is full, copying the live items into the same slots of the bigger buffer
+    if (b - t > a->size - 1)
+    {
+        tpool_array_t *bigger = tpool_array_create(a->size * 2, a);
+        if (bigger == NULL)
+            return false;
+        int64_t i;
+        for (i = t; i < b; i++)
+            bigger->buf[i & (bigger->size - 1)] = __atomic_load_n(&a->buf[i & (a->size - 1)], __ATOMIC_RELAXED);
+        __atomic_store_n(&w->array, bigger, __ATOMIC_RELEASE);
+        a = bigger;
+    }
+    __atomic_store_n(&a->buf[b & (a->size - 1)], work, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
 
-    if (work->next == NULL)
+// tpool_deque_pop takes the newest work from the bottom of the calling worker's deque (owner only)
+static tpool_work_t *tpool_deque_pop(tpool_worker_t *w)
+{
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    tpool_array_t *a = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    tpool_work_t *work = NULL;
+    if (t <= b)
     {
-        tp->work_first = NULL;
-        tp->work_last = NULL;
+        work = __atomic_load_n(&a->buf[b & (a->size - 1)], __ATOMIC_RELAXED);
+
+        // the last item might be being stolen, so race the thieves for it
+        if (t == b)
+        {
+            if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                work = NULL;
+            __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        }
     }
     else
     {
-        tp->work_first = work->next;
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
     }
-
     return work;
 }
 
-// tpool_worker waits for work and then processes it
-static void *tpool_worker(void *arg)
+// tpool_deque_steal takes the oldest work from the top of another worker's deque (NULL if it is empty or another thief won)
+static tpool_work_t *tpool_deque_steal(tpool_worker_t *w)
 {
-    tpool_t *tp = arg;
-    tpool_work_t *work;
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return NULL;
+    tpool_array_t *a = __atomic_load_n(&w->array, __ATOMIC_ACQUIRE);
+    tpool_work_t *work = __atomic_load_n(&a->buf[t & (a->size - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return work;
+}
 
-    // keep the thread running
-    while (1)
-    {
+// tpool_work_get pulls work off the injection queue, and lets a blocked submitter know there is room
+static tpool_work_t *tpool_work_get(tpool_t *tp)
+{
+    tpool_work_t *work = NULL;
 
-        // mutex lock is used to synchronize pulling work from the queue
-        pthread_mutex_lock(&(tp->work_mutex));
+    if (__atomic_load_n(&tp->inject_cnt, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
 
-        // check we don't need to stop before pulling any work off the queue
-        if (tp->stop)
-            break;
+    pthread_mutex_lock(&(tp->work_mutex));
+    if (tp->inject_cnt != 0)
+    {
+        work = tp->inject[tp->inject_head];
+        tp->inject_head = (tp->inject_head + 1) & (tp->inject_size - 1);
+        __atomic_store_n(&tp->inject_cnt, tp->inject_cnt - 1, __ATOMIC_RELEASE);
+        if (tp->blocked != 0)
+            pthread_cond_signal(&(tp->space_cond));
+    }
+    pthread_mutex_unlock(&(tp->work_mutex));
+    return work;
+}
 
-        // check if there is any work available for processing and wait in a conditional if there is none
-        if (tp->work_first == NULL)
-            pthread_cond_wait(&(tp->work_cond), &(tp->work_mutex));
+// tpool_inject_push adds work to the back of the injection queue, growing it if it is unbounded (work_mutex must be held)
+// returns false if the queue is at its capacity or can't grow
+static bool tpool_inject_push(tpool_t *tp, tpool_work_t *work)
+{
+    if (tp->inject_limit != 0 && tp->inject_cnt >= tp->inject_limit)
+        return false;
+    if (tp->inject_cnt == tp->inject_size)
+    {
+        tpool_work_t **bigger = malloc(2 * tp->inject_size * sizeof(tpool_work_t *));
+        if (bigger == NULL)
+            return false;
+        size_t i;
+        for (i = 0; i < tp->inject_cnt; i++)
+            bigger[i] = tp->inject[(tp->inject_head + i) & (tp->inject_size - 1)];
+        free(tp->inject);
+        tp->inject = bigger;
+        tp->inject_size *= 2;
+        tp->inject_head = 0;
+    }
+    tp->inject[(tp->inject_head + tp->inject_cnt) & (tp->inject_size - 1)] = work;
+    __atomic_store_n(&tp->inject_cnt, tp->inject_cnt + 1, __ATOMIC_RELEASE);
+    if (tp->inject_cnt > tp->inject_high)
+        tp->inject_high = tp->inject_cnt;
+    return true;
+}
 
-        // once the thread was signaled there is work, get it
+// tpool_work_find gets the next job for a worker: its own deque first, then the injection queue, then stealing
+static tpool_work_t *tpool_work_find(tpool_t *tp, tpool_worker_t *w)
+{
+    tpool_work_t *work = tpool_deque_pop(w);
+    if (work == NULL)
         work = tpool_work_get(tp);
+    if (work == NULL)
+    {
 
-        // notify the pool that this thread is working
-        tp->working_cnt++;
-
-        // unlock the mutex so other threads can get work from the queue
-        pthread_mutex_unlock(&(tp->work_mutex));
-
-        /*
-            If there was work, process it and destroy the work object.
-            It is possible that there was no work at this point so there
-            isn’t anything that needs to be done.
-            
-            For example, lets say there is one piece of work and 4 threads.
-            All threads are signaled there is work.
-            Each one will unblock one at a time and pull the work, so the 
-            first thread will acquire the lock pull the work, lock and start processing. 
-            The next three will unblock and pull nothing from the queue because it’s empty.
-        */
-        if (work != NULL)
+        // try every other worker, starting from a random one
+        w->seed ^= w->seed << 13;
+        w->seed ^= w->seed >> 7;
+        w->seed ^= w->seed << 17;
+        size_t start = w->seed % tp->thread_cnt, i;
+        for (i = 0; i < tp->thread_cnt && work == NULL; i++)
         {
-            work->func(work->arg);
-            tpool_work_destroy(work);
+            tpool_worker_t *victim = &tp->workers[(start + i) % tp->thread_cnt];
+            if (victim != w)
+                work = tpool_deque_steal(victim);
         }
+    }
+    if (work != NULL)
+        __atomic_sub_fetch(&tp->queued, 1, __ATOMIC_SEQ_CST);
+    return work;
+}
+
+// tpool_park puts a worker to sleep until there is work queued or the pool is stopping
+static void tpool_park(tpool_t *tp)
+{
+    pthread_mutex_lock(&(tp->park_mutex));
+
+    // announce the worker is going to sleep, then check there is still nothing to do
+    // (a submitter bumps queued and then checks sleeping, so one of the two always sees the other)
+    __atomic_add_fetch(&tp->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tp->queued, __ATOMIC_SEQ_CST) == 0 && !__atomic_load_n(&tp->stop, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&(tp->park_cond), &(tp->park_mutex));
+    __atomic_sub_fetch(&tp->sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(tp->park_mutex));
+}
+
+// tpool_unpark wakes a single parked worker, if there are any
+static void tpool_unpark(tpool_t *tp)
+{
+    if (__atomic_load_n(&tp->sleeping, __ATOMIC_SEQ_CST) == 0)
+        return;
+    pthread_mutex_lock(&(tp->park_mutex));
+    pthread_cond_signal(&(tp->park_cond));
+    pthread_mutex_unlock(&(tp->park_mutex));
+}
+
+// tpool_work_done marks a job as finished, and lets tpool_wait know once nothing is pending
+static void tpool_work_done(tpool_t *tp)
+{
+    if (__atomic_sub_fetch(&tp->pending, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    pthread_mutex_lock(&(tp->park_mutex));
+    pthread_cond_broadcast(&(tp->working_cond));
+    pthread_mutex_unlock(&(tp->park_mutex));
+}
+
+// tpool_pin pins the calling worker to its CPU
+static void tpool_pin(tpool_worker_t *w)
+{
+    if (w->cpu < 0)
+        return;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        slog(0, SLOG_WARN, "\t- could not pin a worker to CPU %d", w->cpu);
+#else
+    slog(0, SLOG_WARN, "\t- pinning workers to CPUs is not supported on this platform");
+#endif
+}
 
-        // lock the mutex again and clean up the thread
-        pthread_mutex_lock(&(tp->work_mutex));
-        tp->working_cnt--; // notify the pool that this thread is no longer working
-        if (!tp->stop && tp->working_cnt == 0 && tp->work_first == NULL)
-            pthread_cond_signal(&(tp->working_cond));
-        pthread_mutex_unlock(&(tp->work_mutex));
+// tpool_worker finds work, processes it, and parks when there is none
+static void *tpool_worker(void *arg)
+{
+    tpool_worker_t *w = arg;
+    tpool_t *tp = w->tp;
+    tpool_work_t *work;
+    currentWorker = w;
+
+    // pin before allocating the deque, so that it is first touched on the worker's own NUMA node
+    tpool_pin(w);
+    w->array = tpool_array_create(TPOOL_DEQUE_SIZE, NULL);
+    if (w->array == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate a worker deque");
+        exit(1);
     }
+    pthread_mutex_lock(&(tp->park_mutex));
+    tp->started++;
+    pthread_cond_broadcast(&(tp->working_cond));
+    pthread_mutex_unlock(&(tp->park_mutex));
 
-    tp->thread_cnt--;
-    pthread_cond_signal(&(tp->working_cond));
-    pthread_mutex_unlock(&(tp->work_mutex));
+    // keep the thread running until the pool is stopped
+    while (!__atomic_load_n(&tp->stop, __ATOMIC_ACQUIRE))
+    {
+        work = tpool_work_find(tp, w);
+        if (work == NULL)
+        {
+            tpool_park(tp);
+            continue;
+        }
+
+        // there may be more work than awake workers, so pass the wake up along before starting on this one
+        if (__atomic_load_n(&tp->queued, __ATOMIC_SEQ_CST) != 0)
+            tpool_unpark(tp);
+        tpool_future_t *future = work->future;
+        if (future != NULL)
+        {
+            pthread_mutex_lock(&(future->mutex));
+            future->status = TPOOL_RUNNING;
+            future->started = tpool_now();
+            pthread_mutex_unlock(&(future->mutex));
+        }
+        currentFuture = future;
+        work->func(work->arg);
+
+        // the future is completed here unless the job took it with tpool_defer
+        if (currentFuture != NULL)
+            tpool_future_complete(currentFuture, TPOOL_DONE, NULL);
+        currentFuture = NULL;
+        tpool_work_destroy(work);
+        tpool_work_done(tp);
+    }
+    currentWorker = NULL;
     return NULL;
 }
 
-// tpool_create is used to create a workerpool with a specified number of workers (2 is used if num < 2)
+// tpool_create is used to create a workerpool with a specified number of workers (1 is used if num < 1) and an unbounded queue
 tpool_t *tpool_create(size_t num)
+{
+    return tpool_create_bounded(num, 0);
+}
+
+// tpool_create_bounded is used to create a workerpool whose injection queue holds at most capacity jobs (0 for unbounded)
+tpool_t *tpool_create_bounded(size_t num, size_t capacity)
+{
+    return tpool_create_pinned(num, capacity, NULL, 0);
+}
+
+// tpool_create_pinned is tpool_create_bounded, but worker i is pinned to cpus[i % numCpus] (no pinning if numCpus is 0)
+tpool_t *tpool_create_pinned(size_t num, size_t capacity, const int *cpus, size_t numCpus)
 {
     tpool_t *tp;
-    pthread_t thread;
     size_t i;
 
-    if (num < 2)
-        num = 2;
+    if (num < 1)
+        num = 1;
 
     tp = calloc(1, sizeof(*tp));
+    if (tp == NULL)
+        return NULL;
+    tp->workers = calloc(num, sizeof(tpool_worker_t));
+    if (tp->workers == NULL)
+    {
+        free(tp);
+        return NULL;
+    }
     tp->thread_cnt = num;
 
+    // the ring buffer is a power of 2 so that it can wrap with a mask
+    tp->inject_limit = capacity;
+    tp->inject_size = TPOOL_INJECT_SIZE;
+    while (tp->inject_size < capacity)
+        tp->inject_size *= 2;
+    tp->inject = malloc(tp->inject_size * sizeof(tpool_work_t *));
+    if (tp->inject == NULL)
+    {
+        free(tp->workers);
+        free(tp);
+        return NULL;
+    }
+
     pthread_mutex_init(&(tp->work_mutex), NULL);
-    pthread_cond_init(&(tp->work_cond), NULL);
+    pthread_cond_init(&(tp->space_cond), NULL);
+    pthread_mutex_init(&(tp->park_mutex), NULL);
+    pthread_cond_init(&(tp->park_cond), NULL);
     pthread_cond_init(&(tp->working_cond), NULL);
 
-    tp->work_first = NULL;
-    tp->work_last = NULL;
-
     for (i = 0; i < num; i++)
     {
-        pthread_create(&thread, NULL, tpool_worker, tp);
-        pthread_detach(thread);
+        tp->workers[i].tp = tp;
+        tp->workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        tp->workers[i].cpu = numCpus != 0 ? cpus[i % numCpus] : -1;
+    }
+    for (i = 0; i < num; i++)
+    {
+        if (pthread_create(&(tp->workers[i].thread), NULL, tpool_worker, &tp->workers[i]))
+        {
+            slog(0, SLOG_ERROR, "could not start a worker thread");
+            exit(1);
+        }
     }
 
+    // the workers allocate their own deques, and other workers can steal from them, so wait until they all have
+    pthread_mutex_lock(&(tp->park_mutex));
+    while (tp->started != num)
+        pthread_cond_wait(&(tp->working_cond), &(tp->park_mutex));
+    pthread_mutex_unlock(&(tp->park_mutex));
+
     return tp;
 }
 
-// tpool_destroy
+// tpool_work_drop destroys a job that is never going to run, passing its arg to the drop hook and then cancelling its future
+static void tpool_work_drop(tpool_t *tp, tpool_work_t *work)
+{
+    if (tp->drop != NULL)
+        tp->drop(work->func, work->arg);
+    tpool_future_complete(work->future, TPOOL_CANCELLED, NULL);
+    tpool_work_destroy(work);
+}
+
+// tpool_set_drop sets a hook which tpool_destroy calls with each job that it drops, so the job's arg can be freed
+// it must be set before the pool is destroyed, and is called on the thread destroying the pool once the workers have exited
+void tpool_set_drop(tpool_t *tp, tpool_drop_t drop)
+{
+    tp->drop = drop;
+}
+
+// tpool_destroy stops the workers once their current jobs are done, and drops any work that hasn't started (cancelling any futures)
 void tpool_destroy(tpool_t *tp)
 {
-    tpool_work_t *work;
-    tpool_work_t *work2;
+    size_t i;
 
     if (tp == NULL)
         return;
 
+    // stop and wake all the workers, then wait for them to exit
+    pthread_mutex_lock(&(tp->park_mutex));
+    __atomic_store_n(&tp->stop, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&(tp->park_cond));
+    pthread_mutex_unlock(&(tp->park_mutex));
     pthread_mutex_lock(&(tp->work_mutex));
-    work = tp->work_first;
-    while (work != NULL)
+    pthread_cond_broadcast(&(tp->space_cond));
+    pthread_mutex_unlock(&(tp->work_mutex));
+    for (i = 0; i < tp->thread_cnt; i++)
+        pthread_join(tp->workers[i].thread, NULL);
+
+    // the threads are gone, so the queues can be emptied without any care
+    for (i = 0; i < tp->inject_cnt; i++)
+        tpool_work_drop(tp, tp->inject[(tp->inject_head + i) & (tp->inject_size - 1)]);
+    free(tp->inject);
+    for (i = 0; i < tp->thread_cnt; i++)
     {
-        work2 = work->next;
-        tpool_work_destroy(work);
-        work = work2;
+        tpool_worker_t *w = &tp->workers[i];
+        int64_t j;
+        for (j = w->top; j < w->bottom; j++)
+            tpool_work_drop(tp, w->array->buf[j & (w->array->size - 1)]);
+        while (w->array != NULL)
+        {
+            tpool_array_t *prev = w->array->prev;
+            free(w->array);
+            w->array = prev;
+        }
     }
-    tp->stop = true;
-    pthread_cond_broadcast(&(tp->work_cond));
-    pthread_mutex_unlock(&(tp->work_mutex));
-
-    tpool_wait(tp);
 
     pthread_mutex_destroy(&(tp->work_mutex));
-    pthread_cond_destroy(&(tp->work_cond));
+    pthread_cond_destroy(&(tp->space_cond));
+    pthread_mutex_destroy(&(tp->park_mutex));
+    pthread_cond_destroy(&(tp->park_cond));
     pthread_cond_destroy(&(tp->working_cond));
 
+    free(tp->workers);
     free(tp);
 }
 
-// tpool_add_work
-bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg)
+// tpool_submit queues a job, and waits for room on a full injection queue if block is set
+// if the job has a future, it is only taken on by the pool if the job is queued
+static bool tpool_submit(tpool_t *tp, thread_func_t func, void *arg, bool block, tpool_future_t *future)
 {
     tpool_work_t *work;
     if (tp == NULL)
@@ -204,39 +661,153 @@ bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg)
     work = tpool_work_create(func, arg);
     if (work == NULL)
         return false;
-    pthread_mutex_lock(&(tp->work_mutex));
-    if (tp->work_first == NULL)
+    work->future = future;
+
+    // count the job as queued before it is visible, so that a worker can never take it and decrement first
+    __atomic_add_fetch(&tp->pending, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&tp->queued, 1, __ATOMIC_SEQ_CST);
+    if (currentWorker != NULL && currentWorker->tp == tp)
     {
-        tp->work_first = work;
-        tp->work_last = tp->work_first;
+
+        // a worker never blocks on the injection queue, as it could be the one that would make room
+        block = false;
+        if (tpool_deque_push(currentWorker, work))
+        {
+            tpool_unpark(tp);
+            return true;
+        }
     }
-    else
+    pthread_mutex_lock(&(tp->work_mutex));
+    bool added;
+    while (!(added = tpool_inject_push(tp, work)) && block && tp->inject_cnt != 0 && !__atomic_load_n(&tp->stop, __ATOMIC_ACQUIRE))
     {
-        tp->work_last->next = work;
-        tp->work_last = work;
+        tp->blocked++;
+        pthread_cond_wait(&(tp->space_cond), &(tp->work_mutex));
+        tp->blocked--;
     }
-    pthread_cond_broadcast(&(tp->work_cond));
     pthread_mutex_unlock(&(tp->work_mutex));
+    if (!added)
+    {
+        __atomic_sub_fetch(&tp->queued, 1, __ATOMIC_SEQ_CST);
+        tpool_work_destroy(work);
+        tpool_work_done(tp);
+        return false;
+    }
+    tpool_unpark(tp);
     return true;
 }
 
-// tpool_wait
+/*
+    tpool_add_work queues a job
+    - jobs added by a job running on one of the pool's workers go on that worker's deque
+    - anything else goes on the injection queue, waiting for room if it is full
+    - one parked worker is woken if there are any
+*/
+bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg)
+{
+    return tpool_submit(tp, func, arg, true, NULL);
+}
+
+// tpool_try_add_work is tpool_add_work, but returns false straight away if the injection queue is full
+bool tpool_try_add_work(tpool_t *tp, thread_func_t func, void *arg)
+{
+    return tpool_submit(tp, func, arg, false, NULL);
+}
+
+// tpool_add_future makes a future for a job and submits it (returning NULL if it couldn't be queued)
+static tpool_future_t *tpool_add_future(tpool_t *tp, thread_func_t func, void *arg, tpool_callback_t callback, void *cbArg, bool block)
+{
+    tpool_future_t *future = tpool_future_create(callback, cbArg);
+    if (future == NULL)
+        return NULL;
+    if (!tpool_submit(tp, func, arg, block, future))
+    {
+        future->refs = 1;
+        tpool_future_release(future);
+        return NULL;
+    }
+    return future;
+}
+
+/*
+    tpool_add_task queues a job in the same way as tpool_add_work, and returns a future for it
+    - the callback (if not NULL) is run with cbArg as soon as the job completes, on the thread that completed it
+    - the future must be released with tpool_future_release (it can be released straight away if only the callback is wanted)
+    - returns NULL if the job couldn't be queued, in which case the callback is never run
+*/
+tpool_future_t *tpool_add_task(tpool_t *tp, thread_func_t func, void *arg, tpool_callback_t callback, void *cbArg)
+{
+    return tpool_add_future(tp, func, arg, callback, cbArg, true);
+}
+
+// tpool_try_add_task is tpool_add_task, but returns NULL straight away if the injection queue is full
+tpool_future_t *tpool_try_add_task(tpool_t *tp, thread_func_t func, void *arg, tpool_callback_t callback, void *cbArg)
+{
+    return tpool_add_future(tp, func, arg, callback, cbArg, false);
+}
+
+// tpool_high_water returns the most jobs that have been waiting on the injection queue at once
+size_t tpool_high_water(tpool_t *tp)
+{
+    if (tp == NULL)
+        return 0;
+    pthread_mutex_lock(&(tp->work_mutex));
+    size_t high = tp->inject_high;
+    pthread_mutex_unlock(&(tp->work_mutex));
+    return high;
+}
+
+// tpool_capacity returns the capacity of the injection queue (0 if it is unbounded)
+size_t tpool_capacity(tpool_t *tp)
+{
+    return tp == NULL ? 0 : tp->inject_limit;
+}
+
+// tpool_num_threads returns the number of workers
+size_t tpool_num_threads(tpool_t *tp)
+{
+    return tp->thread_cnt;
+}
+
+// tpool_wait blocks until every job that has been added (including jobs added by jobs) has finished
 void tpool_wait(tpool_t *tp)
 {
     if (tp == NULL)
         return;
 
-    pthread_mutex_lock(&(tp->work_mutex));
-    while (1)
+    pthread_mutex_lock(&(tp->park_mutex));
+    while (__atomic_load_n(&tp->pending, __ATOMIC_ACQUIRE) != 0)
+        pthread_cond_wait(&(tp->working_cond), &(tp->park_mutex));
+    pthread_mutex_unlock(&(tp->park_mutex));
+}
+
+// tpool_wait_timeout is tpool_wait, but gives up after the given number of seconds
+// returns true if every job finished in time
+bool tpool_wait_timeout(tpool_t *tp, double seconds)
+{
+    if (tp == NULL)
+        return true;
+
+    // working_cond uses the realtime clock
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)seconds;
+    deadline.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if (deadline.tv_nsec >= 1000000000)
     {
-        if ((!tp->stop && tp->working_cnt != 0) || (tp->stop && tp->thread_cnt != 0))
-        {
-            pthread_cond_wait(&(tp->working_cond), &(tp->work_mutex));
-        }
-        else
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    bool finished = true;
+    pthread_mutex_lock(&(tp->park_mutex));
+    while (__atomic_load_n(&tp->pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        if (pthread_cond_timedwait(&(tp->working_cond), &(tp->park_mutex), &deadline) == ETIMEDOUT)
         {
+            finished = __atomic_load_n(&tp->pending, __ATOMIC_ACQUIRE) == 0;
             break;
         }
     }
-    pthread_mutex_unlock(&(tp->work_mutex));
-}
\ No newline at end of file
+    pthread_mutex_unlock(&(tp->park_mutex));
+    return finished;
+}
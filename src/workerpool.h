@@ -8,12 +8,46 @@
 typedef struct tpool tpool_t;
 typedef void (*thread_func_t)(void *arg);
 
+// tpool_drop_t is called with the func and arg of each job that is dropped by tpool_destroy
+typedef void (*tpool_drop_t)(thread_func_t func, void *arg);
+
+// tpool_future_t tracks a single job added with tpool_add_task
+typedef struct tpool_future tpool_future_t;
+typedef void (*tpool_callback_t)(tpool_future_t *future, void *cbArg);
+
+// tpool_status_t is the state of a future
+typedef enum tpool_status
+{
+    TPOOL_PENDING,  // queued
+    TPOOL_RUNNING,  // started (or deferred and not yet completed)
+    TPOOL_DONE,     // finished
+    TPOOL_FAILED,   // finished, but the job reported an error
+    TPOOL_CANCELLED // dropped by tpool_destroy before it started (or stopped early by the job)
+} tpool_status_t;
+
 /*
     function declarations
 */
 tpool_t* tpool_create(size_t num);
+tpool_t* tpool_create_bounded(size_t num, size_t capacity);
+tpool_t* tpool_create_pinned(size_t num, size_t capacity, const int* cpus, size_t numCpus);
 void tpool_destroy(tpool_t* tm);
+void tpool_set_drop(tpool_t* tm, tpool_drop_t drop);
 bool tpool_add_work(tpool_t* tm, thread_func_t func, void* arg);
+bool tpool_try_add_work(tpool_t* tm, thread_func_t func, void* arg);
+size_t tpool_high_water(tpool_t* tm);
+size_t tpool_capacity(tpool_t* tm);
+size_t tpool_num_threads(tpool_t* tm);
 void tpool_wait(tpool_t* tm);
+bool tpool_wait_timeout(tpool_t* tm, double seconds);
+tpool_future_t* tpool_add_task(tpool_t* tm, thread_func_t func, void* arg, tpool_callback_t callback, void* cbArg);
+tpool_future_t* tpool_try_add_task(tpool_t* tm, thread_func_t func, void* arg, tpool_callback_t callback, void* cbArg);
+tpool_future_t* tpool_defer();
+void tpool_future_complete(tpool_future_t* future, tpool_status_t status, void* result);
+tpool_status_t tpool_future_wait(tpool_future_t* future);
+tpool_status_t tpool_future_status(tpool_future_t* future);
+void* tpool_future_result(tpool_future_t* future);
+void tpool_future_times(tpool_future_t* future, double* queued, double* ran);
+void tpool_future_release(tpool_future_t* future);
 
 #endif
\ No newline at end of file